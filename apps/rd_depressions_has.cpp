@@ -10,7 +10,7 @@ template<class T>
 int PerformAlgorithm(std::string analysis, Array2D<T> elevation){
   elevation.loadData();
 
-  HasDepressions(elevation);  
+  HasDepressionsParallel(elevation);
 
   return 0;
 }
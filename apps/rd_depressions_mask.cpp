@@ -1,6 +1,8 @@
 #include <iostream>
 #include <string>
 #include <cstdlib>
+#include <cstring>
+#include <stdexcept>
 #include "richdem/common/version.hpp"
 #include "richdem/common/router.hpp"
 #include "richdem/depressions/priority_flood.hpp"
@@ -10,12 +12,15 @@
 //#include "richdem/methods/d8_methods.hpp"
 
 template<class T>
-int PerformAlgorithm(std::string output, std::string analysis, Array2D<T> elevation){
+int PerformAlgorithm(std::string output, bool parallel, std::string analysis, Array2D<T> elevation){
   elevation.loadData();
 
   Array2D<uint8_t> mask(elevation);
 
-  pit_mask(elevation, mask);
+  if(parallel)
+    parallel_pit_mask(elevation, mask);
+  else
+    pit_mask(elevation, mask);
 
   mask.saveGDAL(output, analysis);
 
@@ -24,12 +29,35 @@ int PerformAlgorithm(std::string output, std::string analysis, Array2D<T> elevat
 
 int main(int argc, char **argv){
   std::string analysis = PrintRichdemHeader(argc,argv);
-  
-  if(argc!=3){
+
+  bool        parallel = false;
+  std::string inputfile;
+  std::string outputfile;
+
+  try{
+    for(int i=1;i<argc;i++){
+      if(strcmp(argv[i],"--parallel")==0 || strcmp(argv[i],"-p")==0){
+        parallel = true;
+      } else if(argv[i][0]=='-'){
+        throw std::invalid_argument("Unrecognised flag: "+std::string(argv[i]));
+      } else if(inputfile.size()==0){
+        inputfile = argv[i];
+      } else if(outputfile.size()==0){
+        outputfile = argv[i];
+      } else {
+        throw std::invalid_argument("Too many arguments.");
+      }
+    }
+    if(inputfile.size()==0 || outputfile.size()==0)
+      throw std::invalid_argument("Too few arguments.");
+  } catch (const std::invalid_argument &ia){
     std::cerr<<"Return a raster in which 1 indicates depressions, 0 indicates non-depressions, and 3 indicates NoData."<<std::endl;
-    std::cerr<<argv[0]<<" <Input> <Output>"<<std::endl;
+    std::cerr<<argv[0]<<" [--parallel] <Input> <Output>"<<std::endl;
+    std::cerr<<"\t--parallel - Fill the DEM in tiles on all cores. Uses about three times"<<std::endl;
+    std::cerr<<"\t             the memory of the default."<<std::endl;
+    std::cerr<<"###Error: "<<ia.what()<<std::endl;
     return -1;
   }
 
-  return PerformAlgorithm(argv[1],argv[2],analysis);
+  return PerformAlgorithm(inputfile,outputfile,parallel,analysis);
 }
\ No newline at end of file
@@ -12,7 +12,7 @@
 #include <stdexcept>
 
 template<class T>
-void Master(std::string layoutfile, int cachesize, std::string outputname, std::string flip_style){
+void Master(std::string layoutfile, int cachesize, std::string outputname, std::string flip_style, std::string merge_mode){
   Timer total_time;
   total_time.start();
 
@@ -26,7 +26,14 @@ void Master(std::string layoutfile, int cachesize, std::string outputname, std::
 
   std::cerr<<"Saving results..."<<std::endl;
 
-  raster.saveUnifiedGDAL(outputname);
+  if(merge_mode=="lru")
+    raster.saveUnifiedGDAL(outputname);
+  else if(merge_mode=="stream")
+    raster.saveUnifiedGDALStreaming(outputname);
+  else if(merge_mode=="vrt")
+    raster.saveVRT(outputname);
+  else
+    throw std::runtime_error("Unrecognised merge mode '"+merge_mode+"'!");
 
   total_time.stop();
 
@@ -36,9 +43,12 @@ void Master(std::string layoutfile, int cachesize, std::string outputname, std::
 }
 
 int main(int argc, char **argv){
-  if(argc!=5){
-    std::cerr<<"Syntax: "<<argv[0]<<" <Layout File> <Cache size> <Output File> <noflip/fliph/flipv/fliphv>"<<std::endl;
+  if(argc!=5 && argc!=6){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Layout File> <Cache size> <Output File> <noflip/fliph/flipv/fliphv> [lru/stream/vrt]"<<std::endl;
     std::cerr<<"\tor use 'table' for cache size"<<std::endl;
+    std::cerr<<"\tlru    (default) Writes tiles one at a time through the tile cache"<<std::endl;
+    std::cerr<<"\tstream Writes the output a row of tiles at a time, decoding tiles in parallel. Cache size is ignored."<<std::endl;
+    std::cerr<<"\tvrt    Writes a GDAL VRT referencing the tiles in place"<<std::endl;
     return -1;
   }
   auto file_type         = peekLayoutType(argv[1]);
@@ -54,22 +64,23 @@ int main(int argc, char **argv){
   int cachesize = std::stoi(argv[2]);
   std::string output_filename(argv[3]);
   std::string flip_style(argv[4]);
+  std::string merge_mode = (argc==6)?argv[5]:"lru";
 
   switch(file_type){
     case GDT_Byte:
-      Master<uint8_t >(argv[1],cachesize,output_filename,flip_style);break;
+      Master<uint8_t >(argv[1],cachesize,output_filename,flip_style,merge_mode);break;
     case GDT_UInt16:
-      Master<uint16_t>(argv[1],cachesize,output_filename,flip_style);break;
+      Master<uint16_t>(argv[1],cachesize,output_filename,flip_style,merge_mode);break;
     case GDT_Int16:
-      Master<int16_t >(argv[1],cachesize,output_filename,flip_style);break;
+      Master<int16_t >(argv[1],cachesize,output_filename,flip_style,merge_mode);break;
     case GDT_UInt32:
-      Master<uint32_t>(argv[1],cachesize,output_filename,flip_style);break;
+      Master<uint32_t>(argv[1],cachesize,output_filename,flip_style,merge_mode);break;
     case GDT_Int32:
-      Master<int32_t >(argv[1],cachesize,output_filename,flip_style);break;
+      Master<int32_t >(argv[1],cachesize,output_filename,flip_style,merge_mode);break;
     case GDT_Float32:
-      Master<float   >(argv[1],cachesize,output_filename,flip_style);break;
+      Master<float   >(argv[1],cachesize,output_filename,flip_style,merge_mode);break;
     case GDT_Float64:
-      Master<double  >(argv[1],cachesize,output_filename,flip_style);break;
+      Master<double  >(argv[1],cachesize,output_filename,flip_style,merge_mode);break;
     default:
       std::cerr<<"Unrecognised data type!"<<std::endl;
       return -1;
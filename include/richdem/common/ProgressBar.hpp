@@ -3,11 +3,18 @@
   @brief Defines a handy progress bar object so users don't get impatient.
 
   The progress bar indicates to the user how much work has been completed, how
-  much is left, and how long it is estimated to take. It accounts for
-  multithreading by assuming uniform progress by all threads.
+  much is left, and how long it is estimated to take.
 
-  Define the global macro `NOPROGRESS` disables the progress bar, which may 
-  speed up the program.
+  Work is counted cheaply so that the progress bar can be used inside hot
+  loops: each thread counts its own work and only adds it to a shared, relaxed
+  atomic counter once every few thousand cells. The bar itself is drawn by a
+  background thread a few times a second, so the loops being measured never
+  touch the console.
+
+  Define the global macro `NOPROGRESS` disables the progress bar, which may
+  speed up the program. With it defined operator++ and update() do nothing, so
+  that no work is counted and no reporter thread is started; only the time is
+  kept.
 
   The progress bar looks like this:
 
@@ -18,19 +25,31 @@
 #ifndef _richdem_progress_bar_hpp_
 #define _richdem_progress_bar_hpp_
 
+#include <algorithm>
+#include <atomic>
 #include <string>
 #include <iostream>
 #include <iomanip>
 #include <sys/time.h>
 #include <stdexcept>
+#include <cstdint>
+#include <vector>
 #include "richdem/common/timer.hpp"
 
+#ifndef NOPROGRESS
+  #include <chrono>
+  #include <condition_variable>
+  #include <mutex>
+  #include <thread>
+#endif
+
 ///Macros used to disguise the fact that we do not have multithreading enabled.
 #ifdef _OPENMP
   #include <omp.h>
 #else
   #define omp_get_thread_num()  0
   #define omp_get_num_threads() 1
+  #define omp_get_max_threads() 1
 #endif
 
 ///@brief Manages a console-based progress bar to keep the user entertained.
@@ -38,80 +57,176 @@
 ///Defining the global `NOPROGRESS` will
 ///disable all progress operations, potentially speeding up a program. The look
 ///of the progress bar is shown in ProgressBar.hpp.
+///
+///Unless `NOPROGRESS` is defined, programs using this must be linked with
+///`-pthread` (or `-fopenmp`), since the bar is drawn by a background thread.
 class ProgressBar{
   private:
-    uint32_t total_work;    ///< Total work to be accomplished
-    uint32_t next_update;   ///< Next point to update the visible progress bar
-    uint32_t call_diff;     ///< Interval between updates in work units
-    uint32_t work_done;
-    uint16_t old_percent;   ///< Old percentage value (aka: should we update the progress bar) TODO: Maybe that we do not need this
-    Timer    timer;         ///< Used for generating ETA
+    Timer    timer;          ///< Used for generating ETA
+
+  #ifndef NOPROGRESS
+    uint64_t total_work = 0; ///< Total work to be accomplished
+
+    ///Number of units of work a thread counts before adding them to the
+    ///shared counter
+    static const uint32_t BATCH = 4096;
+
+    ///Work counted by a single thread. Padded to a cache line so that threads
+    ///do not contend for it.
+    struct alignas(64) LocalCount {
+      uint32_t n = 0;
+    };
+
+    std::atomic<uint64_t>   work_done{0};  ///< Work reported by all threads
+    std::vector<LocalCount> local;         ///< Per-thread work not yet in `work_done`
+
+    ///Add each thread's uncounted work to the shared counter
+    void flushLocal(){
+      for(auto &l: local){
+        work_done.fetch_add(l.n, std::memory_order_relaxed);
+        l.n = 0;
+      }
+    }
+
+    std::atomic<uint64_t>   work_seen{0};  ///< Most recent work passed to update()
+    std::thread             reporter;      ///< Draws the bar in the background
+    std::mutex              reporter_mutex;
+    std::condition_variable reporter_cv;
+    bool                    reporting = false;
 
     ///Clear current line on console so a new progress bar can be written
     void clearConsoleLine() const {
       std::cerr<<"\r\033[2K"<<std::flush;
     }
 
+    ///Draw the bar until stop() is called
+    void reportLoop(){
+      uint16_t old_percent = 0;
+      std::unique_lock<std::mutex> lock(reporter_mutex);
+      while(reporting){
+        reporter_cv.wait_for(lock, std::chrono::milliseconds(250));
+        if(!reporting || total_work==0)
+          break;
+
+        const uint64_t done = std::max(
+          work_done.load(std::memory_order_relaxed),
+          work_seen.load(std::memory_order_relaxed)
+        );
+
+        uint16_t percent = (uint16_t)std::min<uint64_t>(100, done*100/total_work);
+        if(percent==old_percent || percent==0)
+          continue;
+        old_percent = percent;
+
+        std::cerr<<"\r\033[2K["
+                 <<std::string(percent/2, '=')<<std::string(50-percent/2, ' ')
+                 <<"] ("
+                 <<percent<<"% - "
+                 <<std::fixed<<std::setprecision(1)<<timer.lap()/percent*(100-percent)
+                 <<"s - "
+                 <<omp_get_max_threads()<< " threads)"<<std::flush;
+      }
+    }
+
+    ///Stop the reporter thread, if it is running
+    void stopReporter(){
+      {
+        std::lock_guard<std::mutex> lock(reporter_mutex);
+        if(!reporting)
+          return;
+        reporting = false;
+      }
+      reporter_cv.notify_all();
+      reporter.join();
+      clearConsoleLine();
+    }
+  #endif
+
   public:
+  #ifndef NOPROGRESS
+    ProgressBar() : local(omp_get_max_threads()) {}
+  #else
+    ProgressBar() = default;
+  #endif
+    ProgressBar(const ProgressBar&) = delete;
+    ProgressBar& operator=(const ProgressBar&) = delete;
+
+    ~ProgressBar(){
+      #ifndef NOPROGRESS
+        stopReporter();
+      #endif
+    }
+
     ///@brief Start/reset the progress bar.
     ///@param total_work  The amount of work to be completed, usually specified in cells.
-    void start(uint32_t total_work){
+    void start(uint64_t total_work){
+      #ifndef NOPROGRESS
+        stopReporter();
+      #endif
+
       timer = Timer();
       timer.start();
-      this->total_work = total_work;
-      next_update      = 0;
-      call_diff        = total_work/200;
-      old_percent      = 0;
-      work_done        = 0;
-      clearConsoleLine();
+
+      #ifndef NOPROGRESS
+        this->total_work = total_work;
+        work_done = 0;
+        work_seen = 0;
+        local.assign(omp_get_max_threads(), LocalCount());
+        reporting = true;
+        reporter  = std::thread(&ProgressBar::reportLoop, this);
+      #else
+        (void)total_work;
+      #endif
     }
 
-    ///@brief Update the visible progress bar, but only if enough work has been done.
+    ///@brief Report the amount of work done so far.
+    ///
+    ///Within an OpenMP parallel region only thread 0's reports are used. Its
+    ///progress is assumed to be representative, so the work done is taken to
+    ///be `work_done0` times the number of threads. This costs one relaxed
+    ///atomic store; the bar itself is drawn by the reporter thread.
     ///
     ///Define the global `NOPROGRESS` flag to prevent this from having an
     ///effect. Doing so may speed up the program's execution.
-    void update(uint32_t work_done0){
-      #ifdef NOPROGRESS
-        return;
-      #endif
-
+  #ifndef NOPROGRESS
+    void update(uint64_t work_done0){
       if(omp_get_thread_num()!=0)
         return;
-
-      work_done = work_done0;
-
-      if(work_done<next_update)
-        return;
-
-      next_update += call_diff;
-
-      uint16_t percent = (uint8_t)(work_done*omp_get_num_threads()*100/total_work);
-      if(percent>100)
-        percent=100;
-      if(percent==old_percent)
-        return;
-      old_percent=percent;
-
-      std::cerr<<"\r\033[2K["
-               <<std::string(percent/2, '=')<<std::string(50-percent/2, ' ')
-               <<"] ("
-               <<percent<<"% - "
-               <<std::fixed<<std::setprecision(1)<<timer.lap()/percent*(100-percent)
-               <<"s - "
-               <<omp_get_num_threads()<< " threads)"<<std::flush;
+      work_seen.store(work_done0*omp_get_num_threads(), std::memory_order_relaxed);
     }
+  #else
+    void update(uint64_t){}
+  #endif
 
-    ///Increment by one the work done and update the progress bar
+    ///Increment by one the work done. Safe to call from multiple threads and
+    ///before start(). Does nothing if `NOPROGRESS` is defined.
+  #ifndef NOPROGRESS
+    ProgressBar& operator++(){
+      const size_t t = omp_get_thread_num();
+      if(t>=local.size()){ //More threads than when the bar was started
+        work_done.fetch_add(1, std::memory_order_relaxed);
+        return *this;
+      }
+      auto &l = local[t];
+      if(++l.n==BATCH){
+        work_done.fetch_add(BATCH, std::memory_order_relaxed);
+        l.n = 0;
+      }
+      return *this;
+    }
+  #else
     ProgressBar& operator++(){
-      work_done++;
-      update(work_done);
       return *this;
     }
+  #endif
 
     ///Stop the progress bar. Throws an exception if it wasn't started.
     ///@return The number of seconds the progress bar was running.
     double stop(){
-      clearConsoleLine();
+      #ifndef NOPROGRESS
+        stopReporter();
+        flushLocal();
+      #endif
 
       timer.stop();
       return timer.accumulated();
@@ -122,8 +237,24 @@ class ProgressBar{
       return timer.accumulated();
     }
 
-    uint32_t cellsProcessed() const {
-      return work_done;
+    ///@return The number of cells counted with operator++. If no cells were
+    ///        counted this way, the most recent work passed to update(). Always
+    ///        0 if `NOPROGRESS` is defined, since no work is counted.
+    uint64_t cellsProcessed() const {
+      #ifndef NOPROGRESS
+        const uint64_t done = work_done.load(std::memory_order_relaxed);
+        return done>0 ? done : work_seen.load(std::memory_order_relaxed);
+      #else
+        return 0;
+      #endif
+    }
+
+    ///@return Cells processed per second, as of the last call to stop()
+    double cellsPerSecond(){
+      const double time = timer.accumulated();
+      if(time==0)
+        return 0;
+      return cellsProcessed()/time;
     }
 };
 
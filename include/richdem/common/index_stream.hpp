@@ -0,0 +1,103 @@
+/**
+  @file
+  @brief A stream of linear cell indices which spills to disk when it grows
+         too large to keep in memory
+
+  Some algorithms need to revisit cells in the order in which a first pass
+  reached them. Recording that order takes 4 bytes per cell, which for very
+  large rasters may be more than can be spared. IndexStream keeps up to a given
+  number of indices in memory and writes the rest, in blocks, to a temporary
+  file which is deleted when the stream is destroyed.
+
+  Richard Barnes (rbarnes@umn.edu), 2017
+*/
+#ifndef _richdem_index_stream_hpp_
+#define _richdem_index_stream_hpp_
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <iostream>
+#include <stdexcept>
+#include <vector>
+
+///@brief An append-only sequence of cell indices which can be read back in
+///       order. Indices beyond `max_in_memory` are spilled to a temporary file.
+class IndexStream {
+ public:
+  typedef uint32_t index_t;
+
+ private:
+  std::vector<index_t> buffer;            ///< Indices not yet spilled
+  FILE                 *spill = nullptr;  ///< Temporary file of spilled indices
+  uint64_t             spilled = 0;       ///< Number of indices in the file
+  size_t               max_in_memory;
+
+  void flush(){
+    if(buffer.empty())
+      return;
+    if(spill==nullptr){
+      spill = std::tmpfile();
+      if(spill==nullptr){
+        std::cerr<<"E Could not open a temporary file for the index stream!"<<std::endl;
+        throw std::runtime_error("Could not open a temporary file for the index stream!");
+      }
+    }
+    std::fseek(spill,0,SEEK_END);
+    if(std::fwrite(buffer.data(),sizeof(index_t),buffer.size(),spill)!=buffer.size()){
+      std::cerr<<"E Could not write to the index stream's temporary file!"<<std::endl;
+      throw std::runtime_error("Could not write to the index stream's temporary file!");
+    }
+    spilled += buffer.size();
+    buffer.clear();
+  }
+
+ public:
+  ///@param max_in_memory Number of indices to keep in memory before spilling
+  ///                     to disk. The default uses at most 256 MB.
+  explicit IndexStream(const size_t max_in_memory = 64*1024*1024)
+    : max_in_memory(std::max<size_t>(max_in_memory,1)) {}
+
+  ~IndexStream(){
+    if(spill!=nullptr)
+      std::fclose(spill);
+  }
+
+  IndexStream(const IndexStream&)            = delete;
+  IndexStream& operator=(const IndexStream&) = delete;
+
+  void push_back(const index_t i){
+    buffer.push_back(i);
+    if(buffer.size()>=max_in_memory)
+      flush();
+  }
+
+  ///@return Number of indices in the stream
+  uint64_t size() const { return spilled+buffer.size(); }
+
+  ///@return Number of indices which have been spilled to disk
+  uint64_t spilledSize() const { return spilled; }
+
+  ///Call `f(index)` on each index in the order they were added
+  template<class F>
+  void forEach(F f){
+    if(spill!=nullptr){
+      std::vector<index_t> block(std::min<size_t>(max_in_memory,1<<20));
+      std::fseek(spill,0,SEEK_SET);
+      for(uint64_t done=0;done<spilled;){
+        const size_t want = (size_t)std::min<uint64_t>(block.size(),spilled-done);
+        if(std::fread(block.data(),sizeof(index_t),want,spill)!=want){
+          std::cerr<<"E Could not read from the index stream's temporary file!"<<std::endl;
+          throw std::runtime_error("Could not read from the index stream's temporary file!");
+        }
+        for(size_t j=0;j<want;j++)
+          f(block[j]);
+        done += want;
+      }
+    }
+    for(const auto i: buffer)
+      f(i);
+  }
+};
+
+#endif
@@ -0,0 +1,245 @@
+/**
+  @file
+  @brief Collects named timings, counts, and memory use so that they can be
+         written out in a machine-readable form
+
+  Algorithms report into a single, process-wide registry: ScopedTimer records
+  how long a named scope took, Instrumentation::count() adds to a named
+  counter, and Instrumentation::record() appends a row (for instance, one per
+  tile) to a named table. Each ScopedTimer also samples the process's peak
+  memory use with ProcessMemUsage().
+
+  If the environment variable `RICHDEM_STATS_JSON` is set to a filename, the
+  registry is written to that file as JSON when the program exits. A `%p` in
+  the filename is replaced by the process id, so that each process of an MPI
+  job can write its own file. Numbers which are not finite are written as
+  null. The JSON looks like this:
+
+      {
+        "timers":   {"improved_priority_flood": {"seconds": 1.2, "calls": 1, "max": 1.2}},
+        "counters": {"improved_priority_flood.pit_cells": 1234},
+        "values":   {},
+        "memory":   {"vmpeak_kb": 123456, "vmhwm_kb": 65432},
+        "records":  {"tiles": [{"gridx": 0, "gridy": 0, "calc": 0.5}]}
+      }
+
+  Richard Barnes (rbarnes@umn.edu), 2017
+*/
+#ifndef _richdem_instrumentation_hpp_
+#define _richdem_instrumentation_hpp_
+
+#include "richdem/common/memory.hpp"
+#include "richdem/common/timer.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <locale>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+#include <unistd.h>
+
+///@brief Process-wide registry of timings, counts, memory use, and records
+class Instrumentation {
+ public:
+  ///A row of a table of records, as (field name, value) pairs
+  typedef std::vector< std::pair<std::string,double> > Record;
+
+ private:
+  struct TimeStat {
+    double   seconds = 0; ///< Total time spent in the scope
+    uint64_t calls   = 0; ///< Number of times the scope was entered
+    double   max     = 0; ///< Longest single time spent in the scope
+  };
+
+  mutable std::mutex                     mtx;
+  std::map<std::string, TimeStat>        timers;
+  std::map<std::string, int64_t>         counters;
+  std::map<std::string, double>          values;
+  std::map<std::string, std::vector<Record> > records;
+  uint64_t vmpeak = 0;                   ///< Largest VmPeak sampled (kB)
+  uint64_t vmhwm  = 0;                   ///< Largest VmHWM sampled (kB)
+
+  Instrumentation() = default;
+
+  ///Escape a string for inclusion in JSON
+  static std::string jsonString(const std::string &s){
+    std::ostringstream out;
+    out<<'"';
+    for(const char c: s){
+      if(c=='"' || c=='\\')
+        out<<'\\'<<c;
+      else if((unsigned char)c<0x20)
+        out<<"\\u"<<std::hex<<std::setw(4)<<std::setfill('0')<<(int)c<<std::dec;
+      else
+        out<<c;
+    }
+    out<<'"';
+    return out.str();
+  }
+
+  ///Format a number for JSON. JSON has no NaN or infinity, so these, which
+  ///arise from timings or ratios with nothing to divide by, are written as
+  ///null. Enough digits are written to read back the same double, whatever
+  ///the formatting or locale of the stream being written to.
+  static std::string jsonNumber(const double x){
+    if(!std::isfinite(x))
+      return "null";
+    std::ostringstream out;
+    out.imbue(std::locale::classic());
+    out<<std::setprecision(std::numeric_limits<double>::max_digits10)<<x;
+    return out.str();
+  }
+
+ public:
+  Instrumentation(const Instrumentation&) = delete;
+  Instrumentation& operator=(const Instrumentation&) = delete;
+
+  ///Writes the registry to the file named by `RICHDEM_STATS_JSON`, if any
+  ~Instrumentation(){
+    const char *fname = std::getenv("RICHDEM_STATS_JSON");
+    if(fname==nullptr || fname[0]=='\0')
+      return;
+    std::string filename(fname);
+    const auto p = filename.find("%p");
+    if(p!=std::string::npos)
+      filename.replace(p,2,std::to_string(getpid()));
+    writeJSON(filename);
+  }
+
+  ///@return The process-wide registry
+  static Instrumentation& get(){
+    static Instrumentation inst;
+    return inst;
+  }
+
+  ///Add `seconds` to the named timer
+  void time(const std::string &name, const double seconds){
+    std::lock_guard<std::mutex> lock(mtx);
+    auto &t    = timers[name];
+    t.seconds += seconds;
+    t.calls++;
+    t.max      = std::max(t.max,seconds);
+  }
+
+  ///Add `n` to the named counter
+  void count(const std::string &name, const int64_t n=1){
+    std::lock_guard<std::mutex> lock(mtx);
+    counters[name] += n;
+  }
+
+  ///Set the named value, replacing any earlier value
+  void value(const std::string &name, const double val){
+    std::lock_guard<std::mutex> lock(mtx);
+    values[name] = val;
+  }
+
+  ///Append a row to the named table
+  void record(const std::string &table, const Record &row){
+    std::lock_guard<std::mutex> lock(mtx);
+    records[table].push_back(row);
+  }
+
+  ///Sample the process's memory use and keep the largest values seen. Failures
+  ///are ignored, since this is called from ScopedTimer's destructor.
+  void sampleMemory() noexcept {
+    try {
+      uint64_t peak, hwm;
+      ProcessMemUsage(peak,hwm);
+      std::lock_guard<std::mutex> lock(mtx);
+      vmpeak = std::max(vmpeak,peak);
+      vmhwm  = std::max(vmhwm, hwm);
+    } catch(...) {
+    }
+  }
+
+  ///Write the registry as JSON
+  void writeJSON(std::ostream &out) const {
+    std::lock_guard<std::mutex> lock(mtx);
+
+    out<<"{\n";
+
+    out<<"  \"timers\": {";
+    for(auto t=timers.begin();t!=timers.end();++t)
+      out<<(t==timers.begin()?"\n":",\n")<<"    "<<jsonString(t->first)
+         <<": {\"seconds\": "<<jsonNumber(t->second.seconds)
+         <<", \"calls\": "   <<t->second.calls
+         <<", \"max\": "     <<jsonNumber(t->second.max)<<"}";
+    out<<"\n  },\n";
+
+    out<<"  \"counters\": {";
+    for(auto c=counters.begin();c!=counters.end();++c)
+      out<<(c==counters.begin()?"\n":",\n")<<"    "<<jsonString(c->first)<<": "<<c->second;
+    out<<"\n  },\n";
+
+    out<<"  \"values\": {";
+    for(auto v=values.begin();v!=values.end();++v)
+      out<<(v==values.begin()?"\n":",\n")<<"    "<<jsonString(v->first)<<": "<<jsonNumber(v->second);
+    out<<"\n  },\n";
+
+    out<<"  \"memory\": {\"vmpeak_kb\": "<<vmpeak<<", \"vmhwm_kb\": "<<vmhwm<<"},\n";
+
+    out<<"  \"records\": {";
+    for(auto r=records.begin();r!=records.end();++r){
+      out<<(r==records.begin()?"\n":",\n")<<"    "<<jsonString(r->first)<<": [";
+      for(auto row=r->second.begin();row!=r->second.end();++row){
+        out<<(row==r->second.begin()?"\n":",\n")<<"      {";
+        for(auto f=row->begin();f!=row->end();++f)
+          out<<(f==row->begin()?"":", ")<<jsonString(f->first)<<": "<<jsonNumber(f->second);
+        out<<"}";
+      }
+      out<<"\n    ]";
+    }
+    out<<"\n  }\n";
+
+    out<<"}\n";
+  }
+
+  ///Write the registry as JSON to the named file
+  void writeJSON(const std::string &filename) const {
+    std::ofstream fout(filename);
+    if(!fout.good()){
+      std::cerr<<"E Could not open '"<<filename<<"' to write instrumentation!"<<std::endl;
+      return;
+    }
+    writeJSON(fout);
+  }
+};
+
+
+
+///@brief Records the time between its construction and destruction in the
+///       Instrumentation registry, and samples memory use on destruction.
+class ScopedTimer {
+ private:
+  std::string name;
+  Timer       timer;
+
+ public:
+  ///@param name  Name of the timer in the registry
+  explicit ScopedTimer(const std::string &name) : name(name) {
+    timer.start();
+  }
+
+  ScopedTimer(const ScopedTimer&) = delete;
+  ScopedTimer& operator=(const ScopedTimer&) = delete;
+
+  ///Never throws: a failure to record the timing is ignored
+  ~ScopedTimer() noexcept {
+    try {
+      Instrumentation::get().time(name, timer.stop());
+    } catch(...) {
+    }
+    Instrumentation::get().sampleMemory();
+  }
+};
+
+#endif
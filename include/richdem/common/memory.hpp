@@ -7,6 +7,8 @@
 #ifndef _memory_hpp_
 #define _memory_hpp_
 
+#include <cstdint>
+#include <cstdlib>
 #include <fstream>
 #include <string>
 
@@ -15,10 +17,13 @@
 
   This code is drawn from "http://stackoverflow.com/a/671389/752843"
 
+  Values which cannot be read are reported as 0. This never throws, so it is
+  safe to call from destructors.
+
   @param[out]   vmpeak    Peak virtual memory size (kB)
   @param[out]   vmhwm     Peak resident set size (kB)
 */
-void ProcessMemUsage(long &vmpeak, long &vmhwm){
+inline void ProcessMemUsage(uint64_t &vmpeak, uint64_t &vmhwm){
   #if defined(__linux__) || defined(__linux) || defined(linux) || defined(__gnu_linux__)
     vmpeak = 0;
     vmhwm  = 0;
@@ -35,7 +40,7 @@ void ProcessMemUsage(long &vmpeak, long &vmhwm){
       }
 
       if(line.compare(0,7,"VmPeak:")==0){        //Peak virtual memory size
-        vmpeak = std::stoi(line.substr(7));
+        vmpeak = std::strtoull(line.c_str()+7,nullptr,10);
       // } else if(line.compare(0,7,"VmSize:")==0){ //Virtual memory size
       //   std::cerr<<"T: "<<line.substr(7,10)<<std::endl;
       //   vmsize = std::stoi(line.substr(7,10));
@@ -43,7 +48,7 @@ void ProcessMemUsage(long &vmpeak, long &vmhwm){
       //   std::cerr<<"T: "<<line.substr(7,10)<<std::endl;
       //   vmrss = std::stoi(line.substr(7,10));
       } else if(line.compare(0,6,"VmHWM:")==0){  //Peak resident set size
-        vmhwm = std::stoi(line.substr(6));
+        vmhwm = std::strtoull(line.c_str()+6,nullptr,10);
       }
     }
   #else
@@ -51,4 +56,26 @@ void ProcessMemUsage(long &vmpeak, long &vmhwm){
   #endif
 }
 
+/**
+  @brief Reset the peak resident set size (VmHWM) of the process to its current
+         resident set size
+
+  After this, ProcessMemUsage() reports the peak reached by what follows, which
+  makes it possible to measure the peak of several operations in one process.
+  Requires Linux 4.0 or newer.
+
+  @return True if the peak was reset
+*/
+inline bool ResetPeakMemUsage(){
+  #if defined(__linux__) || defined(__linux) || defined(linux) || defined(__gnu_linux__)
+    std::ofstream fout("/proc/self/clear_refs");
+    if(!fout.good())
+      return false;
+    fout<<"5"<<std::flush;
+    return fout.good();
+  #else
+    return false;
+  #endif
+}
+
 #endif
@@ -0,0 +1,529 @@
+/**
+  @file
+  @brief Priority queues of grid cells for the Priority-Flood family
+
+  The Priority-Flood algorithms in priority_flood.hpp take the queue they use
+  for the open set as a template parameter. Any class template `Queue<elev_t>`
+  can be used if it provides:
+
+      void                     emplace(int x, int y, elev_t z); //Add a cell
+      const GridCellZ<elev_t>& top()   const;                   //Lowest cell
+      void                     pop();                           //Remove it
+      size_t                   size()  const;
+      bool                     empty() const;
+
+  where top() returns a cell of lowest elevation and NaN elevations are taken
+  to be lower than any other. GridCellZ_pq, a binary heap built on
+  std::priority_queue, is the default. The queues here order cells by an
+  unsigned integer key which sorts the same way as the elevations, so that
+  comparisons are cheap whatever the elevation type.
+
+  StableBucketQueue pops cells of equal elevation in the order they were added,
+  as GridCellZk_pq does, but without storing an insertion counter with each
+  cell.
+
+  RadixHeapQueue is monotone: it assumes no cell is pushed which is lower than
+  the last cell popped. This holds for the filling algorithms, which raise each
+  cell to at least the level of the cell it was reached from before pushing it.
+  Cells which break the assumption are treated as being at the level of the last
+  cell popped. This is the level they would be filled to, so filled elevations
+  are unchanged, but flow directions or labels may come out differently.
+
+  Richard Barnes (rbarnes@umn.edu), 2017
+*/
+#ifndef _richdem_priority_queues_hpp_
+#define _richdem_priority_queues_hpp_
+
+#include "richdem/common/grid_cell.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <limits>
+#include <type_traits>
+#include <vector>
+
+///@brief Maps elevations to unsigned integers which sort in the same order.
+///       NaN maps to 0, the smallest key. Equal elevations, including -0 and
+///       +0, have equal keys.
+template<class elev_t>
+class ElevationKey {
+ public:
+  ///Keys are 32 bits for elevation types of 4 or fewer bytes and 64 otherwise
+  typedef typename std::conditional<sizeof(elev_t)<=4, uint32_t, uint64_t>::type key_t;
+
+  ///Number of bits in a key
+  static const int BITS = 8*sizeof(key_t);
+
+  ///@return The key of elevation `z`. Keys use the high bits of key_t, so a
+  ///        8-bit elevation yields keys which are multiples of 2^24.
+  static key_t get(const elev_t z){
+    return getImpl(z, std::is_floating_point<elev_t>());
+  }
+
+ private:
+  static key_t getImpl(const elev_t z, std::true_type){
+    typedef typename std::conditional<sizeof(elev_t)==4, uint32_t, uint64_t>::type bits_t;
+    if(std::isnan(z))
+      return 0;
+    const elev_t zz = (z==0) ? elev_t(0) : z; //-0 becomes +0
+    bits_t b;
+    std::memcpy(&b,&zz,sizeof(zz));
+    const bits_t sign = bits_t(1)<<(8*sizeof(bits_t)-1);
+    b = (b & sign) ? ~b : (b | sign);
+    return (key_t)b;
+  }
+
+  static key_t getImpl(const elev_t z, std::false_type){
+    typedef typename std::make_unsigned<elev_t>::type u_t;
+    u_t u = (u_t)z;
+    if(std::is_signed<elev_t>::value)
+      u ^= (u_t)(u_t(1)<<(8*sizeof(u_t)-1));
+    return (key_t)((key_t)u << (BITS-8*sizeof(u_t)));
+  }
+};
+
+
+
+///@brief A grid cell stored along with its key
+template<class elev_t>
+class KeyedGridCellZ {
+ public:
+  typedef typename ElevationKey<elev_t>::key_t key_t;
+  key_t             key;
+  GridCellZ<elev_t> c;
+  KeyedGridCellZ() = default;
+  KeyedGridCellZ(const key_t key, const int x, const int y, const elev_t z) : key(key), c(x,y,z) {}
+};
+
+
+
+///@brief A d-ary heap of grid cells. Wider heaps are shallower, trading more
+///       comparisons per level for fewer cache misses.
+template<class elev_t, int D>
+class DaryHeapQueue {
+ private:
+  typedef KeyedGridCellZ<elev_t> entry_t;
+  std::vector<entry_t> heap;
+
+  void siftUp(size_t i){
+    entry_t e = heap[i];
+    while(i>0){
+      const size_t parent = (i-1)/D;
+      if(heap[parent].key<=e.key)
+        break;
+      heap[i] = heap[parent];
+      i       = parent;
+    }
+    heap[i] = e;
+  }
+
+  void siftDown(size_t i){
+    const size_t n = heap.size();
+    entry_t e = heap[i];
+    while(true){
+      const size_t first = D*i+1;
+      if(first>=n)
+        break;
+      const size_t last = std::min(first+D,n);
+      size_t best = first;
+      for(size_t c=first+1;c<last;c++)
+        if(heap[c].key<heap[best].key)
+          best = c;
+      if(e.key<=heap[best].key)
+        break;
+      heap[i] = heap[best];
+      i       = best;
+    }
+    heap[i] = e;
+  }
+
+ public:
+  void emplace(const int x, const int y, const elev_t z){
+    heap.emplace_back(ElevationKey<elev_t>::get(z),x,y,z);
+    siftUp(heap.size()-1);
+  }
+
+  const GridCellZ<elev_t>& top() const {
+    return heap.front().c;
+  }
+
+  void pop(){
+    heap.front() = heap.back();
+    heap.pop_back();
+    if(!heap.empty())
+      siftDown(0);
+  }
+
+  size_t size()  const { return heap.size();  }
+  bool   empty() const { return heap.empty(); }
+};
+
+///@brief A binary heap ordered by integer keys
+template<class elev_t>
+using BinaryHeapQueue = DaryHeapQueue<elev_t,2>;
+
+///@brief A 4-ary heap ordered by integer keys
+template<class elev_t>
+using QuaternaryHeapQueue = DaryHeapQueue<elev_t,4>;
+
+
+
+///@brief A pairing heap of grid cells. Nodes live in a single vector and are
+///       recycled through a free list.
+template<class elev_t>
+class PairingHeapQueue {
+ private:
+  typedef KeyedGridCellZ<elev_t> entry_t;
+  static const int32_t NONE = -1;
+
+  struct Node {
+    entry_t e;
+    int32_t child;   ///< First child
+    int32_t sibling; ///< Next sibling, or the next free node
+  };
+
+  std::vector<Node>    nodes;
+  std::vector<int32_t> pairs; ///< Scratch space used by pop()
+  int32_t root      = NONE;
+  int32_t free_list = NONE;
+  size_t  count     = 0;
+
+  ///Make the root with the larger key a child of the other
+  int32_t meld(const int32_t a, const int32_t b){
+    if(a==NONE) return b;
+    if(b==NONE) return a;
+    if(nodes[b].e.key<nodes[a].e.key){
+      nodes[a].sibling = nodes[b].child;
+      nodes[b].child   = a;
+      return b;
+    } else {
+      nodes[b].sibling = nodes[a].child;
+      nodes[a].child   = b;
+      return a;
+    }
+  }
+
+ public:
+  void emplace(const int x, const int y, const elev_t z){
+    int32_t n;
+    if(free_list!=NONE){
+      n         = free_list;
+      free_list = nodes[n].sibling;
+    } else {
+      n = (int32_t)nodes.size();
+      nodes.emplace_back();
+    }
+    nodes[n].e       = entry_t(ElevationKey<elev_t>::get(z),x,y,z);
+    nodes[n].child   = NONE;
+    nodes[n].sibling = NONE;
+    root = meld(root,n);
+    count++;
+  }
+
+  const GridCellZ<elev_t>& top() const {
+    return nodes[root].e.c;
+  }
+
+  void pop(){
+    const int32_t old = root;
+
+    //Two-pass merge: meld the children in pairs from left to right, then meld
+    //the pairs together from right to left
+    pairs.clear();
+    int32_t c = nodes[old].child;
+    while(c!=NONE){
+      const int32_t a = c;
+      const int32_t b = nodes[a].sibling;
+      c = (b==NONE) ? NONE : nodes[b].sibling;
+      nodes[a].sibling = NONE;
+      if(b!=NONE)
+        nodes[b].sibling = NONE;
+      pairs.push_back(meld(a,b));
+    }
+    root = NONE;
+    for(auto p=pairs.rbegin();p!=pairs.rend();++p)
+      root = meld(root,*p);
+
+    nodes[old].sibling = free_list;
+    free_list          = old;
+    count--;
+  }
+
+  size_t size()  const { return count;    }
+  bool   empty() const { return count==0; }
+};
+
+
+
+///@brief A monotone radix heap of grid cells. Cells are kept in buckets by the
+///       highest bit in which their key differs from the key of the last cell
+///       popped. See the note in priority_queues.hpp on monotonicity.
+template<class elev_t>
+class RadixHeapQueue {
+ private:
+  typedef KeyedGridCellZ<elev_t>              entry_t;
+  typedef typename ElevationKey<elev_t>::key_t key_t;
+  static const int BITS = ElevationKey<elev_t>::BITS;
+
+  //top() may need to redistribute the buckets, so they are mutable
+  mutable std::vector<entry_t> buckets[BITS+1];
+  mutable key_t                last  = 0;
+  size_t                       count = 0;
+
+  static int highBit(const key_t v){
+    int b = 0;
+    for(key_t t=v;t;t>>=1)
+      b++;
+    return b;
+  }
+
+  int bucketOf(const key_t key) const {
+    return (key==last) ? 0 : highBit(key^last);
+  }
+
+  ///Make sure bucket 0 holds the cells with the smallest key
+  void refill() const {
+    if(!buckets[0].empty())
+      return;
+    int i = 1;
+    while(buckets[i].empty())
+      i++;
+    key_t mn = buckets[i].front().key;
+    for(const auto &e: buckets[i])
+      mn = std::min(mn,e.key);
+    last = mn;
+    for(const auto &e: buckets[i])
+      buckets[bucketOf(e.key)].push_back(e);
+    buckets[i].clear();
+  }
+
+ public:
+  void emplace(const int x, const int y, const elev_t z){
+    const key_t key = std::max(ElevationKey<elev_t>::get(z),last);
+    buckets[bucketOf(key)].emplace_back(key,x,y,z);
+    count++;
+  }
+
+  const GridCellZ<elev_t>& top() const {
+    refill();
+    return buckets[0].back().c;
+  }
+
+  void pop(){
+    refill();
+    buckets[0].pop_back();
+    count--;
+  }
+
+  size_t size()  const { return count;    }
+  bool   empty() const { return count==0; }
+};
+
+
+
+///@brief A two-level bucket queue of grid cells. The top 16 bits of the key
+///       choose one of 65536 buckets, each of which is a small binary heap on
+///       the full key. A bitmap of non-empty buckets makes finding the lowest
+///       one cheap. Unlike RadixHeapQueue, cells may be pushed in any order.
+template<class elev_t>
+class BucketQueue {
+ private:
+  typedef KeyedGridCellZ<elev_t>              entry_t;
+  typedef typename ElevationKey<elev_t>::key_t key_t;
+  static const int      BITS     = ElevationKey<elev_t>::BITS;
+  static const uint32_t NBUCKETS = 1u<<16;
+
+  struct Greater {
+    bool operator()(const entry_t &a, const entry_t &b) const { return a.key>b.key; }
+  };
+
+  std::vector< std::vector<entry_t> > buckets;
+  std::vector<uint64_t>               nonempty; ///< Bit b is set if bucket b has cells
+  uint32_t cursor = NBUCKETS;                   ///< Lowest non-empty bucket
+  size_t   count  = 0;
+
+  static uint32_t bucketOf(const key_t key){
+    return (uint32_t)(key>>(BITS-16));
+  }
+
+ public:
+  BucketQueue() : buckets(NBUCKETS), nonempty(NBUCKETS/64,0) {}
+
+  void emplace(const int x, const int y, const elev_t z){
+    const key_t    key = ElevationKey<elev_t>::get(z);
+    const uint32_t b   = bucketOf(key);
+    auto &bucket = buckets[b];
+    bucket.emplace_back(key,x,y,z);
+    std::push_heap(bucket.begin(),bucket.end(),Greater());
+    nonempty[b/64] |= uint64_t(1)<<(b%64);
+    cursor = std::min(cursor,b);
+    count++;
+  }
+
+  const GridCellZ<elev_t>& top() const {
+    return buckets[cursor].front().c;
+  }
+
+  void pop(){
+    auto &bucket = buckets[cursor];
+    std::pop_heap(bucket.begin(),bucket.end(),Greater());
+    bucket.pop_back();
+    count--;
+    if(!bucket.empty())
+      return;
+
+    nonempty[cursor/64] &= ~(uint64_t(1)<<(cursor%64));
+    uint32_t w = cursor/64;
+    while(w<NBUCKETS/64 && nonempty[w]==0)
+      w++;
+    if(w==NBUCKETS/64){
+      cursor = NBUCKETS;
+      return;
+    }
+    uint64_t bits = nonempty[w];
+    uint32_t b    = 0;
+    while(!(bits & 1)){
+      bits >>= 1;
+      b++;
+    }
+    cursor = 64*w+b;
+  }
+
+  size_t size()  const { return count;    }
+  bool   empty() const { return count==0; }
+};
+
+
+
+///@brief A priority queue of grid cells which pops cells of equal elevation in
+///       the order they were added.
+///
+/// Cells of equal elevation are appended to FIFO buckets. A binary heap holds
+/// one entry per bucket, ordered by elevation and then by when the bucket was
+/// opened, and keeps the bucket's first cell inline. A cell joins the newest
+/// bucket of its elevation if that bucket is still open and can be found in a
+/// small cache; otherwise it opens a new bucket. Either way cells come out in
+/// the order they went in. On flats most cells share a bucket, so the heap is
+/// small and popping them does not reorder it.
+///
+/// Buckets are numbered with 32-bit counters. Should these run out, the open
+/// buckets are renumbered, so there is no limit on the number of cells.
+template<class elev_t>
+class StableBucketQueue {
+ private:
+  typedef typename ElevationKey<elev_t>::key_t key_t;
+
+  struct HeapEntry {
+    key_t             key;
+    uint32_t          seq;    ///< Order in which the bucket was opened
+    uint32_t          bucket;
+    GridCellZ<elev_t> c;      ///< Next cell of the bucket
+    bool operator>(const HeapEntry &o) const {
+      return key>o.key || (key==o.key && seq>o.seq);
+    }
+  };
+
+  ///Cells waiting behind the one in the heap
+  struct Bucket {
+    std::vector< GridCellZ<elev_t> > cells;
+    size_t head = 0; ///< Index of the next cell to move into the heap
+    key_t  key  = 0;
+  };
+
+  static const uint32_t NONE        = std::numeric_limits<uint32_t>::max();
+  static const uint32_t CACHE_SLOTS = 256;
+
+  std::vector<HeapEntry> heap;         ///< Min-heap of open buckets
+  std::vector<Bucket>    buckets;
+  std::vector<uint32_t>  free_buckets;
+  uint32_t cache[CACHE_SLOTS];         ///< Newest open bucket of keys hashing to each slot
+  uint32_t next_seq = 0;
+  size_t   count    = 0;
+
+  static uint32_t slotOf(const key_t key){
+    return (uint32_t)((key ^ (key>>16) ^ (key>>(ElevationKey<elev_t>::BITS-8))) % CACHE_SLOTS);
+  }
+
+  ///Number the open buckets 0,1,2,... in the order they are popped. A sorted
+  ///array is a valid heap.
+  void renumber(){
+    std::sort(heap.begin(),heap.end(),[](const HeapEntry &a, const HeapEntry &b){ return b>a; });
+    next_seq = 0;
+    for(auto &e: heap)
+      e.seq = next_seq++;
+  }
+
+ public:
+  StableBucketQueue(){
+    std::fill(cache,cache+CACHE_SLOTS,NONE);
+  }
+
+  void emplace(const int x, const int y, const elev_t z){
+    const key_t    key  = ElevationKey<elev_t>::get(z);
+    const uint32_t slot = slotOf(key);
+    count++;
+
+    const uint32_t cb = cache[slot];
+    if(cb!=NONE && buckets[cb].key==key){
+      buckets[cb].cells.emplace_back(x,y,z);
+      return;
+    }
+
+    uint32_t b;
+    if(!free_buckets.empty()){
+      b = free_buckets.back();
+      free_buckets.pop_back();
+    } else {
+      b = (uint32_t)buckets.size();
+      buckets.emplace_back();
+    }
+    buckets[b].key = key;
+    cache[slot]    = b;
+
+    if(next_seq==NONE)
+      renumber();
+    heap.push_back(HeapEntry{key,next_seq++,b,GridCellZ<elev_t>(x,y,z)});
+    std::push_heap(heap.begin(),heap.end(),std::greater<HeapEntry>());
+  }
+
+  const GridCellZ<elev_t>& top() const {
+    return heap.front().c;
+  }
+
+  void pop(){
+    count--;
+    HeapEntry &front = heap.front();
+    const uint32_t b = front.bucket;
+    auto &bucket = buckets[b];
+
+    if(bucket.head<bucket.cells.size()){
+      //The next cell of the bucket has the same key and sequence number, so it
+      //replaces the top of the heap without reordering it
+      front.c = bucket.cells[bucket.head++];
+      //A bucket which is being filled while it is emptied, as happens on a
+      //flat, would otherwise hold every cell which ever passed through it
+      if(bucket.head>=4096 && 2*bucket.head>=bucket.cells.size()){
+        bucket.cells.erase(bucket.cells.begin(),bucket.cells.begin()+bucket.head);
+        bucket.head = 0;
+      }
+      return;
+    }
+
+    //The bucket is empty: close it and recycle it
+    bucket.cells.clear();
+    bucket.head = 0;
+    const uint32_t slot = slotOf(bucket.key);
+    if(cache[slot]==b)
+      cache[slot] = NONE;
+    free_buckets.push_back(b);
+    std::pop_heap(heap.begin(),heap.end(),std::greater<HeapEntry>());
+    heap.pop_back();
+  }
+
+  size_t size()  const { return count;    }
+  bool   empty() const { return count==0; }
+};
+
+#endif
@@ -0,0 +1,223 @@
+/**
+  @file
+  @brief Records timelines of begin/end events and writes them in the Chrome
+         trace format
+
+  Each process records the phases it goes through (loading a tile, computing,
+  sending results, and so on) as complete events with a start time and a
+  duration. The events of several processes can be gathered into one list and
+  written as a single JSON file which can be opened with `chrome://tracing` or
+  https://ui.perfetto.dev. Each process appears as its own row, so idle time
+  and waiting show up as gaps.
+
+  Event times are taken from the system clock so that events recorded by
+  different processes, possibly on different machines, line up. Recording an
+  event costs a clock read and a push_back, so events are always recorded;
+  writing them out is optional.
+
+  Richard Barnes (rbarnes@umn.edu), 2017
+*/
+#ifndef _richdem_trace_hpp_
+#define _richdem_trace_hpp_
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+///@brief A single complete ("X") event of a trace
+class TraceEvent {
+ public:
+  std::string name;                         ///< Name of the phase
+  std::string cat;                          ///< Category, e.g. "io" or "calc"
+  int32_t     pid = 0;                      ///< Process (MPI rank) that recorded the event
+  uint64_t    ts  = 0;                      ///< Start time in microseconds since the epoch
+  uint64_t    dur = 0;                      ///< Duration in microseconds
+  std::map<std::string,std::string> args;   ///< Extra information shown by the viewer
+
+  template<class Archive>
+  void serialize(Archive &ar){
+    ar(name,cat,pid,ts,dur,args);
+  }
+};
+
+
+
+///@brief Per-process list of trace events
+class Trace {
+ private:
+  std::vector<TraceEvent>       events;
+  std::map<int32_t,std::string> process_names;
+  int32_t                       pid = 0;
+
+  Trace() = default;
+
+  static std::string jsonString(const std::string &s){
+    std::ostringstream out;
+    out<<'"';
+    for(const char c: s){
+      if(c=='"' || c=='\\')
+        out<<'\\'<<c;
+      else if((unsigned char)c<0x20)
+        out<<' ';
+      else
+        out<<c;
+    }
+    out<<'"';
+    return out.str();
+  }
+
+ public:
+  Trace(const Trace&) = delete;
+  Trace& operator=(const Trace&) = delete;
+
+  ///@return The process-wide trace
+  static Trace& get(){
+    static Trace trace;
+    return trace;
+  }
+
+  ///@return Microseconds since the epoch according to the system clock
+  static uint64_t now(){
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+      std::chrono::system_clock::now().time_since_epoch()
+    ).count();
+  }
+
+  ///@brief Set the id (usually the MPI rank) attached to this process's events
+  void setProcess(const int32_t pid){
+    this->pid = pid;
+  }
+
+  ///@brief Set the name the viewer shows for a process's row
+  void nameProcess(const int32_t pid, const std::string &name){
+    process_names[pid] = name;
+  }
+
+  ///@brief Add a complete event which started at `start` and ends now
+  void add(
+    const std::string &name,
+    const std::string &cat,
+    const uint64_t start,
+    const std::map<std::string,std::string> &args = {}
+  ){
+    TraceEvent ev;
+    ev.name = name;
+    ev.cat  = cat;
+    ev.pid  = pid;
+    ev.ts   = start;
+    ev.dur  = now()-start;
+    ev.args = args;
+    events.push_back(std::move(ev));
+  }
+
+  ///@return The events recorded so far
+  const std::vector<TraceEvent>& getEvents() const {
+    return events;
+  }
+
+  ///@brief Add events recorded by another process
+  void merge(const std::vector<TraceEvent> &other){
+    events.insert(events.end(), other.begin(), other.end());
+  }
+
+  ///@brief Write all events in the Chrome trace format. Times are written
+  ///       relative to the earliest event.
+  void writeJSON(std::ostream &out) const {
+    uint64_t t0 = std::numeric_limits<uint64_t>::max();
+    for(const auto &ev: events)
+      t0 = std::min(t0,ev.ts);
+
+    //Every process which recorded an event gets a row, named if possible
+    std::map<int32_t,std::string> names;
+    for(const auto &ev: events)
+      names[ev.pid] = "Process "+std::to_string(ev.pid);
+    for(const auto &pn: process_names)
+      names[pn.first] = pn.second;
+
+    out<<"{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+    bool first = true;
+    for(const auto &pn: names){
+      out<<(first?"\n":",\n")
+         <<"  {\"name\": \"process_name\", \"ph\": \"M\", \"pid\": "<<pn.first
+         <<", \"tid\": 0, \"args\": {\"name\": "<<jsonString(pn.second)<<"}},\n"
+         <<"  {\"name\": \"process_sort_index\", \"ph\": \"M\", \"pid\": "<<pn.first
+         <<", \"tid\": 0, \"args\": {\"sort_index\": "<<pn.first<<"}}";
+      first = false;
+    }
+    for(const auto &ev: events){
+      out<<(first?"\n":",\n")
+         <<"  {\"name\": "<<jsonString(ev.name)
+         <<", \"cat\": " <<jsonString(ev.cat)
+         <<", \"ph\": \"X\", \"pid\": "<<ev.pid
+         <<", \"tid\": 0, \"ts\": "<<(ev.ts-t0)
+         <<", \"dur\": "<<ev.dur;
+      if(!ev.args.empty()){
+        out<<", \"args\": {";
+        for(auto a=ev.args.begin();a!=ev.args.end();++a)
+          out<<(a==ev.args.begin()?"":", ")<<jsonString(a->first)<<": "<<jsonString(a->second);
+        out<<"}";
+      }
+      out<<"}";
+      first = false;
+    }
+    out<<"\n]}\n";
+  }
+
+  ///@brief Write all events in the Chrome trace format to the named file
+  void writeJSON(const std::string &filename) const {
+    std::ofstream fout(filename);
+    if(!fout.good()){
+      std::cerr<<"E Could not open '"<<filename<<"' to write the trace!"<<std::endl;
+      return;
+    }
+    writeJSON(fout);
+    std::cerr<<"m Trace events written = "<<events.size()<<std::endl;
+  }
+};
+
+
+
+///@brief Adds an event to the process's Trace covering the time between its
+///       construction and destruction, or until end() is called.
+class TraceScope {
+ private:
+  std::string name, cat;
+  std::map<std::string,std::string> args;
+  uint64_t start;
+  bool     ended = false;
+
+ public:
+  ///@param name  Name of the phase
+  ///@param cat   Category of the phase, e.g. "io" or "calc"
+  ///@param args  Extra information shown by the viewer
+  TraceScope(
+    const std::string &name,
+    const std::string &cat,
+    const std::map<std::string,std::string> &args = {}
+  ) : name(name), cat(cat), args(args), start(Trace::now()) {}
+
+  TraceScope(const TraceScope&) = delete;
+  TraceScope& operator=(const TraceScope&) = delete;
+
+  ///@brief End the event before the scope does
+  void end(){
+    if(ended)
+      return;
+    Trace::get().add(name,cat,start,args);
+    ended = true;
+  }
+
+  ~TraceScope(){
+    end();
+  }
+};
+
+#endif
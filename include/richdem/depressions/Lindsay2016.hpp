@@ -2,10 +2,19 @@
 #define _richdem_lindsay2016_hpp_
 
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/grid_cell.hpp"
+#include "richdem/common/index_stream.hpp"
+#include "richdem/common/priority_queues.hpp"
 #include "richdem/common/ProgressBar.hpp"
 #include "richdem/common/timer.hpp"
+#include "richdem/depressions/priority_flood.hpp"
+#include <algorithm>
+#include <cmath>
 #include <limits>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
 
 enum LindsayMode {
   COMPLETE_BREACHING,
@@ -19,7 +28,26 @@ enum LindsayCellType {
   EDGE
 };
 
-template<class T>
+/**
+  @brief  Breaches and, optionally, fills the depressions of a DEM (Lindsay 2016)
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Breach paths are lowered by the smallest step the elevations can represent,
+  so only floating-point DEMs are accepted.
+
+  @tparam         Queue             Priority queue used for the open set (see
+                                    priority_queues.hpp). It must pop cells of
+                                    equal elevation in the order they were
+                                    added, as StableBucketQueue and
+                                    GridCellZk_pq do, since the order in which
+                                    flats are visited decides the breach paths.
+  @param[in,out]  &dem              A grid of cell elevations
+  @param[in]      mode              Complete, selective, or constrained breaching
+  @param[in]      fill_depressions  Fill depressions which cannot be breached
+  @param[in]      maxpathlen        Longest breach path allowed, when selective
+  @param[in]      maxdepth          Deepest breach allowed, when selective
+*/
+template<template<class> class Queue = StableBucketQueue, class T>
 void Lindsay2016(
   Array2D<T>  &dem,
   LindsayMode mode,
@@ -27,6 +55,9 @@ void Lindsay2016(
   uint32_t    maxpathlen,
   T           maxdepth
 ){
+  static_assert(std::is_floating_point<T>::value, "Lindsay2016 lowers breach paths by the smallest representable step, so it needs floating-point elevations!");
+
+  ScopedTimer scoped_timer("Lindsay2016");
   std::cerr<<"\nA Lindsay2016: Breach/Fill Depressions"<<std::endl;
   std::cerr<<"C Lindsay, J.B., 2016. Efficient hybrid breaching-filling sink removal methods for flow path enforcement in digital elevation models: Efficient Hybrid Sink Removal Methods for Flow Path Enforcement. Hydrological Processes 30, 846--857. doi:10.1002/hyp.10648"<<std::endl;
 
@@ -35,8 +66,8 @@ void Lindsay2016(
   Array2D<uint32_t>     backlinks(dem, NO_BACK_LINK);
   Array2D<uint8_t>      visited(dem, false);
   Array2D<uint8_t>      pits(dem, false);
-  std::vector<uint32_t> flood_array;
-  GridCellZk_pq<T>      pq;
+  IndexStream           flood_array; //Order in which cells were reached, for filling
+  Queue<T>              pq;
   ProgressBar           progress;
   Timer                 overall;
 
@@ -44,7 +75,12 @@ void Lindsay2016(
 
   dem.setNoData(-9999); //TODO
 
-  uint32_t total_pits = 0;
+  //Depressions left by selective or constrained breaching are filled in a
+  //single pass over the cells in the order the breaching traversal reached them
+  const bool fill_after = mode!=COMPLETE_BREACHING && fill_depressions;
+
+  uint32_t total_pits      = 0;
+  uint64_t processed_cells = 0;
 
   visited.setAll(LindsayCellType::UNVISITED);
 
@@ -101,6 +137,9 @@ void Lindsay2016(
   }
   progress.stop();
 
+  const uint32_t pits_found = total_pits;
+  std::cerr<<"m Pits = "<<pits_found<<std::endl;
+
 
   //The Priority-Flood operation assures that we reach pit cells by passing into
   //depressions over the outlet of minimal elevation on their edge.
@@ -111,6 +150,7 @@ void Lindsay2016(
 
     const auto c = pq.top();
     pq.pop();
+    processed_cells++;
 
     //This cell is a pit: let's consider doing some breaching
     if(pits(c.x,c.y)){
@@ -162,8 +202,10 @@ void Lindsay2016(
         }
       }
 
+      //Once all the pits are dealt with there is nothing left to breach, but
+      //filling needs every cell to have been reached
       --total_pits;
-      if(total_pits==0)
+      if(total_pits==0 && !fill_after)
         break;
     }
 
@@ -183,42 +225,281 @@ void Lindsay2016(
 
       //The neighbour is unvisited. Add it to the queue
       pq.emplace(nx,ny,my_e);
-      //flood_array.emplace_back(dem.xyToI(nx,ny)); //TODO
+      if(fill_after)
+        flood_array.push_back(dem.xyToI(nx,ny));
       visited(nx,ny)   = LindsayCellType::VISITED;
       backlinks(nx,ny) = dem.xyToI(c.x,c.y);
     }
   }
   progress.stop();
 
-  if(mode!=COMPLETE_BREACHING && fill_depressions){
+  //Each cell was reached after the cell it links back to, so raising cells in
+  //this order to just above the cell they link to fills the remaining
+  //depressions and leaves no flats
+  if(fill_after){
     std::cerr<<"p Flooding..."<<std::endl;
-    progress.start(dem.numDataCells());
-    for(const auto f: flood_array){
+    if(flood_array.spilledSize()>0)
+      std::cerr<<"m Flood order cells spilled to disk = "<<flood_array.spilledSize()<<std::endl;
+    progress.start(flood_array.size());
+    flood_array.forEach([&](const uint32_t f){
       ++progress;
-      auto parent = backlinks(f);
+      const auto parent = backlinks(f);
       if(dem(f)<=dem(parent))
         dem(f) = std::nextafter(dem(parent),std::numeric_limits<T>::max());
-    }
+    });
     progress.stop();
   }
 
+  std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
+  Instrumentation::get().count("Lindsay2016.pits",pits_found);
+  Instrumentation::get().count("Lindsay2016.processed_cells",processed_cells);
+
   std::cerr<<"t Wall-time = "<<overall.stop()<<std::endl;
 }
 
-//TODO: Specialize all integer types
-template<>
-void Lindsay2016(Array2D<uint8_t> &dem, LindsayMode mode, bool fill_depressions, uint32_t maxpathlen, uint8_t maxdepth){
-  throw std::runtime_error("E Lindsay2016 not available for uint8_t.");
-}
 
-template<>
-void Lindsay2016(Array2D<int16_t> &dem, LindsayMode mode, bool fill_depressions, uint32_t maxpathlen, int16_t maxdepth){
-  throw std::runtime_error("E Lindsay2016 not available for int16_t.");
-}
 
-template<>
-void Lindsay2016(Array2D<uint16_t> &dem, LindsayMode mode, bool fill_depressions, uint32_t maxpathlen, uint16_t maxdepth){
-  throw std::runtime_error("E Lindsay2016 not available for uint16_t.");
+/**
+  @brief Complete breaching (Lindsay 2016) with the DEM split into tiles which
+         are processed in parallel
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Lindsay2016() interleaves a Priority-Flood, which links each cell to the cell
+  it was reached from, with breaching, which follows these links back from each
+  pit and lowers the cells it passes. Since breaching only alters cells the
+  flood has already left behind, the two can be separated. Further, for
+  complete breaching, each cell ends up at the lowest target of the paths which
+  reach it and a path stopped early by a lower cell is continued by the path
+  which lowered that cell, so the paths can be followed in any order.
+
+  This function therefore:
+
+    1. Finds the pits and outlets of each tile in parallel. Outlets are edge
+       cells and cells next to NoData, as in Lindsay2016().
+    2. Links the cells with parallel_priority_flood_flowdirs(), which floods
+       the tiles in parallel and joins them through a graph of their
+       watersheds. Each cell's flow direction points to the cell the flood
+       reached it from.
+    3. Follows the paths from each tile's pits in parallel, each tile altering
+       only its own cells. Paths leaving a tile are handed to the neighbouring
+       tile in a merge stage and followed from there, in further parallel
+       rounds, until all paths have ended.
+
+  Every step runs in parallel. The links of step 2 follow the lowest way out
+  of each depression, as those of Lindsay2016() do, but where there are ties
+  they may pass through different cells, so the breach paths, and hence the
+  result, may differ from those of Lindsay2016(). Every cell still drains to
+  the edge of the DEM or to NoData, and no cell is raised other than the pits
+  raised by step 1.
+
+  The link of each cell is held as a one-byte flow direction instead of
+  Lindsay2016()'s four-byte cell index. The cells processed by the linking
+  flood are counted by parallel_priority_flood_flowdirs(), so this function
+  counts the cells its breach paths lower (`breached_cells`) in place of
+  Lindsay2016()'s `processed_cells`.
+
+  @tparam        Queue        Priority queue used to flood each tile (see
+                              priority_queues.hpp). Defaults to GridCellZ_pq.
+  @param[in,out] &dem         A grid of cell elevations
+  @param[in]     tile_width   Width of the tiles
+  @param[in]     tile_height  Height of the tiles
+
+  @pre
+    1. **dem** contains the elevations of every cell or a value _NoData_ for
+       cells not part of the DEM.
+
+  @post
+    1. **dem** has no depressions or flats: every cell drains to the edge of
+       the DEM or to a cell next to NoData.
+*/
+template<template<class> class Queue = GridCellZ_pq, class T>
+void Lindsay2016Parallel(
+  Array2D<T> &dem,
+  const int  tile_width  = 512,
+  const int  tile_height = 512
+){
+  static_assert(std::is_floating_point<T>::value, "Lindsay2016Parallel lowers breach paths by the smallest representable step, so it needs floating-point elevations!");
+
+  ScopedTimer scoped_timer("Lindsay2016Parallel");
+  std::cerr<<"\nA Lindsay2016: Breach Depressions (complete breaching, tile-parallel)"<<std::endl;
+  std::cerr<<"C Lindsay, J.B., 2016. Efficient hybrid breaching-filling sink removal methods for flow path enforcement in digital elevation models: Efficient Hybrid Sink Removal Methods for Flow Path Enforcement. Hydrological Processes 30, 846--857. doi:10.1002/hyp.10648"<<std::endl;
+
+  if(tile_width<1 || tile_height<1){
+    std::cerr<<"E Tile width and height must be at least 1!"<<std::endl;
+    throw std::runtime_error("Tile width and height must be at least 1!");
+  }
+
+  typedef typename Array2D<T>::i_t i_t;
+
+  //A path being followed: the next cell and the height to lower it to
+  struct PathStep {
+    i_t cell;
+    T   target;
+  };
+
+  Array2D<uint8_t>      outlets(dem, false);
+  Array2D<d8_flowdir_t> links;
+  Timer                 overall;
+  Timer                 timer;
+
+  overall.start();
+
+  dem.setNoData(-9999); //TODO: As in Lindsay2016()
+
+  const int gridx  = (dem.width() +tile_width -1)/tile_width;
+  const int gridy  = (dem.height()+tile_height-1)/tile_height;
+  const int ntiles = gridx*gridy;
+
+  const auto TileOf = [&](const i_t i){
+    const int x = i%dem.width();
+    const int y = i/dem.width();
+    return (y/tile_height)*gridx+x/tile_width;
+  };
+
+  //Pits of each tile, with their heights before breaching
+  std::vector< std::vector<PathStep> > tile_pits(ntiles);
+
+  std::cerr<<"p Identifying pits and outlets..."<<std::endl;
+  timer.start();
+  {
+    //Pits are raised after all tiles are scanned, so that no tile reads a cell
+    //another is writing. No two strict pits are adjacent, so this classifies
+    //each cell as Lindsay2016() does.
+    std::vector< std::vector<PathStep> > raises(ntiles);
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int t=0;t<ntiles;t++){
+      const int x0 = (t%gridx)*tile_width;
+      const int y0 = (t/gridx)*tile_height;
+      const int x1 = std::min(x0+tile_width, dem.width());
+      const int y1 = std::min(y0+tile_height,dem.height());
+      for(int y=y0;y<y1;y++)
+      for(int x=x0;x<x1;x++){
+        if(dem.isNoData(x,y))
+          continue;
+
+        if(dem.isEdgeCell(x,y)){
+          outlets(x,y) = true;
+          continue;
+        }
+
+        T    lowest_neighbour = std::numeric_limits<T>::max();
+        bool drains_to_nodata = false;
+        for(int n=1;n<=8;n++){
+          const int nx = x+dx[n];
+          const int ny = y+dy[n];
+          if(dem.isNoData(nx,ny)){
+            drains_to_nodata = true;
+            break;
+          }
+          lowest_neighbour = std::min(dem(nx,ny),lowest_neighbour);
+        }
+
+        if(drains_to_nodata){
+          outlets(x,y) = true;
+          continue;
+        }
+
+        T height = dem(x,y);
+        if(height<lowest_neighbour){
+          height = std::nextafter(lowest_neighbour, std::numeric_limits<T>::lowest());
+          raises[t].push_back(PathStep{dem.xyToI(x,y),height});
+        }
+
+        if(height<=lowest_neighbour)
+          tile_pits[t].push_back(PathStep{dem.xyToI(x,y),height});
+      }
+    }
+
+    #pragma omp parallel for schedule(dynamic)
+    for(int t=0;t<ntiles;t++)
+    for(const auto &r: raises[t])
+      dem(r.cell) = r.target;
+  }
+
+  uint64_t total_pits = 0;
+  for(const auto &tp: tile_pits)
+    total_pits += tp.size();
+  std::cerr<<"m Pits = "<<total_pits<<std::endl;
+  std::cerr<<"t Pit identification time = "<<timer.stop()<<" s"<<std::endl;
+
+  //Without pits there is nothing to breach, so the links are not needed
+  if(total_pits>0){
+    std::cerr<<"p Linking cells..."<<std::endl;
+    timer.reset();
+    timer.start();
+    parallel_priority_flood_flowdirs<Queue>(dem,links,tile_width,tile_height);
+    std::cerr<<"t Linking time = "<<timer.stop()<<" s"<<std::endl;
+  }
+
+  //Follow a path back through tile `t`, lowering cells as Lindsay2016() does,
+  //until it ends or leaves the tile. A path ends once it has lowered an
+  //outlet, since Lindsay2016()'s flood starts from these and so does not link
+  //them to anything.
+  std::vector< std::vector<PathStep> > outbox(ntiles);
+  uint64_t breached_cells = 0;
+  const auto FollowPath = [&](const int t, i_t cc, T target_height){
+    uint64_t lowered = 0;
+    while(true){
+      if(TileOf(cc)!=t){
+        outbox[t].push_back(PathStep{cc,target_height});
+        break;
+      }
+      if(dem(cc)<target_height)
+        break;
+      dem(cc) = target_height;
+      lowered++;
+      const d8_flowdir_t d = links(cc);
+      if(outlets(cc) || d==NO_FLOW)
+        break;
+      int x, y;
+      dem.iToxy(cc,x,y);
+      cc            = dem.xyToI(x+dx[d],y+dy[d]);
+      target_height = std::nextafter(target_height,std::numeric_limits<T>::lowest());
+    }
+    return lowered;
+  };
+
+  std::cerr<<"p Breaching..."<<std::endl;
+  timer.reset();
+  timer.start();
+
+  #pragma omp parallel for schedule(dynamic) reduction(+:breached_cells)
+  for(int t=0;t<ntiles;t++)
+  for(const auto &p: tile_pits[t])
+    breached_cells += FollowPath(t,p.cell,p.target);
+
+  //Merge stage: hand paths which left their tiles to the tiles they entered
+  int rounds = 0;
+  std::vector< std::vector<PathStep> > inbox(ntiles);
+  while(true){
+    uint64_t handed_over = 0;
+    for(int t=0;t<ntiles;t++){
+      for(const auto &s: outbox[t])
+        inbox[TileOf(s.cell)].push_back(s);
+      handed_over += outbox[t].size();
+      outbox[t].clear();
+    }
+    if(handed_over==0)
+      break;
+    rounds++;
+
+    #pragma omp parallel for schedule(dynamic) reduction(+:breached_cells)
+    for(int t=0;t<ntiles;t++){
+      for(const auto &s: inbox[t])
+        breached_cells += FollowPath(t,s.cell,s.target);
+      inbox[t].clear();
+    }
+  }
+  std::cerr<<"m Cells breached = "<<breached_cells<<std::endl;
+  std::cerr<<"m Merge rounds = "<<rounds<<std::endl;
+  std::cerr<<"t Breaching time = "<<timer.stop()<<" s"<<std::endl;
+
+  Instrumentation::get().count("Lindsay2016Parallel.pits",total_pits);
+  Instrumentation::get().count("Lindsay2016Parallel.breached_cells",breached_cells);
+  Instrumentation::get().count("Lindsay2016Parallel.merge_rounds",rounds);
+
+  std::cerr<<"t Wall-time = "<<overall.stop()<<std::endl;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -10,6 +10,8 @@
 #define _richdem_zhou2016pf_hpp_
 
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/grid_cell.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/timer.hpp"
 #include <queue>
 #include <vector>
@@ -18,12 +20,12 @@
 
 typedef char label_t;
 
-template<class elev_t>
+template<class elev_t, class Queue>
 void ProcessTraceQue_onepass(
   Array2D<elev_t> &dem,
   Array2D<label_t> &labels,
   std::queue<int> &traceQueue,
-  std::priority_queue<std::pair<elev_t, int>, std::vector< std::pair<elev_t, int> >, std::greater< std::pair<elev_t, int> > > &priorityQueue
+  Queue &priorityQueue
 ){
   while (!traceQueue.empty()){
     auto c = traceQueue.front();
@@ -59,7 +61,9 @@ void ProcessTraceQue_onepass(
           }
         }
         if(isBoundary){
-          priorityQueue.emplace(dem(c),c);
+          int cx,cy;
+          dem.iToxy(c,cx,cy);
+          priorityQueue.emplace(cx,cy,dem(c));
           bInPQ = true;
         }
       }
@@ -67,14 +71,14 @@ void ProcessTraceQue_onepass(
   }
 }
 
-template<class elev_t>
+template<class elev_t, class Queue>
 void ProcessPit_onepass(
   elev_t c_elev,
   Array2D<elev_t> &dem,
   Array2D<label_t> &labels,
   std::queue<int> &depressionQue,
   std::queue<int> &traceQueue,
-  std::priority_queue<std::pair<elev_t, int>, std::vector< std::pair<elev_t, int> >, std::greater< std::pair<elev_t, int> > > &priorityQueue
+  Queue &priorityQueue
 ){
   while (!depressionQue.empty()){
     auto c = depressionQue.front();
@@ -108,6 +112,8 @@ void ProcessPit_onepass(
     reduces the number of items which must pass through the priority queue, thus
     achieving greater efficiencies.
 
+  @tparam         Queue         Priority queue used for the open set (see
+                                priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in,out]  &elevations   A grid of cell elevations
 
   @pre
@@ -120,13 +126,14 @@ void ProcessPit_onepass(
        for cells not part of the DEM.
     2. **elevations** contains no landscape depressions or digital dams.
 */
-template<class elev_t>
+template<template<class> class Queue = GridCellZ_pq, class elev_t>
 void Zhou2016(
   Array2D<elev_t> &dem
 ){
   std::queue<int> traceQueue;
   std::queue<int> depressionQue;
 
+  ScopedTimer scoped_timer("Zhou2016");
   std::cerr<<"A Priority-Flood (Zhou2016 version)"<<std::endl;
   std::cerr<<"C Zhou, G., Sun, Z., Fu, S., 2016. An efficient variant of the Priority-Flood algorithm for filling depressions in raster digital elevation models. Computers & Geosciences 90, Part A, 87 – 96. doi:http://dx.doi.org/10.1016/j.cageo.2016.02.021"<<std::endl;
 
@@ -138,11 +145,10 @@ void Zhou2016(
 
   labels.setAll(0);
 
-  std::priority_queue<std::pair<elev_t, int>, std::vector< std::pair<elev_t, int> >, std::greater< std::pair<elev_t, int> > > priorityQueue;
+  Queue<elev_t> priorityQueue;
 
   auto PlaceCell = [&](int x, int y){
-    int i = dem.xyToI(x,y);
-    priorityQueue.emplace(dem(i),i);
+    priorityQueue.emplace(x,y,dem(x,y));
   };
 
   for(int x=0;x<dem.width();x++)     //Top Row
@@ -158,25 +164,27 @@ void Zhou2016(
     PlaceCell(dem.width()-1,y);
 
   while (!priorityQueue.empty()){
-    std::pair<elev_t, int> c = priorityQueue.top();
+    const auto   top   = priorityQueue.top();
+    const int    ci    = dem.xyToI(top.x,top.y);
+    const elev_t celev = top.z;
     priorityQueue.pop();
 
-    labels(c.second) = 10;
+    labels(ci) = 10;
 
     for(int n=1;n<=8;n++){
-      int ni = dem.nToI(c.second, dx[n], dy[n]);
+      int ni = dem.nToI(ci, dx[n], dy[n]);
       if(ni==-1)
         continue;
 
       if(labels(ni)!=0)
         continue;
 
-      labels(ni) = labels(c.second);
+      labels(ni) = labels(ci);
 
-      if(dem(ni)<=c.first){ //Depression cell
-        dem(ni) = c.first;
+      if(dem(ni)<=celev){ //Depression cell
+        dem(ni) = celev;
         depressionQue.emplace(ni);
-        ProcessPit_onepass(c.first,dem,labels,depressionQue,traceQueue,priorityQueue);
+        ProcessPit_onepass(celev,dem,labels,depressionQue,traceQueue,priorityQueue);
       } else {          //Slope cell
         traceQueue.emplace(ni);
       }     
@@ -0,0 +1,516 @@
+/**
+  @file
+  @brief Builds the hierarchy of a DEM's depressions, with the size of each
+
+  Each local minimum of a DEM is the bottom of a depression. As water fills the
+  depression it eventually reaches a pass over which it spills. If the far side
+  of the pass drains off the DEM, the depression overflows into it. If, instead,
+  the far side is another depression which is also full to the level of the
+  pass, the two merge and go on filling as a single, larger depression. The
+  depressions and their merges form a binary tree whose root is the "ocean":
+  everything which drains off the edge of the DEM or into NoData cells.
+
+  GetDepressionHierarchy() finds this tree with a single Priority-Flood. The
+  flood starts from every local minimum and from the edges at once, labelling
+  each cell with the minimum (or the ocean) it is reached from. Where two
+  labels meet, the lowest pass between them is recorded. Processing the passes
+  from lowest to highest with a union-find then gives the merges in the order
+  they happen as the DEM fills. A final pass over the cells adds up how many
+  cells lie below each depression's spill elevation and how much water it
+  would take to fill it.
+
+  With the hierarchy in hand, questions like "which depressions are smaller
+  than 100 cells?" or "how much water do the depressions hold?" need only a
+  look at the array of depressions, rather than another flood of the DEM.
+
+  Richard Barnes (rbarnes@umn.edu), 2017
+*/
+#ifndef _richdem_depression_hierarchy_hpp_
+#define _richdem_depression_hierarchy_hpp_
+
+#include "richdem/common/Array2D.hpp"
+#include "richdem/common/grid_cell.hpp"
+#include "richdem/common/instrumentation.hpp"
+#include "richdem/common/ProgressBar.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <limits>
+#include <queue>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+
+///Labels of depressions. Leaf depressions share their labels with the cells
+///which drain to them.
+typedef uint32_t dh_label_t;
+
+///Label of the ocean: the root of the hierarchy and the label of cells which
+///drain off the DEM
+const dh_label_t DH_OCEAN    = 0;
+
+///No depression
+const dh_label_t DH_NO_VALUE = std::numeric_limits<dh_label_t>::max();
+
+
+
+///@brief A depression: either a leaf, which has a single local minimum, or a
+///       depression formed when two depressions filled up and merged
+template<class elev_t>
+struct Depression {
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  ///The depression this one merges into or, if it spills into the ocean or
+  ///into a depression which drains to the ocean, DH_OCEAN
+  dh_label_t parent        = DH_NO_VALUE;
+  ///The two depressions which merged to form this one. DH_NO_VALUE for leaves.
+  dh_label_t lchild        = DH_NO_VALUE;
+  dh_label_t rchild        = DH_NO_VALUE;
+  ///Label of the cells on the far side of the spill cell: the leaf depression
+  ///(or DH_OCEAN) this one overflows into
+  dh_label_t overflow_into = DH_NO_VALUE;
+
+  i_t    pit_cell   = Array2D<elev_t>::NO_I; ///< Lowest cell of the depression
+  i_t    spill_cell = Array2D<elev_t>::NO_I; ///< Cell over which the depression overflows
+  elev_t pit_elev   = std::numeric_limits<elev_t>::lowest(); ///< Elevation of pit_cell
+  elev_t spill_elev = std::numeric_limits<elev_t>::max();    ///< Level to which the depression fills
+
+  uint64_t cell_count = 0; ///< Cells lower than spill_elev
+  double   area       = 0; ///< Area of those cells
+  double   volume     = 0; ///< Volume of water needed to fill the depression to spill_elev
+
+  bool   isLeaf() const { return lchild==DH_NO_VALUE; }
+  double depth()  const { return (double)spill_elev-(double)pit_elev; }
+};
+
+///@brief The depressions of a DEM. Element DH_OCEAN is the ocean, leaves come
+///       next, and each merged depression comes after its children.
+template<class elev_t>
+using DepressionHierarchy = std::vector< Depression<elev_t> >;
+
+
+
+/**
+  @brief  Builds the depression hierarchy of a DEM
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  @tparam     Queue     Priority queue used for the flood (see
+                        priority_queues.hpp). Defaults to GridCellZ_pq.
+  @param[in]  &dem      A grid of cell elevations
+  @param[out] &labels   The leaf depression each cell drains to, DH_OCEAN for
+                        cells which drain off the DEM, and DH_NO_VALUE for
+                        NoData cells
+
+  @return The depressions. Areas and volumes use the cell size from the DEM's
+          geotransform; if it has none, cells are taken to have an area of 1.
+
+  @pre
+    1. **dem** contains the elevations of every cell or a value _NoData_ for
+       cells not part of the DEM. Cells next to NoData cells drain into them.
+
+  @correctness
+    The correctness of this command is determined by inspection and by
+    comparison with improved_priority_flood(): every cell lower than the
+    spill elevation of a top-level depression is raised to it by the fill.
+*/
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
+DepressionHierarchy<elev_t> GetDepressionHierarchy(
+  const Array2D<elev_t> &dem,
+  Array2D<dh_label_t>   &labels
+){
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  ScopedTimer scoped_timer("GetDepressionHierarchy");
+  std::cerr<<"\nA Depression Hierarchy (Based on Priority-Flood)"<<std::endl;
+  std::cerr<<"C Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
+
+  Timer timer;
+  timer.start();
+
+  labels.resize(dem.width(),dem.height(),DH_NO_VALUE);
+  labels.setNoData(DH_NO_VALUE);
+
+  DepressionHierarchy<elev_t> deps(1); //The ocean
+
+  Queue<elev_t> open;
+  std::queue< GridCellZ<elev_t> > pit;
+
+  //Cells which drain off the DEM seed the flood as the ocean
+  std::cerr<<"p Finding edge cells and local minima..."<<std::endl;
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++){
+    if(dem.isNoData(x,y))
+      continue;
+    bool drains = dem.isEdgeCell(x,y);
+    for(int n=1;n<=8 && !drains;n++)
+      drains = dem.isNoData(x+dx[n],y+dy[n]);
+    if(drains){
+      labels(x,y) = DH_OCEAN;
+      open.emplace(x,y,dem(x,y));
+    }
+  }
+
+  //Each minimum, which may be a flat of several cells none of which has a
+  //lower neighbour, seeds the flood as a leaf depression
+  {
+    Array2D<uint8_t> seen(dem,false);
+    std::vector<GridCell> plateau;
+    for(int y=1;y<dem.height()-1;y++)
+    for(int x=1;x<dem.width()-1;x++){
+      if(seen(x,y) || labels(x,y)!=DH_NO_VALUE || dem.isNoData(x,y))
+        continue;
+
+      const elev_t z = dem(x,y);
+      bool is_min = true;
+      for(int n=1;n<=8 && is_min;n++)
+        is_min = !(dem(x+dx[n],y+dy[n])<z);
+      if(!is_min)
+        continue;
+
+      //Gather the plateau of equal elevation. It is a minimum if none of its
+      //cells has a lower neighbour or drains off the DEM.
+      plateau.clear();
+      plateau.emplace_back(x,y);
+      seen(x,y) = true;
+      for(size_t i=0;i<plateau.size();i++){
+        const auto c = plateau[i];
+        if(labels(c.x,c.y)==DH_OCEAN)
+          is_min = false;
+        for(int n=1;n<=8;n++){
+          const int nx = c.x+dx[n];
+          const int ny = c.y+dy[n];
+          if(!dem.inGrid(nx,ny) || dem.isNoData(nx,ny))
+            continue;
+          if(dem(nx,ny)<z)
+            is_min = false;
+          else if(dem(nx,ny)==z && !seen(nx,ny)){
+            seen(nx,ny) = true;
+            plateau.emplace_back(nx,ny);
+          }
+        }
+      }
+      if(!is_min)
+        continue;
+
+      const dh_label_t label = deps.size();
+      deps.emplace_back();
+      deps.back().pit_cell = dem.xyToI(x,y);
+      deps.back().pit_elev = z;
+      for(const auto &c: plateau){
+        labels(c.x,c.y) = label;
+        open.emplace(c.x,c.y,z);
+      }
+    }
+  }
+  const dh_label_t leaf_count = deps.size()-1;
+  std::cerr<<"m Leaf depressions = "<<leaf_count<<std::endl;
+
+  //The lowest pass between each pair of labels: the pair of neighbouring
+  //cells, one with each label, whose higher cell is lowest
+  struct Pass {
+    dh_label_t a, b;         ///< a<b
+    i_t        acell, bcell; ///< The cells with labels a and b
+    elev_t     elev;
+  };
+  std::unordered_map<uint64_t, Pass> passes;
+
+  std::cerr<<"p Flooding..."<<std::endl;
+  ProgressBar progress;
+  progress.start(dem.size());
+  while(open.size()>0 || pit.size()>0){
+    GridCellZ<elev_t> c;
+    if(pit.size()>0){
+      c = pit.front();
+      pit.pop();
+    } else {
+      c = open.top();
+      open.pop();
+    }
+    ++progress;
+
+    const dh_label_t clabel = labels(c.x,c.y);
+    const i_t        ci     = dem.xyToI(c.x,c.y);
+
+    for(int n=1;n<=8;n++){
+      const int nx = c.x+dx[n];
+      const int ny = c.y+dy[n];
+      if(!dem.inGrid(nx,ny) || dem.isNoData(nx,ny))
+        continue;
+
+      const dh_label_t nlabel = labels(nx,ny);
+      if(nlabel==DH_NO_VALUE){
+        labels(nx,ny) = clabel;
+        if(dem(nx,ny)<=c.z)
+          pit.emplace(nx,ny,c.z);
+        else
+          open.emplace(nx,ny,dem(nx,ny));
+      } else if(nlabel!=clabel){
+        const i_t    ni   = dem.xyToI(nx,ny);
+        const elev_t elev = std::max(dem(ci),dem(ni));
+        Pass p;
+        if(clabel<nlabel)
+          p = Pass{clabel,nlabel,ci,ni,elev};
+        else
+          p = Pass{nlabel,clabel,ni,ci,elev};
+        const uint64_t key = ((uint64_t)p.a<<32) | p.b;
+        const auto found = passes.find(key);
+        if(found==passes.end())
+          passes.emplace(key,p);
+        else if(elev<found->second.elev)
+          found->second = p;
+      }
+    }
+  }
+  progress.stop();
+
+  //Merge depressions in the order in which they fill
+  std::cerr<<"p Building the hierarchy from "<<passes.size()<<" passes..."<<std::endl;
+  std::vector<Pass> sorted_passes;
+  sorted_passes.reserve(passes.size());
+  for(const auto &kv: passes)
+    sorted_passes.push_back(kv.second);
+  passes.clear();
+  std::sort(sorted_passes.begin(),sorted_passes.end(),[](const Pass &p, const Pass &q){
+    if(p.elev!=q.elev) return p.elev<q.elev;
+    if(p.a!=q.a)       return p.a<q.a;
+    return p.b<q.b;
+  });
+
+  //Union-find over depressions. Each set is named by its highest depression.
+  std::vector<dh_label_t> uf(deps.size());
+  for(dh_label_t i=0;i<uf.size();i++)
+    uf[i] = i;
+  const auto Find = [&](dh_label_t d){
+    dh_label_t root = d;
+    while(uf[root]!=root)
+      root = uf[root];
+    while(uf[d]!=root){
+      const dh_label_t next = uf[d];
+      uf[d] = root;
+      d     = next;
+    }
+    return root;
+  };
+
+  const auto SetSpill = [&](const dh_label_t d, const Pass &p, const bool d_is_a){
+    deps[d].spill_elev    = p.elev;
+    deps[d].spill_cell    = (dem(p.acell)>=dem(p.bcell)) ? p.acell : p.bcell;
+    deps[d].overflow_into = d_is_a ? p.b : p.a;
+  };
+
+  for(const auto &p: sorted_passes){
+    const dh_label_t ra = Find(p.a);
+    const dh_label_t rb = Find(p.b);
+    if(ra==rb)
+      continue;
+
+    if(ra==DH_OCEAN || rb==DH_OCEAN){
+      //The depression overflows into the ocean or into a depression which
+      //already drains there
+      const dh_label_t d = (ra==DH_OCEAN) ? rb : ra;
+      SetSpill(d,p,d==ra);
+      deps[d].parent = DH_OCEAN;
+      uf[d]          = DH_OCEAN;
+    } else {
+      //Both depressions are full to the pass: they merge
+      const dh_label_t m = deps.size();
+      deps.emplace_back();
+      auto &md = deps.back();
+      md.lchild   = ra;
+      md.rchild   = rb;
+      md.pit_cell = (deps[ra].pit_elev<=deps[rb].pit_elev) ? deps[ra].pit_cell : deps[rb].pit_cell;
+      md.pit_elev = std::min(deps[ra].pit_elev,deps[rb].pit_elev);
+      SetSpill(ra,p,true);
+      SetSpill(rb,p,false);
+      deps[ra].parent = m;
+      deps[rb].parent = m;
+      uf[ra] = m;
+      uf[rb] = m;
+      uf.push_back(m);
+    }
+  }
+  sorted_passes.clear();
+  sorted_passes.shrink_to_fit();
+
+  //Each cell lies in the lowest depression containing its leaf whose spill
+  //elevation is above the cell, and in all of that depression's ancestors
+  std::cerr<<"p Measuring depressions..."<<std::endl;
+  std::vector<double> sum_elev(deps.size(),0);
+  for(i_t i=0;i<dem.size();i++){
+    const dh_label_t leaf = labels(i);
+    if(leaf==DH_OCEAN || leaf==DH_NO_VALUE)
+      continue;
+    const elev_t z = dem(i);
+    dh_label_t d = leaf;
+    while(d!=DH_OCEAN && d!=DH_NO_VALUE && !(z<deps[d].spill_elev))
+      d = deps[d].parent;
+    if(d==DH_OCEAN || d==DH_NO_VALUE)
+      continue;
+    deps[d].cell_count++;
+    sum_elev[d] += z;
+  }
+
+  const double cell_area = (dem.geotransform.size()==6) ? std::abs(dem.geotransform[1]*dem.geotransform[5]) : 1;
+
+  //Children come before their parents, so one pass carries the totals up
+  for(dh_label_t d=1;d<deps.size();d++){
+    auto &dd = deps[d];
+    dd.area   = dd.cell_count*cell_area;
+    dd.volume = std::max(0.0,(dd.cell_count*(double)dd.spill_elev-sum_elev[d])*cell_area);
+    if(dd.parent!=DH_OCEAN && dd.parent!=DH_NO_VALUE){
+      deps[dd.parent].cell_count += dd.cell_count;
+      sum_elev[dd.parent]        += sum_elev[d];
+    }
+  }
+
+  std::cerr<<"m Depressions = "<<(deps.size()-1)<<" ("<<leaf_count<<" leaves)"<<std::endl;
+  std::cerr<<"t Succeeded in = "<<timer.stop()<<" s"<<std::endl;
+  Instrumentation::get().count("GetDepressionHierarchy.leaf_depressions",leaf_count);
+  Instrumentation::get().count("GetDepressionHierarchy.depressions",deps.size()-1);
+
+  return deps;
+}
+
+
+/**
+  @brief  Fills the depressions of a DEM which satisfy a predicate, using its
+          depression hierarchy rather than a new flood
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  A depression is filled to its spill elevation if it, or any depression
+  containing it, satisfies `fill_dep`. Depressions which merge at the level at
+  which they spill form a single pool and are judged together. Since a
+  depression is contained in its ancestors, the fill level of each leaf is the
+  spill elevation of its highest qualifying ancestor, so each cell is raised
+  with a single lookup. The same hierarchy can be reused for any number of
+  thresholds.
+
+  @param[in,out] &dem      A grid of cell elevations
+  @param[in]     &labels   Leaf labels from GetDepressionHierarchy() for this DEM
+  @param[in]     &deps     Hierarchy from GetDepressionHierarchy() for this DEM
+  @param[in]     fill_dep  Called as `fill_dep(const Depression<elev_t>&)`;
+                           returns true if the depression should be filled
+
+  @pre
+    1. **labels** and **deps** were built from **dem** and **dem** has not been
+       changed since.
+
+  @post
+    1. **dem** has every qualifying depression filled to its spill elevation.
+       **labels** and **deps** no longer describe **dem**.
+
+  @correctness
+    Filling every depression is checked against improved_priority_flood() in
+    the tests, as are thresholds on the test DEM of
+    improved_priority_flood_max_dep().
+*/
+template<class elev_t, class F>
+void FillDepressionsIf(
+  Array2D<elev_t>                   &dem,
+  const Array2D<dh_label_t>         &labels,
+  const DepressionHierarchy<elev_t> &deps,
+  F                                 fill_dep
+){
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  ScopedTimer scoped_timer("FillDepressionsIf");
+  std::cerr<<"\nA Selective depression filling from a depression hierarchy"<<std::endl;
+
+  if(labels.width()!=dem.width() || labels.height()!=dem.height()){
+    std::cerr<<"E The labels do not have the same dimensions as the DEM!"<<std::endl;
+    throw std::runtime_error("The labels do not have the same dimensions as the DEM!");
+  }
+
+  //Parents come after their children, so walking backwards sees each parent's
+  //fill level before its children's. A depression which spills at the same
+  //elevation as its parent is, when full, part of the parent's pool of water,
+  //so it takes the parent's decision rather than being judged on its own.
+  std::vector<elev_t> fill_elev(deps.size(),std::numeric_limits<elev_t>::lowest());
+  std::vector<char>   fill_self(deps.size(),false);
+  uint64_t filled_deps = 0;
+  for(dh_label_t d=deps.size()-1;d>DH_OCEAN;d--){
+    const auto &dd = deps[d];
+    const bool has_parent = dd.parent!=DH_OCEAN && dd.parent!=DH_NO_VALUE;
+    if(has_parent && deps[dd.parent].spill_elev==dd.spill_elev)
+      fill_self[d] = fill_self[dd.parent];
+    else
+      fill_self[d] = fill_dep(dd);
+    if(has_parent)
+      fill_elev[d] = fill_elev[dd.parent];
+    if(fill_self[d]){
+      fill_elev[d] = std::max(fill_elev[d],dd.spill_elev);
+      filled_deps++;
+    }
+  }
+
+  uint64_t raised_cells = 0;
+  #pragma omp parallel for reduction(+:raised_cells)
+  for(i_t i=0;i<dem.size();i++){
+    const dh_label_t leaf = labels(i);
+    if(leaf==DH_OCEAN || leaf==DH_NO_VALUE)
+      continue;
+    if(dem(i)<fill_elev[leaf]){
+      dem(i) = fill_elev[leaf];
+      raised_cells++;
+    }
+  }
+
+  std::cerr<<"m Depressions filled = "<<filled_deps<<std::endl;
+  std::cerr<<"m Cells raised = "<<raised_cells<<std::endl;
+  Instrumentation::get().count("FillDepressionsIf.raised_cells",raised_cells);
+}
+
+
+
+///Property of a depression compared against a threshold by FillDepressionsBelow()
+enum class DepressionMeasure {
+  CELLS,   ///< Number of cells
+  AREA,    ///< Area, in the units of the geotransform
+  VOLUME,  ///< Volume needed to fill the depression to its spill elevation
+  DEPTH,   ///< Difference between the spill and pit elevations
+};
+
+/**
+  @brief  Fills each depression whose size, area, volume, or depth is at most
+          a threshold, using the DEM's depression hierarchy
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  DepressionMeasure::CELLS is similar to improved_priority_flood_max_dep(),
+  but counts every cell below a depression's spill elevation, including those
+  of nested depressions, and many thresholds can be tried without re-flooding
+  the DEM. The two differ for small depressions nested inside a large one:
+  improved_priority_flood_max_dep() leaves them alone if the large depression
+  is not filled, whereas this fills them to their own spill elevations.
+
+  @param[in,out] &dem       A grid of cell elevations
+  @param[in]     &labels    Leaf labels from GetDepressionHierarchy() for this DEM
+  @param[in]     &deps      Hierarchy from GetDepressionHierarchy() for this DEM
+  @param[in]     measure    Property compared against the threshold
+  @param[in]     threshold  Depressions with measure<=threshold are filled
+*/
+template<class elev_t>
+void FillDepressionsBelow(
+  Array2D<elev_t>                   &dem,
+  const Array2D<dh_label_t>         &labels,
+  const DepressionHierarchy<elev_t> &deps,
+  const DepressionMeasure           measure,
+  const double                      threshold
+){
+  switch(measure){
+    case DepressionMeasure::CELLS:
+      FillDepressionsIf(dem,labels,deps,[&](const Depression<elev_t> &d){ return d.cell_count<=threshold; });
+      break;
+    case DepressionMeasure::AREA:
+      FillDepressionsIf(dem,labels,deps,[&](const Depression<elev_t> &d){ return d.area<=threshold;       });
+      break;
+    case DepressionMeasure::VOLUME:
+      FillDepressionsIf(dem,labels,deps,[&](const Depression<elev_t> &d){ return d.volume<=threshold;     });
+      break;
+    case DepressionMeasure::DEPTH:
+      FillDepressionsIf(dem,labels,deps,[&](const Depression<elev_t> &d){ return d.depth()<=threshold;    });
+      break;
+  }
+}
+
+#endif
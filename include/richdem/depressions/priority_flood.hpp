@@ -7,12 +7,23 @@
 #ifndef _richdem_priority_flood_hpp_
 #define _richdem_priority_flood_hpp_
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/grid_cell.hpp"
+#include "richdem/common/priority_queues.hpp"
+#include "richdem/common/ProgressBar.hpp"
 #include "richdem/flowdirs/d8_flowdirs.hpp"
+#include <algorithm>
+#include <atomic>
+#include <functional>
 #include <queue>
 #include <limits>
 #include <iostream>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
 #include <cstdlib> //Used for exit
+#include <cstring>
+#include <type_traits>
 
 
 /**
@@ -25,6 +36,8 @@
     queue. If the neighbours are lower than the cell which is adding them, then
     they are part of a depression and the question is answered.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in]  &elevations   A grid of cell elevations
 
   @pre
@@ -37,11 +50,12 @@
   @correctness
     The correctness of this command is determined by inspection. (TODO)
 */
-template <class elev_t>
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
 bool HasDepressions(const Array2D<elev_t> &elevations){
-  GridCellZ_pq<elev_t> open;
+  Queue<elev_t> open;
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("HasDepressions");
   std::cerr<<"\nA HasDepressions (Based on Priority-Flood)"<<std::endl;
   std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
   std::cerr<<"p Setting up boolean flood array matrix..."<<std::endl;
@@ -99,6 +113,143 @@ bool HasDepressions(const Array2D<elev_t> &elevations){
 
 
 
+/**
+  @brief  Determine if a DEM has depressions, using many threads and stopping
+          at the first depression found
+  @author Richard Barnes (rbarnes@umn.edu)
+
+    A DEM has a depression exactly when some group of connected cells of equal
+    elevation (possibly a single cell) has no lower neighbour and does not
+    touch the edge of the DEM: from any other cell there is a path to the edge
+    which never goes up. Most such groups are single cells with only higher
+    neighbours, which a scan of the DEM can spot without a flood. The scan is
+    split over threads; once any thread finds a depression, the others stop.
+
+    Cells with no lower neighbour but with neighbours of equal elevation are
+    set aside during the scan. If no single-cell depression is found, the flat
+    around each is then searched, stopping as soon as a lower neighbour or an
+    edge cell shows that the flat drains. A cell reached by an earlier search
+    belongs to a flat which drains, so each cell is searched at most once.
+
+    On a DEM without depressions, such as one which has just been filled, this
+    reads each cell's neighbours once, in parallel, plus a search of the flats,
+    rather than passing every cell through a priority queue.
+
+  @param[in]  &elevations   A grid of cell elevations
+
+  @pre
+    1. **elevations** contains the elevations of every cell or a value _NoData_
+       for cells not part of the DEM. Note that the _NoData_ value is assumed to
+       be a negative number less than any actual data value.
+
+  @return True if the DEM contains depressions; otherwise, false. This is the
+          same as the result of HasDepressions().
+
+  @correctness
+    The correctness of this command is determined by comparison with
+    HasDepressions() in the tests.
+*/
+template <class elev_t>
+bool HasDepressionsParallel(const Array2D<elev_t> &elevations){
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  ScopedTimer scoped_timer("HasDepressionsParallel");
+  std::cerr<<"\nA HasDepressions (parallel scan for minima)"<<std::endl;
+  std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
+
+  Timer timer;
+  timer.start();
+
+  std::atomic<bool> found{false};
+  std::vector< std::vector<i_t> > flat_starts(omp_get_max_threads());
+
+  std::cerr<<"p Scanning for minima..."<<std::endl;
+  #pragma omp parallel for schedule(dynamic,16)
+  for(int y=1;y<elevations.height()-1;y++){
+    if(found.load(std::memory_order_relaxed))
+      continue;
+    auto &my_flat_starts = flat_starts[omp_get_thread_num()];
+    for(int x=1;x<elevations.width()-1;x++){
+      const elev_t z = elevations(x,y);
+      bool lower = false;
+      bool equal = false;
+      for(int n=1;n<=8;n++){
+        const elev_t nz = elevations(x+dx[n],y+dy[n]);
+        lower |= nz<z;
+        equal |= nz==z;
+      }
+      if(lower)
+        continue;
+      if(!equal){
+        found = true;
+        break;
+      }
+      my_flat_starts.push_back(elevations.xyToI(x,y));
+    }
+  }
+
+  uint64_t flat_cells = 0;
+  if(!found){
+    std::cerr<<"p Searching flats..."<<std::endl;
+    //Cells of flats known to drain, and of the flat being searched
+    const uint8_t DRAINS = 1;
+    const uint8_t CURRENT = 2;
+    Array2D<uint8_t> visited(elevations,0);
+    std::vector<i_t> flat;
+    for(const auto &fs: flat_starts)
+    for(const auto start: fs){
+      if(found)
+        break;
+      if(visited(start))
+        continue;
+
+      const elev_t z = elevations(start);
+      bool drains = false;
+      flat.clear();
+      flat.push_back(start);
+      visited(start) = CURRENT;
+      for(size_t f=0;f<flat.size() && !drains;f++){
+        int x,y;
+        elevations.iToxy(flat[f],x,y);
+        if(elevations.isEdgeCell(x,y)){
+          drains = true;
+          break;
+        }
+        for(int n=1;n<=8;n++){
+          const int nx = x+dx[n];
+          const int ny = y+dy[n];
+          const elev_t nz = elevations(nx,ny);
+          if(nz<z){
+            drains = true;
+            break;
+          } else if(nz==z){
+            if(visited(nx,ny)==DRAINS){
+              drains = true;
+              break;
+            } else if(visited(nx,ny)==CURRENT)
+              continue;
+            visited(nx,ny) = CURRENT;
+            flat.push_back(elevations.xyToI(nx,ny));
+          }
+        }
+      }
+      flat_cells += flat.size();
+      if(!drains)
+        found = true;
+      for(const auto f: flat)
+        visited(f) = DRAINS;
+    }
+  }
+
+  std::cerr<<"m Flat cells searched = "<<flat_cells<<std::endl;
+  std::cerr<<"t Succeeded in    = "<<timer.stop()<<" s"<<std::endl;
+  std::cerr<<"m "<<(found?"Depression found.":"No depressions found.")<<std::endl;
+  Instrumentation::get().count("HasDepressionsParallel.flat_cells",flat_cells);
+  return found;
+}
+
+
+
 /**
   @brief  Fills all pits and removes all digital dams from a DEM
   @author Richard Barnes (rbarnes@umn.edu)
@@ -109,6 +260,8 @@ bool HasDepressions(const Array2D<elev_t> &elevations){
     queue. If the neighbours are lower than the cell which is adding them, then
     they are raised to match its elevation; this fills depressions.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in,out]  &elevations   A grid of cell elevations
 
   @pre
@@ -124,13 +277,14 @@ bool HasDepressions(const Array2D<elev_t> &elevations){
   @correctness
     The correctness of this command is determined by inspection. (TODO)
 */
-template <class elev_t>
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
 void original_priority_flood(Array2D<elev_t> &elevations){
-  GridCellZ_pq<elev_t> open;
+  Queue<elev_t> open;
   uint64_t processed_cells = 0;
   uint64_t pitc            = 0;
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("original_priority_flood");
   std::cerr<<"\nA Priority-Flood (Original)"<<std::endl;
   std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
   std::cerr<<"p Setting up boolean flood array matrix..."<<std::endl;
@@ -180,6 +334,8 @@ void original_priority_flood(Array2D<elev_t> &elevations){
   std::cerr<<"t Succeeded in    = "<<progress.stop() <<" s"<<std::endl;
   std::cerr<<"m Cells processed = "<<processed_cells       <<std::endl;
   std::cerr<<"m Cells in pits   = "<<pitc                  <<std::endl;
+  Instrumentation::get().count("original_priority_flood.processed_cells",processed_cells);
+  Instrumentation::get().count("original_priority_flood.pit_cells",      pitc);
 }
 
 
@@ -197,6 +353,8 @@ void original_priority_flood(Array2D<elev_t> &elevations){
     are higher than a pit being filled are added to the priority queue. In this
     way, pits are filled without incurring the expense of the priority queue.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in,out]  &elevations   A grid of cell elevations
 
   @pre
@@ -212,14 +370,15 @@ void original_priority_flood(Array2D<elev_t> &elevations){
   @correctness
     The correctness of this command is determined by inspection. (TODO)
 */
-template <class elev_t>
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
 void improved_priority_flood(Array2D<elev_t> &elevations){
-  GridCellZ_pq<elev_t> open;
+  Queue<elev_t> open;
   std::queue<GridCellZ<elev_t> > pit;
   uint64_t processed_cells = 0;
   uint64_t pitc            = 0;
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("improved_priority_flood");
   std::cerr<<"\nPriority-Flood (Improved)"<<std::endl;
   std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
   std::cerr<<"p Setting up boolean flood array matrix..."<<std::endl;
@@ -280,6 +439,8 @@ void improved_priority_flood(Array2D<elev_t> &elevations){
   std::cerr<<"t Succeeded in "<<std::fixed<<std::setprecision(1)<<progress.stop()<<" s"<<std::endl;
   std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
   std::cerr<<"m Cells in pits = "  <<pitc           <<std::endl;
+  Instrumentation::get().count("improved_priority_flood.processed_cells",processed_cells);
+  Instrumentation::get().count("improved_priority_flood.pit_cells",      pitc);
 }
 
 
@@ -296,6 +457,8 @@ void improved_priority_flood(Array2D<elev_t> &elevations){
     are higher than a pit being filled are added to the priority queue. In this
     way, pits are filled without incurring the expense of the priority queue.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in,out]  &elevations   A grid of cell elevations
 
   @pre
@@ -311,9 +474,9 @@ void improved_priority_flood(Array2D<elev_t> &elevations){
   @correctness
     The correctness of this command is determined by inspection. (TODO)
 */
-template <class elev_t>
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
 void priority_flood_epsilon(Array2D<elev_t> &elevations){
-  GridCellZ_pq<elev_t> open;
+  Queue<elev_t> open;
   std::queue<GridCellZ<elev_t> > pit;
   ProgressBar progress;
   uint64_t processed_cells = 0;
@@ -321,6 +484,7 @@ void priority_flood_epsilon(Array2D<elev_t> &elevations){
   auto     PitTop          = elevations.noData();
   int      false_pit_cells = 0;
 
+  ScopedTimer scoped_timer("priority_flood_epsilon");
   std::cerr<<"\nA Priority-Flood+Epsilon"<<std::endl;
   std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
   std::cerr<<"p Setting up boolean flood array matrix..."<<std::endl;
@@ -387,6 +551,8 @@ void priority_flood_epsilon(Array2D<elev_t> &elevations){
   std::cerr<<"\t\033[96mt succeeded in "<<progress.stop()<<"s.\033[39m"<<std::endl;
   std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
   std::cerr<<"m Cells in pits = "  <<pitc           <<std::endl;
+  Instrumentation::get().count("priority_flood_epsilon.processed_cells",processed_cells);
+  Instrumentation::get().count("priority_flood_epsilon.pit_cells",      pitc);
   if(false_pit_cells)
     std::cerr<<"\033[91mW In assigning negligible gradients to depressions, some depressions rose above the surrounding cells. This implies that a larger storage type should be used. The problem occured for "<<false_pit_cells<<" of "<<elevations.numDataCells()<<".\033[39m"<<std::endl;
 }
@@ -428,6 +594,202 @@ void priority_flood_epsilon(Array2D<int32_t> &elevations){
 }
 
 
+///@brief Raises elevations by whole multiples of the smallest increment the
+///       type can represent. For integer types this is 1. For floating-point
+///       types it is one unit in the last place, so raising a value by n steps
+///       gives the same result as n calls to std::nextafter() towards
+///       infinity, except that -0 and +0 are one step apart. The result is
+///       capped at the largest finite value of the type.
+template<class elev_t, bool = std::is_floating_point<elev_t>::value>
+struct EpsilonSteps {
+  static elev_t raise(const elev_t z, const uint32_t n){
+    const int64_t room = (int64_t)std::numeric_limits<elev_t>::max()-(int64_t)z;
+    return (elev_t)(z+std::min<int64_t>(room,n));
+  }
+};
+
+template<class elev_t>
+struct EpsilonSteps<elev_t,true> {
+  static_assert(std::is_same<elev_t,float>::value || std::is_same<elev_t,double>::value, "EpsilonSteps needs IEEE single or double precision!");
+  typedef typename std::conditional<std::is_same<elev_t,float>::value,uint32_t,uint64_t>::type bits_t;
+  static constexpr bits_t sign = (bits_t)1<<(8*sizeof(bits_t)-1);
+
+  ///Maps a value onto an unsigned integer which sorts the same way. Adjacent
+  ///values map onto adjacent integers. Written without branches so that loops
+  ///over many cells can be vectorized.
+  static bits_t toKey(const elev_t z){
+    bits_t b;
+    std::memcpy(&b,&z,sizeof(b));
+    return b ^ ( ((bits_t)0-(b>>(8*sizeof(bits_t)-1))) | sign );
+  }
+
+  static elev_t fromKey(const bits_t k){
+    const bits_t b = k ^ ( ((k>>(8*sizeof(bits_t)-1))-1) | sign );
+    elev_t z;
+    std::memcpy(&z,&b,sizeof(z));
+    return z;
+  }
+
+  static elev_t raise(const elev_t z, const uint32_t n){
+    const bits_t kmax = toKey(std::numeric_limits<elev_t>::max());
+    const bits_t k    = toKey(z);
+    const bits_t room = (k<kmax) ? kmax-k : 0;
+    return fromKey( k+std::min<bits_t>(room,n) );
+  }
+};
+
+
+
+/**
+  @brief  Modifies cell elevations to guarantee drainage, as
+          priority_flood_epsilon() does, without stepping each cell in turn
+  @author Richard Barnes (rbarnes@umn.edu)
+
+    A cell raised by priority_flood_epsilon() ends up a whole number of
+    epsilons above the level of the depression it lies in: one for each cell on
+    the path by which the flood reached it from the depression's outlet. This
+    version floods as improved_priority_flood() does, filling each depression
+    to its level and noting how many steps each cell is from the outlet. The
+    increments are then applied to all the cells at once, in a loop the
+    compiler can vectorize, rather than one std::nextafter() at a time during
+    the flood.
+
+    An epsilon is the smallest increment the data type can represent: one unit
+    in the last place for float and double, so that the two types are treated
+    alike, and 1 for integer types, which priority_flood_epsilon() does not
+    handle. Cells are raised no higher than the largest value of the type.
+
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
+  @param[in,out]  &elevations   A grid of cell elevations
+
+  @pre
+    1. **elevations** contains the elevations of every cell or a value _NoData_
+       for cells not part of the DEM. Note that the _NoData_ value is assumed to
+       be a negative number less than any actual data value.
+
+  @post
+    1. **elevations** contains the elevations of every cell or a value _NoData_
+       for cells not part of the DEM.
+    2. **elevations** has no landscape depressions, digital dams, or flats.
+
+  @correctness
+    The correctness of this command is determined by comparison with
+    priority_flood_epsilon() and by checking the postconditions in the tests.
+*/
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
+void priority_flood_epsilon_steps(Array2D<elev_t> &elevations){
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  Queue<elev_t> open;
+  std::queue<GridCellZ<elev_t> > pit;
+  ProgressBar progress;
+  uint64_t processed_cells = 0;
+  uint64_t pitc            = 0;
+  uint64_t false_pit_cells = 0;
+
+  ScopedTimer scoped_timer("priority_flood_epsilon_steps");
+  std::cerr<<"\nA Priority-Flood+Epsilon (step counting)"<<std::endl;
+  std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
+
+  //One more than the number of epsilons each cell lies above the level it is
+  //filled to, or 0 for cells the flood has not yet reached. This doubles as
+  //the closed set, so no separate array of flags is needed.
+  std::cerr<<"p Setting up the step count matrix..."<<std::endl;
+  Array2D<uint32_t> steps(elevations.width(),elevations.height(),0);
+
+  std::cerr<<"p Adding cells to the priority queue..."<<std::endl;
+  for(int x=0;x<elevations.width();x++){
+    open.emplace(x,0,elevations(x,0) );
+    open.emplace(x,elevations.height()-1,elevations(x,elevations.height()-1) );
+    steps(x,0)=1;
+    steps(x,elevations.height()-1)=1;
+  }
+  for(int y=1;y<elevations.height()-1;y++){
+    open.emplace(0,y,elevations(0,y)  );
+    open.emplace(elevations.width()-1,y,elevations(elevations.width()-1,y) );
+    steps(0,y)=1;
+    steps(elevations.width()-1,y)=1;
+  }
+
+  std::cerr<<"p Performing Priority-Flood+Epsilon..."<<std::endl;
+  progress.start( elevations.size() );
+  while(open.size()>0 || pit.size()>0){
+    //Cells are taken in the same order as priority_flood_epsilon() takes them,
+    //which compares the open set against the raised elevation at the front of
+    //the pit queue. Otherwise, ties would reach the open set in a different
+    //order and cells could be counted a different number of steps from their
+    //outlets.
+    GridCellZ<elev_t> c;
+    if(pit.size()>0 && open.size()>0 && open.top().z==EpsilonSteps<elev_t>::raise(pit.front().z,steps(pit.front().x,pit.front().y)-1)){
+      c=open.top();
+      open.pop();
+    } else if(pit.size()>0){
+      c=pit.front();
+      pit.pop();
+    } else {
+      c=open.top();
+      open.pop();
+    }
+    processed_cells++;
+
+    //A neighbour which is raised is one step above this cell. Cells no higher
+    //than that must be raised for this cell to drain.
+    const uint32_t csteps = steps(c.x,c.y);
+    const uint32_t nsteps = csteps+(csteps<std::numeric_limits<uint32_t>::max());
+    const elev_t   ntop   = EpsilonSteps<elev_t>::raise(c.z,nsteps-1);
+
+    for(int n=1;n<=8;n++){
+      const int nx=c.x+dx[n];
+      const int ny=c.y+dy[n];
+
+      if(!elevations.inGrid(nx,ny)) continue;
+
+      if(steps(nx,ny))
+        continue;
+
+      if(elevations.isNoData(nx,ny)){
+        steps(nx,ny) = 1;
+        pit.emplace(nx,ny,elevations.noData());
+      } else if(elevations(nx,ny)<=ntop){
+        if(csteps>1 && c.z<elevations(nx,ny))
+          ++false_pit_cells;
+        ++pitc;
+        elevations(nx,ny) = c.z;
+        steps(nx,ny)      = nsteps;
+        pit.emplace(nx,ny,c.z);
+      } else {
+        steps(nx,ny) = 1;
+        open.emplace(nx,ny,elevations(nx,ny));
+      }
+    }
+    progress.update(processed_cells);
+  }
+  std::cerr<<"\t\033[96mt succeeded in "<<progress.stop()<<"s.\033[39m"<<std::endl;
+
+  //Raising a cell by no steps leaves it as it is, so every cell, including
+  //NoData cells, can be treated alike. The loop is over plain arrays so that
+  //the compiler can vectorize it.
+  std::cerr<<"p Applying the increments..."<<std::endl;
+  Timer timer;
+  timer.start();
+  elev_t         *const edata = elevations.getData();
+  const uint32_t *const sdata = steps.getData();
+  const i_t size = elevations.size();
+  #pragma omp parallel for
+  for(i_t i=0;i<size;i++)
+    edata[i] = EpsilonSteps<elev_t>::raise(edata[i],sdata[i]-1);
+  std::cerr<<"t Increment time = "<<timer.stop()<<" s"<<std::endl;
+
+  std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
+  std::cerr<<"m Cells in pits = "  <<pitc           <<std::endl;
+  Instrumentation::get().count("priority_flood_epsilon_steps.processed_cells",processed_cells);
+  Instrumentation::get().count("priority_flood_epsilon_steps.pit_cells",      pitc);
+  if(false_pit_cells)
+    std::cerr<<"\033[91mW In assigning negligible gradients to depressions, some depressions rose above the surrounding cells. This implies that a larger storage type should be used. The problem occured for "<<false_pit_cells<<" of "<<elevations.numDataCells()<<".\033[39m"<<std::endl;
+}
+
+
 /**
   @brief  Determines D8 flow directions and implicitly fills pits.
   @author Richard Barnes (rbarnes@umn.edu)
@@ -440,6 +802,11 @@ void priority_flood_epsilon(Array2D<int32_t> &elevations){
 
     Based on Metz 2011.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). It must pop cells of equal
+                             elevation in the order they were added, as
+                             StableBucketQueue and GridCellZk_pq do, for the
+                             flow directions to be deterministic.
   @param[in]   &elevations  A grid of cell elevations
   @param[out]  &flowdirs    A grid of D8 flow directions
 
@@ -457,12 +824,13 @@ void priority_flood_epsilon(Array2D<int32_t> &elevations){
   @correctness
     The correctness of this command is determined by inspection. (TODO)
 */
-template <class elev_t>
+template <template<class> class Queue = StableBucketQueue, class elev_t>
 void priority_flood_flowdirs(const Array2D<elev_t> &elevations, Array2D<d8_flowdir_t> &flowdirs){
-  GridCellZk_pq<elev_t> open;
+  Queue<elev_t> open;
   uint64_t processed_cells = 0;
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("priority_flood_flowdirs");
   std::cerr<<"\nA Priority-Flood+Flow Directions"<<std::endl;
   std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
   std::cerr<<"p Setting up boolean flood array matrix..."<<std::endl;
@@ -531,6 +899,378 @@ void priority_flood_flowdirs(const Array2D<elev_t> &elevations, Array2D<d8_flowd
   }
   std::cerr<<"\t\033[96mt succeeded in "<<progress.stop()<<"s.\033[39m"<<std::endl;
   std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
+  Instrumentation::get().count("priority_flood_flowdirs.processed_cells",processed_cells);
+}
+
+
+
+/**
+  @brief  Determines D8 flow directions and implicitly fills pits, as
+          priority_flood_flowdirs() does, with the DEM split into tiles which
+          are flooded in parallel
+  @author Richard Barnes (rbarnes@umn.edu)
+
+    This follows parallel_priority_flood_watersheds(), but keeps flow
+    directions in place of labels and fill elevations.
+
+    1. Each tile is flooded, in parallel, as though its border were the edge of
+       the DEM. Each border cell seeds a watershed, and each cell in it is
+       directed to the cell from which the flood reached it, so that the
+       watershed is a tree draining to its seed. Where two of a tile's
+       watersheds meet, the lowest pass between them, and the cells on either
+       side of it, are noted.
+    2. The watersheds of neighbouring tiles are joined by passes between the
+       border cells they face each other across.
+    3. The resulting graph of watersheds is flooded from the watersheds seeded
+       by the edge of the DEM. Each other watershed is reached through the pass
+       by which it drains.
+    4. In parallel, each such watershed's tree is re-rooted at its cell on that
+       pass, by reversing the directions along the path from that cell to the
+       seed, and the cell is directed across the pass.
+
+    Following the flow directions from any cell leads to the edge of the DEM,
+    or to a NoData cell, without rising above the elevation to which
+    improved_priority_flood() would fill that cell. Beyond the output, the
+    memory needed is a label and an elevation for each cell of the tiles being
+    flooded and a small amount for each tile's border; the filled DEM is never
+    stored.
+
+  @tparam     Queue         Priority queue used to flood each tile (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
+  @param[in]   &elevations  A grid of cell elevations
+  @param[out]  &flowdirs    A grid of D8 flow directions
+  @param[in]   tile_width   Width of the tiles
+  @param[in]   tile_height  Height of the tiles
+
+  @pre
+    1. **elevations** contains the elevations of every cell or a value _NoData_
+       for cells not part of the DEM. Note that the _NoData_ value is assumed to
+       be a negative number less than any actual data value.
+
+  @post
+    1. **flowdirs** contains a D8 flow direction of each cell or a value
+       _NO_FLOW_ for those cells which are not part of the DEM.
+    2. **flowdirs** has no cells which are not part of a continuous flow
+       path leading to the edge of the DEM.
+
+  @correctness
+    The correctness of this command is determined by following the flow paths
+    and comparing their highest cells with improved_priority_flood() in the
+    tests.
+*/
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
+void parallel_priority_flood_flowdirs(
+  const Array2D<elev_t>  &elevations,
+  Array2D<d8_flowdir_t>  &flowdirs,
+  const int              tile_width  = 512,
+  const int              tile_height = 512
+){
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  ScopedTimer scoped_timer("parallel_priority_flood_flowdirs");
+  std::cerr<<"\nA Priority-Flood+Flow Directions (tile-parallel)"<<std::endl;
+  std::cerr<<"C Barnes, R., 2016. Parallel Priority-Flood depression filling for trillion cell digital elevation models on desktops or clusters. Computers & Geosciences 96, 56--68. doi:10.1016/j.cageo.2016.07.001"<<std::endl;
+
+  if(tile_width<1 || tile_height<1){
+    std::cerr<<"E Tile width and height must be at least 1!"<<std::endl;
+    throw std::runtime_error("Tile width and height must be at least 1!");
+  }
+
+  Timer overall;
+  overall.start();
+
+  const int gridx  = (elevations.width() +tile_width -1)/tile_width;
+  const int gridy  = (elevations.height()+tile_height-1)/tile_height;
+  const int ntiles = gridx*gridy;
+
+  const auto TileOf = [&](const int x, const int y){
+    return (y/tile_height)*gridx+x/tile_width;
+  };
+
+  //Tile t's watersheds are labelled from label_offset[t]+1, one for each cell
+  //of its border, in row-major order
+  std::vector<int32_t> label_offset(ntiles+1,0);
+  for(int t=0;t<ntiles;t++){
+    const int w = std::min(tile_width, elevations.width() -(t%gridx)*tile_width );
+    const int h = std::min(tile_height,elevations.height()-(t/gridx)*tile_height);
+    const int64_t border = (w==1 || h==1) ? (int64_t)w*h : 2*(int64_t)w+2*(int64_t)h-4;
+    if(label_offset[t]+border>=std::numeric_limits<int32_t>::max()){
+      std::cerr<<"E Too many tile borders to label! Use larger tiles."<<std::endl;
+      throw std::runtime_error("Too many tile borders to label! Use larger tiles.");
+    }
+    label_offset[t+1] = label_offset[t]+border;
+  }
+  const int32_t nlabels = label_offset[ntiles];
+
+  //Label of the watershed seeded by a cell on the border of its tile
+  const auto BorderLabel = [&](const int x, const int y){
+    const int t  = TileOf(x,y);
+    const int rx = x-(t%gridx)*tile_width;
+    const int ry = y-(t/gridx)*tile_height;
+    const int w  = std::min(tile_width, elevations.width() -(t%gridx)*tile_width );
+    const int h  = std::min(tile_height,elevations.height()-(t/gridx)*tile_height);
+    const int64_t per_row = (w==1) ? 1 : 2;
+    int64_t idx;
+    if(ry==0)
+      idx = rx;
+    else if(ry==h-1)
+      idx = w+(h-2)*per_row+rx;
+    else
+      idx = w+(ry-1)*per_row+(rx==0 ? 0 : 1);
+    return (int32_t)(label_offset[t]+idx+1);
+  };
+
+  flowdirs.resize(elevations.width(),elevations.height());
+  flowdirs.setNoData(NO_FLOW);
+
+  //A pass between two watersheds, with the cells on either side of it
+  struct Pass {
+    int32_t a, b;
+    elev_t  elev;
+    i_t     ca, cb;
+  };
+  std::vector< std::vector<Pass> > tile_passes(ntiles);
+  std::vector<i_t> seed_cell(nlabels+1);
+  uint64_t processed_cells = 0;
+
+  const int d8_order[9] = {0,1,3,5,7,2,4,6,8};
+
+  std::cerr<<"p Flooding tiles..."<<std::endl;
+  Timer timer;
+  timer.start();
+  #pragma omp parallel for schedule(dynamic) reduction(+:processed_cells)
+  for(int t=0;t<ntiles;t++){
+    const int x0 = (t%gridx)*tile_width;
+    const int y0 = (t/gridx)*tile_height;
+    const int x1 = std::min(x0+tile_width, elevations.width());
+    const int y1 = std::min(y0+tile_height,elevations.height());
+    const int w  = x1-x0;
+
+    //Watershed labels and fill elevations of the tile's cells. Label 0 marks
+    //cells the flood has not reached.
+    std::vector<int32_t> label((int64_t)w*(y1-y0),0);
+    std::vector<elev_t>  fill ((int64_t)w*(y1-y0));
+    const auto TI = [&](const int x, const int y){
+      return (int64_t)(y-y0)*w+(x-x0);
+    };
+
+    Queue<elev_t> open;
+    std::queue<GridCellZ<elev_t> > pit;
+    int32_t clabel = label_offset[t];
+    for(int y=y0;y<y1;y++)
+    for(int x=x0;x<x1;x++){
+      if(x!=x0 && x!=x1-1 && y!=y0 && y!=y1-1)
+        continue;
+      label[TI(x,y)]    = ++clabel;
+      fill[TI(x,y)]     = elevations(x,y);
+      seed_cell[clabel] = elevations.xyToI(x,y);
+      flowdirs(x,y)     = NO_FLOW;
+      open.emplace(x,y,elevations(x,y));
+    }
+
+    std::unordered_map<uint64_t, Pass> passes;
+    while(open.size()>0 || pit.size()>0){
+      GridCellZ<elev_t> c;
+      if(pit.size()>0){
+        c=pit.front();
+        pit.pop();
+      } else {
+        c=open.top();
+        open.pop();
+      }
+      processed_cells++;
+
+      const int32_t my_label = label[TI(c.x,c.y)];
+      for(int no=1;no<=8;no++){
+        const int n  = d8_order[no];
+        const int nx = c.x+dx[n];
+        const int ny = c.y+dy[n];
+        if(nx<x0 || nx>=x1 || ny<y0 || ny>=y1)
+          continue;
+
+        const int64_t ni     = TI(nx,ny);
+        const int32_t nlabel = label[ni];
+        if(nlabel==0){
+          label[ni]       = my_label;
+          flowdirs(nx,ny) = d8_inverse[n];
+          if(elevations(nx,ny)<=c.z){
+            fill[ni] = c.z;
+            pit.emplace(nx,ny,c.z);
+          } else {
+            fill[ni] = elevations(nx,ny);
+            open.emplace(nx,ny,elevations(nx,ny));
+          }
+        } else if(nlabel!=my_label){
+          const bool     mine_first = my_label<nlabel;
+          const uint64_t key  = mine_first ? ((uint64_t)my_label<<32 | (uint32_t)nlabel) : ((uint64_t)nlabel<<32 | (uint32_t)my_label);
+          const elev_t   elev = std::max(c.z,fill[ni]);
+          const i_t      ci   = elevations.xyToI(c.x,c.y);
+          const i_t      nci  = elevations.xyToI(nx,ny);
+          const Pass     p    = mine_first ? Pass{my_label,nlabel,elev,ci,nci} : Pass{nlabel,my_label,elev,nci,ci};
+          const auto found = passes.find(key);
+          if(found==passes.end())
+            passes.emplace(key,p);
+          else if(elev<found->second.elev)
+            found->second = p;
+        }
+      }
+    }
+
+    for(const auto &kv: passes)
+      tile_passes[t].push_back(kv.second);
+  }
+  std::cerr<<"t Tile flooding time = "<<timer.stop()<<" s"<<std::endl;
+
+  //Passes to the tiles to the right, below-left, below, and below-right,
+  //which are the neighbouring tiles with higher indices. Border cells are not
+  //raised, so the pass is the higher of the two.
+  #pragma omp parallel for schedule(dynamic)
+  for(int t=0;t<ntiles;t++){
+    const int x0 = (t%gridx)*tile_width;
+    const int y0 = (t/gridx)*tile_height;
+    const int x1 = std::min(x0+tile_width, elevations.width());
+    const int y1 = std::min(y0+tile_height,elevations.height());
+
+    const auto AddPasses = [&](const int x, const int y){
+      for(int n=1;n<=8;n++){
+        const int nx = x+dx[n];
+        const int ny = y+dy[n];
+        if(!elevations.inGrid(nx,ny) || TileOf(nx,ny)<=t)
+          continue;
+        tile_passes[t].push_back(Pass{
+          BorderLabel(x,y), BorderLabel(nx,ny),
+          std::max(elevations(x,y),elevations(nx,ny)),
+          elevations.xyToI(x,y), elevations.xyToI(nx,ny)
+        });
+      }
+    };
+    for(int y=y0;y<y1;y++)
+      AddPasses(x1-1,y);
+    for(int x=x0;x<x1-1;x++)
+      AddPasses(x,y1-1);
+  }
+
+  std::cerr<<"p Flooding the graph of watersheds..."<<std::endl;
+  timer.reset();
+  timer.start();
+
+  std::vector<Pass> passes;
+  for(auto &tp: tile_passes){
+    passes.insert(passes.end(),tp.begin(),tp.end());
+    tp.clear();
+    tp.shrink_to_fit();
+  }
+
+  //Adjacency lists of the graph, in compressed form, holding pass indices
+  std::vector<uint64_t> first(nlabels+2,0);
+  for(const auto &p: passes){
+    first[p.a+1]++;
+    first[p.b+1]++;
+  }
+  for(int32_t l=1;l<=nlabels+1;l++)
+    first[l] += first[l-1];
+  std::vector<uint64_t> adj(first[nlabels+1]);
+  {
+    std::vector<uint64_t> next(first.begin(),first.end()-1);
+    for(uint64_t e=0;e<passes.size();e++){
+      adj[next[passes[e].a]++] = e;
+      adj[next[passes[e].b]++] = e;
+    }
+  }
+
+  //Priority-Flood over the graph, as in parallel_priority_flood_watersheds().
+  //Each watershed notes the pass it drains through; those seeded by the edge
+  //of the DEM drain off it.
+  const uint64_t NO_PASS = std::numeric_limits<uint64_t>::max();
+  std::vector<elev_t>   level(nlabels+1,std::numeric_limits<elev_t>::max());
+  std::vector<uint64_t> drains_by(nlabels+1,NO_PASS);
+  std::vector<uint8_t>  settled(nlabels+1,false);
+  typedef std::pair<elev_t,int32_t> LevelLabel;
+  std::priority_queue<LevelLabel, std::vector<LevelLabel>, std::greater<LevelLabel> > gopen;
+
+  for(int32_t l=1;l<=nlabels;l++){
+    int x,y;
+    elevations.iToxy(seed_cell[l],x,y);
+    if(!elevations.isEdgeCell(x,y))
+      continue;
+    level[l] = elevations(seed_cell[l]);
+    gopen.emplace(level[l],l);
+  }
+
+  while(!gopen.empty()){
+    const auto c = gopen.top();
+    gopen.pop();
+    if(settled[c.second])
+      continue;
+    settled[c.second] = true;
+    for(uint64_t j=first[c.second];j<first[c.second+1];j++){
+      const Pass    &p    = passes[adj[j]];
+      const int32_t m     = (p.a==c.second) ? p.b : p.a;
+      const elev_t  mlev  = std::max(c.first,p.elev);
+      if(settled[m] || !(mlev<level[m]))
+        continue;
+      level[m]     = mlev;
+      drains_by[m] = adj[j];
+      gopen.emplace(mlev,m);
+    }
+  }
+  std::cerr<<"t Graph flooding time = "<<timer.stop()<<" s"<<std::endl;
+
+  std::cerr<<"p Re-rooting watersheds..."<<std::endl;
+  timer.reset();
+  timer.start();
+  //Each watershed is a tree of its own cells, so the paths which are reversed
+  //do not overlap
+  #pragma omp parallel for schedule(dynamic,256)
+  for(int32_t l=1;l<=nlabels;l++){
+    if(drains_by[l]==NO_PASS)
+      continue;
+    const Pass &p = passes[drains_by[l]];
+    i_t cur  = (p.a==l) ? p.ca : p.cb;
+    i_t prev = (p.a==l) ? p.cb : p.ca;
+    while(true){
+      int cx, cy, px, py;
+      elevations.iToxy(cur, cx,cy);
+      elevations.iToxy(prev,px,py);
+      const d8_flowdir_t old = flowdirs(cx,cy);
+      for(int n=1;n<=8;n++)
+        if(cx+dx[n]==px && cy+dy[n]==py)
+          flowdirs(cx,cy) = n;
+      if(old==NO_FLOW)
+        break;
+      prev = cur;
+      cur  = elevations.xyToI(cx+dx[old],cy+dy[old]);
+    }
+  }
+
+  //Cells which are not part of the DEM do not flow, except on the edge, where
+  //they flow off it as in priority_flood_flowdirs()
+  #pragma omp parallel for
+  for(int y=1;y<elevations.height()-1;y++)
+  for(int x=1;x<elevations.width()-1;x++)
+    if(elevations.isNoData(x,y))
+      flowdirs(x,y) = flowdirs.noData();
+
+  for(int x=0;x<elevations.width();x++){
+    flowdirs(x,0)                       = 3;
+    flowdirs(x,elevations.height()-1)   = 7;
+  }
+  for(int y=1;y<elevations.height()-1;y++){
+    flowdirs(0,y)                       = 1;
+    flowdirs(elevations.width()-1,y)    = 5;
+  }
+  flowdirs(0,0)                                   = 2;
+  flowdirs(flowdirs.width()-1,0)                  = 4;
+  flowdirs(0,flowdirs.height()-1)                 = 8;
+  flowdirs(flowdirs.width()-1,flowdirs.height()-1)= 6;
+  std::cerr<<"t Re-rooting time = "<<timer.stop()<<" s"<<std::endl;
+
+  std::cerr<<"m Tiles = "<<ntiles<<std::endl;
+  std::cerr<<"m Tile watersheds = "<<nlabels<<std::endl;
+  std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
+  std::cerr<<"t Wall-time = "<<overall.stop()<<" s"<<std::endl;
+  Instrumentation::get().count("parallel_priority_flood_flowdirs.processed_cells",processed_cells);
+  Instrumentation::get().count("parallel_priority_flood_flowdirs.tile_watersheds",nlabels);
 }
 
 
@@ -553,6 +1293,8 @@ void priority_flood_flowdirs(const Array2D<elev_t> &elevations, Array2D<d8_flowd
     part of a pit and is given a value 1 to indicate this. The result is a grid
     where every cell which is in a pit is labeled.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in]   &elevations   A grid of cell elevations
   @param[out]  &pit_mask     A grid of indicating which cells are in pits
 
@@ -569,14 +1311,15 @@ void priority_flood_flowdirs(const Array2D<elev_t> &elevations, Array2D<d8_flowd
     The correctness of this command is determined by inspection. (TODO)
 */
 //TODO: Can I use a smaller data type?
-template <class elev_t>
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
 void pit_mask(const Array2D<elev_t> &elevations, Array2D<uint8_t> &pit_mask){
-  GridCellZ_pq<elev_t> open;
+  Queue<elev_t> open;
   std::queue<GridCellZ<elev_t> > pit;
   uint64_t processed_cells = 0;
   uint64_t pitc            = 0;
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("pit_mask");
   std::cerr<<"\nA Pit Mask"<<std::endl;
   std::cerr<<"C Barnes, R. 2016. RichDEM: Terrain Analysis Software. http://github.com/r-barnes/richdem"<<std::endl;
   
@@ -647,6 +1390,8 @@ void pit_mask(const Array2D<elev_t> &elevations, Array2D<uint8_t> &pit_mask){
   std::cerr<<"\t\033[96msucceeded in "<<progress.stop()<<"s.\033[39m"<<std::endl;
   std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
   std::cerr<<"m Cells in depressions = "  <<pitc           <<std::endl;
+  Instrumentation::get().count("pit_mask.processed_cells",processed_cells);
+  Instrumentation::get().count("pit_mask.pit_cells",      pitc);
 }
 
 
@@ -663,6 +1408,8 @@ void pit_mask(const Array2D<elev_t> &elevations, Array2D<uint8_t> &pit_mask){
     a grid of cells where all cells with a common label drain to a common
     point.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in,out] elevations        A grid of cell elevations
   @param[out]    labels            A grid to hold the watershed labels
   @param[in]     alter_elevations
@@ -684,17 +1431,18 @@ void pit_mask(const Array2D<elev_t> &elevations, Array2D<uint8_t> &pit_mask){
   @correctness
     The correctness of this command is determined by inspection. (TODO)
 */
-template<class elev_t>
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
 void priority_flood_watersheds(
   Array2D<elev_t> &elevations, Array2D<int32_t> &labels, bool alter_elevations
 ){
-  GridCellZ_pq<elev_t> open;
+  Queue<elev_t> open;
   std::queue<GridCellZ<elev_t> > pit;
   unsigned long processed_cells=0;
   unsigned long pitc=0,openc=0;
   int clabel=1;  //TODO: Thought this was more clear than zero in the results.
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("priority_flood_watersheds");
   std::cerr<<"\nA Priority-Flood+Watershed Labels"<<std::endl;
   std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
   std::cerr<<"Setting up boolean flood array matrix..."<<std::endl;
@@ -762,7 +1510,7 @@ void priority_flood_watersheds(
           elevations(nx,ny)=c.z;
         pit.push(GridCellZ<elev_t>(nx,ny,c.z));
       } else
-        open.push(GridCellZ<elev_t>(nx,ny,elevations(nx,ny)));
+        open.emplace(nx,ny,elevations(nx,ny));
     }
     progress.update(processed_cells);
   }
@@ -772,6 +1520,603 @@ void priority_flood_watersheds(
   std::cerr<<"m Cells processed   = "  <<processed_cells<<std::endl;
   std::cerr<<"m Cells in pits     = "  <<pitc           <<std::endl;
   std::cerr<<"m Cells not in pits = "  <<openc          <<std::endl;
+  Instrumentation::get().count("priority_flood_watersheds.processed_cells",processed_cells);
+  Instrumentation::get().count("priority_flood_watersheds.pit_cells",      pitc);
+}
+
+
+
+/**
+  @brief  Labels watersheds as priority_flood_watersheds() does, with the DEM
+          split into tiles which are flooded in parallel
+  @author Richard Barnes (rbarnes@umn.edu)
+
+    This follows the parallel Priority-Flood of Barnes (2016), with threads in
+    place of the message passing used there.
+
+    1. Each tile is flooded, in parallel, as though its border were the edge of
+       the DEM: each border cell seeds a watershed of its own. Labels are
+       offset by the number of border cells in the preceding tiles so that they
+       are unique across tiles. Where two of a tile's watersheds meet, the
+       lowest pass between them is noted.
+    2. The watersheds of neighbouring tiles are joined by passes between the
+       border cells they face each other across.
+    3. The resulting graph of watersheds is flooded from the watersheds seeded
+       by the edge of the DEM, giving each watershed the elevation to which it
+       must be filled and the edge watershed it drains into.
+    4. Each cell is relabelled with that edge watershed, and filled, in
+       parallel.
+
+    As with priority_flood_watersheds(), each cell on the edge of the DEM seeds
+    its own watershed. Which watershed a cell joins where two could claim it
+    depends on the order in which the flood meets cells of equal elevation, so
+    cells may be labelled differently than by priority_flood_watersheds(), but
+    the watersheds satisfy the same postconditions.
+
+  @tparam     Queue         Priority queue used to flood each tile (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
+  @param[in,out] elevations        A grid of cell elevations
+  @param[out]    labels            A grid to hold the watershed labels
+  @param[in]     alter_elevations
+    If true, then **elevations** is altered as though improved_priority_flood()
+    had been applied. Otherwise, **elevations** is not altered.
+  @param[in]     tile_width        Width of the tiles
+  @param[in]     tile_height       Height of the tiles
+
+  @pre
+    1. **elevations** contains the elevations of every cell or a value _NoData_
+       for cells not part of the DEM. Note that the _NoData_ value is assumed to
+       be a negative number less than any actual data value.
+
+  @post
+    1. **elevations** contains no depressions or digital dams, if
+       **alter_elevations** was set.
+    2. **labels** contains a label for each cell indicating its membership in a
+       given watershed. Cells bearing common labels drain to common points.
+
+  @correctness
+    The correctness of this command is determined by comparison with
+    improved_priority_flood() and by checking the postconditions in the tests.
+*/
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
+void parallel_priority_flood_watersheds(
+  Array2D<elev_t>  &elevations,
+  Array2D<int32_t> &labels,
+  bool             alter_elevations,
+  const int        tile_width  = 512,
+  const int        tile_height = 512
+){
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  ScopedTimer scoped_timer("parallel_priority_flood_watersheds");
+  std::cerr<<"\nA Priority-Flood+Watershed Labels (tile-parallel)"<<std::endl;
+  std::cerr<<"C Barnes, R., 2016. Parallel Priority-Flood depression filling for trillion cell digital elevation models on desktops or clusters. Computers & Geosciences 96, 56--68. doi:10.1016/j.cageo.2016.07.001"<<std::endl;
+
+  if(tile_width<1 || tile_height<1){
+    std::cerr<<"E Tile width and height must be at least 1!"<<std::endl;
+    throw std::runtime_error("Tile width and height must be at least 1!");
+  }
+
+  Timer overall;
+  overall.start();
+
+  const int gridx  = (elevations.width() +tile_width -1)/tile_width;
+  const int gridy  = (elevations.height()+tile_height-1)/tile_height;
+  const int ntiles = gridx*gridy;
+
+  const auto TileOf = [&](const int x, const int y){
+    return (y/tile_height)*gridx+x/tile_width;
+  };
+
+  //Label 0 marks unlabelled cells. Tile t's watersheds are labelled from
+  //label_offset[t]+1, one for each cell of its border.
+  std::vector<int32_t> label_offset(ntiles+1,0);
+  for(int t=0;t<ntiles;t++){
+    const int w = std::min(tile_width, elevations.width() -(t%gridx)*tile_width );
+    const int h = std::min(tile_height,elevations.height()-(t/gridx)*tile_height);
+    const int64_t border = (w==1 || h==1) ? (int64_t)w*h : 2*(int64_t)w+2*(int64_t)h-4;
+    if(label_offset[t]+border>=std::numeric_limits<int32_t>::max()){
+      std::cerr<<"E Too many tile borders to label! Use larger tiles."<<std::endl;
+      throw std::runtime_error("Too many tile borders to label! Use larger tiles.");
+    }
+    label_offset[t+1] = label_offset[t]+border;
+  }
+  const int32_t nlabels = label_offset[ntiles];
+
+  //Flooding from a tile's border fills the tile as though its border drained
+  //away. When altering the elevations this is done in place, since the border
+  //cells, which the passes between tiles are taken from, are not changed.
+  Array2D<elev_t> local_copy;
+  if(!alter_elevations)
+    local_copy = elevations;
+  Array2D<elev_t> &filled = alter_elevations ? elevations : local_copy;
+
+  labels.resize(elevations.width(),elevations.height(),0);
+  labels.setNoData(-1);
+
+  //A pass between two watersheds
+  struct Pass {
+    int32_t a, b;
+    elev_t  elev;
+  };
+  std::vector< std::vector<Pass> > tile_passes(ntiles);
+  std::vector<i_t> seed_cell(nlabels+1);
+  uint64_t processed_cells = 0;
+
+  std::cerr<<"p Flooding tiles..."<<std::endl;
+  Timer timer;
+  timer.start();
+  #pragma omp parallel for schedule(dynamic) reduction(+:processed_cells)
+  for(int t=0;t<ntiles;t++){
+    const int x0 = (t%gridx)*tile_width;
+    const int y0 = (t/gridx)*tile_height;
+    const int x1 = std::min(x0+tile_width, elevations.width());
+    const int y1 = std::min(y0+tile_height,elevations.height());
+
+    Queue<elev_t> open;
+    std::queue<GridCellZ<elev_t> > pit;
+    int32_t clabel = label_offset[t];
+    for(int y=y0;y<y1;y++)
+    for(int x=x0;x<x1;x++){
+      if(x!=x0 && x!=x1-1 && y!=y0 && y!=y1-1)
+        continue;
+      labels(x,y)         = ++clabel;
+      seed_cell[clabel]   = elevations.xyToI(x,y);
+      open.emplace(x,y,elevations(x,y));
+    }
+
+    std::unordered_map<uint64_t, elev_t> passes;
+    while(open.size()>0 || pit.size()>0){
+      GridCellZ<elev_t> c;
+      if(pit.size()>0){
+        c=pit.front();
+        pit.pop();
+      } else {
+        c=open.top();
+        open.pop();
+      }
+      processed_cells++;
+
+      const int32_t my_label = labels(c.x,c.y);
+      for(int n=1;n<=8;n++){
+        const int nx = c.x+dx[n];
+        const int ny = c.y+dy[n];
+        if(nx<x0 || nx>=x1 || ny<y0 || ny>=y1)
+          continue;
+
+        const int32_t nlabel = labels(nx,ny);
+        if(nlabel==0){
+          labels(nx,ny) = my_label;
+          if(elevations(nx,ny)<=c.z){
+            filled(nx,ny) = c.z;
+            pit.emplace(nx,ny,c.z);
+          } else
+            open.emplace(nx,ny,elevations(nx,ny));
+        } else if(nlabel!=my_label){
+          const uint64_t key  = ((uint64_t)std::min(my_label,nlabel)<<32) | (uint32_t)std::max(my_label,nlabel);
+          const elev_t   elev = std::max(c.z,filled(nx,ny));
+          const auto found = passes.find(key);
+          if(found==passes.end())
+            passes.emplace(key,elev);
+          else if(elev<found->second)
+            found->second = elev;
+        }
+      }
+    }
+
+    for(const auto &kv: passes)
+      tile_passes[t].push_back(Pass{(int32_t)(kv.first>>32),(int32_t)(kv.first&0xFFFFFFFF),kv.second});
+  }
+  std::cerr<<"t Tile flooding time = "<<timer.stop()<<" s"<<std::endl;
+
+  //Passes between tiles are found once every tile is labelled
+  #pragma omp parallel for schedule(dynamic)
+  for(int t=0;t<ntiles;t++){
+    const int x0 = (t%gridx)*tile_width;
+    const int y0 = (t/gridx)*tile_height;
+    const int x1 = std::min(x0+tile_width, elevations.width());
+    const int y1 = std::min(y0+tile_height,elevations.height());
+
+    //Passes to the tiles to the right, below-left, below, and below-right,
+    //which are the neighbouring tiles with higher indices. The border cells on
+    //either side have not been raised, so the pass is the higher of the two.
+    const auto AddPasses = [&](const int x, const int y){
+      for(int n=1;n<=8;n++){
+        const int nx = x+dx[n];
+        const int ny = y+dy[n];
+        if(!elevations.inGrid(nx,ny) || TileOf(nx,ny)<=t)
+          continue;
+        tile_passes[t].push_back(Pass{labels(x,y),labels(nx,ny),std::max(elevations(x,y),elevations(nx,ny))});
+      }
+    };
+    for(int y=y0;y<y1;y++)
+      AddPasses(x1-1,y);
+    for(int x=x0;x<x1-1;x++)
+      AddPasses(x,y1-1);
+  }
+
+  std::cerr<<"p Flooding the graph of watersheds..."<<std::endl;
+  timer.reset();
+  timer.start();
+
+  //Adjacency lists of the graph, in compressed form
+  std::vector<uint64_t> first(nlabels+2,0);
+  for(const auto &tp: tile_passes)
+  for(const auto &p: tp){
+    first[p.a+1]++;
+    first[p.b+1]++;
+  }
+  for(int32_t l=1;l<=nlabels+1;l++)
+    first[l] += first[l-1];
+  std::vector< std::pair<int32_t,elev_t> > adj(first[nlabels+1]);
+  {
+    std::vector<uint64_t> next(first.begin(),first.end()-1);
+    for(auto &tp: tile_passes){
+      for(const auto &p: tp){
+        adj[next[p.a]++] = std::make_pair(p.b,p.elev);
+        adj[next[p.b]++] = std::make_pair(p.a,p.elev);
+      }
+      tp.clear();
+      tp.shrink_to_fit();
+    }
+  }
+
+  //Priority-Flood over the graph. A watershed's level is the elevation to
+  //which its cells must be filled for it to drain off the DEM. Unlike a flood
+  //over cells, the passes into a watershed differ in height, so a watershed is
+  //only settled when it leaves the queue.
+  std::vector<elev_t>  level(nlabels+1,std::numeric_limits<elev_t>::max());
+  std::vector<int32_t> outlet(nlabels+1,0);
+  std::vector<uint8_t> settled(nlabels+1,false);
+  typedef std::pair<elev_t,int32_t> LevelLabel;
+  std::priority_queue<LevelLabel, std::vector<LevelLabel>, std::greater<LevelLabel> > gopen;
+
+  //Outlets are numbered in the order their cells appear in the DEM. Outlets on
+  //NoData cells are labelled NoData, as in priority_flood_watersheds().
+  std::vector<int32_t> edge_labels;
+  for(int32_t l=1;l<=nlabels;l++){
+    int x,y;
+    elevations.iToxy(seed_cell[l],x,y);
+    if(elevations.isEdgeCell(x,y))
+      edge_labels.push_back(l);
+  }
+  std::sort(edge_labels.begin(),edge_labels.end(),[&](const int32_t a, const int32_t b){
+    return seed_cell[a]<seed_cell[b];
+  });
+  std::vector<int32_t> outlet_label(nlabels+1,-1);
+  int32_t next_outlet = 1;
+  for(const auto l: edge_labels){
+    level[l]  = elevations(seed_cell[l]);
+    outlet[l] = l;
+    if(!elevations.isNoData(seed_cell[l]))
+      outlet_label[l] = next_outlet++;
+    gopen.emplace(level[l],l);
+  }
+
+  while(!gopen.empty()){
+    const auto c = gopen.top();
+    gopen.pop();
+    if(settled[c.second])
+      continue;
+    settled[c.second] = true;
+    for(uint64_t e=first[c.second];e<first[c.second+1];e++){
+      const int32_t m    = adj[e].first;
+      const elev_t  mlev = std::max(c.first,adj[e].second);
+      if(settled[m] || !(mlev<level[m]))
+        continue;
+      level[m]  = mlev;
+      outlet[m] = outlet[c.second];
+      gopen.emplace(mlev,m);
+    }
+  }
+  std::cerr<<"t Graph flooding time = "<<timer.stop()<<" s"<<std::endl;
+
+  std::cerr<<"p Relabelling..."<<std::endl;
+  timer.reset();
+  timer.start();
+  #pragma omp parallel for
+  for(i_t i=0;i<labels.size();i++){
+    const int32_t l = labels(i);
+    if(level[l]>filled(i))
+      filled(i) = level[l];
+    labels(i) = outlet_label[outlet[l]];
+  }
+  std::cerr<<"t Relabelling time = "<<timer.stop()<<" s"<<std::endl;
+
+  std::cerr<<"m Tiles = "<<ntiles<<std::endl;
+  std::cerr<<"m Tile watersheds = "<<nlabels<<std::endl;
+  std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
+  std::cerr<<"t Wall-time = "<<overall.stop()<<" s"<<std::endl;
+  Instrumentation::get().count("parallel_priority_flood_watersheds.processed_cells",processed_cells);
+  Instrumentation::get().count("parallel_priority_flood_watersheds.tile_watersheds",nlabels);
+}
+
+
+
+/**
+  @brief  Indicates which cells are in depressions, as pit_mask() does, with
+          the DEM split into tiles which are filled in parallel
+  @author Richard Barnes (rbarnes@umn.edu)
+
+    The DEM is filled by parallel_priority_flood_watersheds(), which floods the
+    tiles in parallel and joins them through the graph of their watersheds. A
+    cell is in a pit if it lies below its filled elevation; this comparison is
+    also made in parallel.
+
+    The DEM must fit in memory as an Array2D; this cannot be used with an
+    A2Array2D. Two copies of the DEM and a grid of labels are held during the
+    fill, about three times the memory of pit_mask(), which remains the better
+    choice when memory is tight.
+
+  @tparam     Queue         Priority queue used to flood each tile (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
+  @param[in]   &elevations   A grid of cell elevations
+  @param[out]  &pit_mask     A grid of indicating which cells are in pits
+  @param[in]   tile_width    Width of the tiles
+  @param[in]   tile_height   Height of the tiles
+
+  @pre
+    1. **elevations** contains the elevations of every cell or a value _NoData_
+       for cells not part of the DEM. Note that the _NoData_ value is assumed to
+       be a negative number less than any actual data value.
+
+  @post
+    1. **pit_mask** contains a 1 for each cell which is in a pit and a 0 for
+       each cell which is not. The value 3 indicates NoData
+
+  @correctness
+    The correctness of this command is determined by comparison with
+    pit_mask() in the tests.
+*/
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
+void parallel_pit_mask(
+  const Array2D<elev_t> &elevations,
+  Array2D<uint8_t>      &pit_mask,
+  const int             tile_width  = 512,
+  const int             tile_height = 512
+){
+  typedef typename Array2D<elev_t>::i_t i_t;
+
+  ScopedTimer scoped_timer("parallel_pit_mask");
+  std::cerr<<"\nA Pit Mask (tile-parallel)"<<std::endl;
+  std::cerr<<"C Barnes, R. 2016. RichDEM: Terrain Analysis Software. http://github.com/r-barnes/richdem"<<std::endl;
+
+  Array2D<elev_t> filled(elevations);
+  {
+    Array2D<int32_t> labels;
+    parallel_priority_flood_watersheds<Queue>(filled, labels, true, tile_width, tile_height);
+  }
+
+  std::cerr<<"p Setting up the pit mask matrix..."<<std::endl;
+  pit_mask.resize(elevations.width(),elevations.height());
+  pit_mask.setNoData(3);
+
+  std::cerr<<"p Comparing filled and original elevations..."<<std::endl;
+  Timer timer;
+  timer.start();
+  uint64_t pitc = 0;
+  #pragma omp parallel for reduction(+:pitc)
+  for(i_t i=0;i<elevations.size();i++){
+    if(elevations.isNoData(i)){
+      pit_mask(i) = pit_mask.noData();
+    } else if(elevations(i)<filled(i)){
+      pit_mask(i) = 1;
+      pitc++;
+    } else {
+      pit_mask(i) = 0;
+    }
+  }
+  std::cerr<<"t Comparison time = "<<timer.stop()<<" s"<<std::endl;
+
+  std::cerr<<"m Cells in depressions = "<<pitc<<std::endl;
+  Instrumentation::get().count("parallel_pit_mask.pit_cells",pitc);
+}
+
+
+
+/**
+  @brief  Updates a filled DEM and its watershed labels after part of the DEM
+          has been edited, re-flooding only the watersheds the edit touches
+  @author Richard Barnes (rbarnes@umn.edu)
+
+    In the output of priority_flood_watersheds(), each cell is filled to the
+    highest elevation on a path which runs entirely through its own watershed
+    to the edge of the DEM. Editing the cells of a rectangle can therefore only
+    change the fill of the watersheds which the rectangle overlaps, unless the
+    edit opens a lower way out for some neighbouring watershed.
+
+    The watersheds overlapping the rectangle are unlabelled and re-flooded with
+    Priority-Flood, starting from their cells on the edge of the DEM and from
+    the filled elevations of the cells bordering them. Those bordering cells
+    are then checked: if one could now drain through the re-flooded region at
+    a lower elevation than its fill, its watershed is added to the region and
+    the region is flooded again. Only the cells of the affected watersheds are
+    visited, so small edits to large DEMs are cheap.
+
+  @tparam     Queue       Priority queue used for the open set (see
+                          priority_queues.hpp). Defaults to GridCellZ_pq.
+  @param[in]     &elevations  The edited DEM
+  @param[in,out] &filled      The output of priority_flood_watersheds() with
+                              alter_elevations set, made before the edit.
+                              Updated to the fill of the edited DEM.
+  @param[in,out] &labels      The watershed labels from the same call. Updated
+                              to match **filled**.
+  @param[in]     xmin,ymin    Top-left corner of the edited rectangle
+  @param[in]     xmax,ymax    Bottom-right corner of the edited rectangle
+                              (inclusive)
+
+  @pre
+    1. **elevations** differs from the DEM **filled** and **labels** were made
+       from only within the rectangle.
+
+  @post
+    1. **filled** is the same as applying improved_priority_flood() to
+       **elevations**.
+    2. **labels** satisfies the postconditions of priority_flood_watersheds()
+       for **elevations**, though cells may be labelled differently than a
+       fresh call would label them.
+
+  @correctness
+    The correctness of this command is determined by inspection and by
+    comparison against improved_priority_flood() in the tests.
+*/
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
+void incremental_priority_flood(
+  const Array2D<elev_t> &elevations,
+  Array2D<elev_t>       &filled,
+  Array2D<int32_t>      &labels,
+  int xmin, int ymin, int xmax, int ymax
+){
+  typedef typename Array2D<elev_t>::i_t i_t;
+  //Marks cells of the region being re-flooded which have not yet been reached
+  const int32_t UNLABELLED = std::numeric_limits<int32_t>::min();
+
+  ScopedTimer scoped_timer("incremental_priority_flood");
+  std::cerr<<"\nA Incremental Priority-Flood+Watershed Labels"<<std::endl;
+  std::cerr<<"C Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
+
+  if(filled.width()!=elevations.width() || filled.height()!=elevations.height() || labels.width()!=elevations.width() || labels.height()!=elevations.height()){
+    std::cerr<<"E The filled DEM and labels must have the same dimensions as the DEM!"<<std::endl;
+    throw std::runtime_error("The filled DEM and labels must have the same dimensions as the DEM!");
+  }
+
+  xmin = std::max(xmin,0);
+  ymin = std::max(ymin,0);
+  xmax = std::min(xmax,elevations.width() -1);
+  ymax = std::min(ymax,elevations.height()-1);
+  if(xmin>xmax || ymin>ymax)
+    return;
+
+  std::vector<i_t>                       region;      //Cells being re-flooded
+  std::vector< std::pair<i_t,int32_t> >  edge_seeds;  //Region cells on the DEM's edge, with their labels
+  std::vector<int32_t>                   new_labels;  //Watersheds to add to the region
+  std::vector<i_t>                       new_seeds;   //A cell of each of those watersheds
+
+  for(int y=ymin;y<=ymax;y++)
+  for(int x=xmin;x<=xmax;x++){
+    new_labels.push_back(labels(x,y));
+    new_seeds.push_back(labels.xyToI(x,y));
+  }
+
+  uint64_t rounds          = 0;
+  uint64_t processed_cells = 0;
+
+  while(!new_labels.empty()){
+    rounds++;
+
+    //Unlabel the cells of the region, adding the new watersheds to it. Each
+    //watershed is connected, so a flood-fill from any of its cells finds it.
+    //The fill runs before the region is unlabelled since part of a watershed
+    //may have been re-flooded in an earlier round.
+    std::sort(new_labels.begin(),new_labels.end());
+    new_labels.erase(std::unique(new_labels.begin(),new_labels.end()),new_labels.end());
+    const auto is_new = [&](const int32_t l){
+      return std::binary_search(new_labels.begin(),new_labels.end(),l);
+    };
+    const auto unlabel = [&](const i_t i){
+      int x,y;
+      labels.iToxy(i,x,y);
+      if(elevations.isEdgeCell(x,y))
+        edge_seeds.emplace_back(i,labels(i));
+      labels(i) = UNLABELLED;
+      region.push_back(i);
+    };
+
+    for(const auto s: new_seeds){
+      if(labels(s)==UNLABELLED || !is_new(labels(s)))
+        continue;
+      size_t next = region.size();
+      unlabel(s);
+      for(;next<region.size();next++){
+        int x,y;
+        labels.iToxy(region[next],x,y);
+        for(int n=1;n<=8;n++){
+          const int nx = x+dx[n];
+          const int ny = y+dy[n];
+          if(labels.inGrid(nx,ny) && labels(nx,ny)!=UNLABELLED && is_new(labels(nx,ny)))
+            unlabel(labels.xyToI(nx,ny));
+        }
+      }
+    }
+    new_labels.clear();
+    new_seeds.clear();
+    for(const auto i: region)
+      labels(i) = UNLABELLED;
+    std::sort(region.begin(),region.end());
+    region.erase(std::unique(region.begin(),region.end()),region.end());
+    std::sort(edge_seeds.begin(),edge_seeds.end());
+    edge_seeds.erase(std::unique(edge_seeds.begin(),edge_seeds.end()),edge_seeds.end());
+
+    //Flood the region from its edge cells and from the cells around it
+    Queue<elev_t> open;
+    std::queue<GridCellZ<elev_t> > pit;
+    for(const auto &es: edge_seeds){
+      int x,y;
+      labels.iToxy(es.first,x,y);
+      labels(es.first) = es.second;
+      filled(es.first) = elevations(es.first);
+      open.emplace(x,y,elevations(es.first));
+    }
+    for(const auto i: region){
+      int x,y;
+      labels.iToxy(i,x,y);
+      for(int n=1;n<=8;n++){
+        const int nx = x+dx[n];
+        const int ny = y+dy[n];
+        if(labels.inGrid(nx,ny) && labels(nx,ny)!=UNLABELLED)
+          open.emplace(nx,ny,filled(nx,ny));
+      }
+    }
+
+    while(open.size()>0 || pit.size()>0){
+      GridCellZ<elev_t> c;
+      if(pit.size()>0){
+        c=pit.front();
+        pit.pop();
+      } else {
+        c=open.top();
+        open.pop();
+      }
+      processed_cells++;
+
+      for(int n=1;n<=8;n++){
+        const int nx = c.x+dx[n];
+        const int ny = c.y+dy[n];
+        if(!labels.inGrid(nx,ny) || labels(nx,ny)!=UNLABELLED)
+          continue;
+        labels(nx,ny) = labels(c.x,c.y);
+        if(elevations(nx,ny)<=c.z){
+          filled(nx,ny) = c.z;
+          pit.emplace(nx,ny,c.z);
+        } else {
+          filled(nx,ny) = elevations(nx,ny);
+          open.emplace(nx,ny,elevations(nx,ny));
+        }
+      }
+    }
+
+    //A neighbouring watershed must be re-flooded too if one of its cells can
+    //now drain through the region at a lower elevation than its fill
+    for(const auto i: region){
+      int x,y;
+      labels.iToxy(i,x,y);
+      for(int n=1;n<=8;n++){
+        const int nx = x+dx[n];
+        const int ny = y+dy[n];
+        if(!labels.inGrid(nx,ny))
+          continue;
+        if(std::max(elevations(nx,ny),filled(i))<filled(nx,ny)){
+          new_labels.push_back(labels(nx,ny));
+          new_seeds.push_back(labels.xyToI(nx,ny));
+        }
+      }
+    }
+  }
+
+  std::cerr<<"m Rounds = "<<rounds<<std::endl;
+  std::cerr<<"m Cells re-flooded = "<<region.size()<<std::endl;
+  Instrumentation::get().count("incremental_priority_flood.processed_cells",processed_cells);
+  Instrumentation::get().count("incremental_priority_flood.reflooded_cells",region.size());
 }
 
 
@@ -792,6 +2137,8 @@ void priority_flood_watersheds(
     When a depression is encountered this command measures its size before 
     filling it. Only small depressions are filled.
 
+  @tparam     Queue         Priority queue used for the open set (see
+                             priority_queues.hpp). Defaults to GridCellZ_pq.
   @param[in,out]  &elevations   A grid of cell elevations
   @param[in]      max_dep_size  Depression must have <=max_dep_size cells to be
                                 filled
@@ -809,17 +2156,18 @@ void priority_flood_watersheds(
   @correctness
     The correctness of this command is determined by inspection. (TODO)
 */
-template <class elev_t>
+template <template<class> class Queue = GridCellZ_pq, class elev_t>
 void improved_priority_flood_max_dep(
   Array2D<elev_t> &elevations,
   uint64_t max_dep_size
 ){
-  GridCellZ_pq<elev_t> open;
+  Queue<elev_t> open;
   std::queue<GridCellZ<elev_t> > pit;
   uint64_t processed_cells = 0;
   uint64_t pitc            = 0;
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("improved_priority_flood_max_dep");
   std::cerr<<"\nPriority-Flood (Improved) with Maximum Size"<<std::endl;
   std::cerr<<"\nC Barnes, R., Lehman, C., Mulla, D., 2014. Priority-flood: An optimal depression-filling and watershed-labeling algorithm for digital elevation models. Computers & Geosciences 62, 117–127. doi:10.1016/j.cageo.2013.04.024"<<std::endl;
   std::cerr<<"p Setting up boolean flood array matrix..."<<std::endl;
@@ -890,6 +2238,8 @@ void improved_priority_flood_max_dep(
   std::cerr<<"t Succeeded in "<<std::fixed<<std::setprecision(1)<<progress.stop()<<" s"<<std::endl;
   std::cerr<<"m Cells processed = "<<processed_cells<<std::endl;
   std::cerr<<"m Cells in pits = "  <<pitc           <<std::endl;
+  Instrumentation::get().count("improved_priority_flood_max_dep.processed_cells",processed_cells);
+  Instrumentation::get().count("improved_priority_flood_max_dep.pit_cells",      pitc);
 }
 
 
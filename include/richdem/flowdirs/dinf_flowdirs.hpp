@@ -12,7 +12,11 @@ described in Barnes (TODO).
 #define _richdem_dinf_flowdirs_hpp_
 
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/ProgressBar.hpp"
+#include <cmath>
+#include <cstdint>
+#include <vector>
 
 ///Value used to indicate that a flow direction cell has no data
 #define dinf_NO_DATA -1
@@ -26,6 +30,30 @@ static const int dx_e2[8] = { 1 ,  1 , -1 , -1 , -1 , -1 , 1 ,  1 };
 static const double ac[8] = { 0.,  1.,  1.,  2.,  2.,  3., 3.,  4.};
 static const double af[8] = { 1., -1.,  1., -1.,  1., -1., 1., -1.};
 
+///How dinf_FlowDirRow() evaluates the angle of the steepest facet
+enum DinfAngleMode {
+  DINF_ANGLE_EXACT,  ///< Use std::atan2(), as dinf_FlowDir() does
+  DINF_ANGLE_APPROX  ///< Use dinf_atan_approx(). Max error 1.2e-5 radians.
+};
+
+/**
+  @brief  Polynomial approximation of atan(t) for 0<=t<=1
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  This is Eq. 4.4.49 of Abramowitz and Stegun (1964). With the coefficients
+  as printed there, the absolute error is at most 1.2e-5 radians over [0,1].
+  That interval is the only range a facet's angle can take. Unlike
+  std::atan2(), it is branch-free and so vectorizes.
+
+  @param[in] t  Ratio of the facet's slopes, s2/s1, in [0,1]
+
+  @return Approximation of atan(t)
+*/
+static double dinf_atan_approx(const double t){
+  const double t2 = t*t;
+  return t*(0.9998660+t2*(-0.3302995+t2*(0.1801410+t2*(-0.0851330+t2*0.0208351))));
+}
+
 /**
   @brief  Determine the D-infinite flow direction of a cell
   @author Implementation by Richard Barnes (rbarnes@umn.edu)
@@ -112,20 +140,147 @@ static float dinf_FlowDir(const Array2D<T> &elevations, const int x, const int y
 }
 
 
+/**
+  @brief  Determine the D-infinite flow directions of one row of a grid
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  This performs the same calculation as dinf_FlowDir(), but is laid out to be
+  vectorized. The eight facets are evaluated one at a time across the whole
+  row, with the steepest slope seen so far held in per-cell buffers. The
+  facet's case (r<0, r>pi/4, or in between) is decided with comparisons
+  rather than atan2(), so that the angle need only be calculated once per
+  cell, for the steepest facet.
+
+  In DINF_ANGLE_EXACT mode the angle is calculated as in dinf_FlowDir(). Cells
+  may then differ from dinf_FlowDir() only if two facets' slopes are equal to
+  within rounding error. In DINF_ANGLE_APPROX mode the angle is within 1.2e-5
+  radians of the exact angle.
+
+  Edge cells and rows at the top and bottom of the grid are passed to
+  dinf_FlowDir().
+
+  Helper function for dinf_flow_directions().
+
+  @param[in]  elevations  A 2D grid of elevation data
+  @param[in]  y           Row to calculate
+  @param[out] row_fds     Flow directions of the row. Must have room for
+                          `elevations.width()` values.
+  @param[in]  mode        How the angle of the steepest facet is calculated
+  @param      smax        Scratch space of at least `elevations.width()`
+  @param      nmax        Scratch space of at least `elevations.width()`
+  @param      ws1         Scratch space of at least `elevations.width()`
+  @param      ws2         Scratch space of at least `elevations.width()`
+*/
+template <class T>
+static void dinf_FlowDirRow(
+  const Array2D<T> &elevations,
+  const int         y,
+  float            *row_fds,
+  DinfAngleMode     mode,
+  double           *smax,
+  int8_t           *nmax,
+  double           *ws1,
+  double           *ws2
+){
+  const int width = elevations.width();
+
+  if(y==0 || y==elevations.height()-1 || width<3){
+    for(int x=0;x<width;x++)
+      row_fds[x] = elevations.isNoData(x,y)?dinf_NO_DATA:dinf_FlowDir(elevations,x,y);
+    return;
+  }
+
+  const T *const mid   = elevations.getDataVec().data()+(int64_t)y*width;
+  const double   diag  = sqrt(1.0*1.0+1.0*1.0);
+
+  for(int x=1;x<width-1;x++){
+    smax[x] = 0;
+    nmax[x] = -1;
+  }
+
+  for(int n=0;n<8;n++){
+    const T *const r1 = mid+(int64_t)dy_e1[n]*width+dx_e1[n];
+    const T *const r2 = mid+(int64_t)dy_e2[n]*width+dx_e2[n];
+
+    #pragma omp simd
+    for(int x=1;x<width-1;x++){
+      const double e0 = mid[x];
+      const double e1 = r1[x];
+      const double e2 = r2[x];
+
+      const double s1 = e0-e1;
+      const double s2 = e1-e2;
+
+      //atan2(s2,s1) is negative exactly when s2 is. It exceeds pi/4 when s2>s1
+      //or when the vector lies in the second quadrant
+      double s;
+      if(s2<0)
+        s = s1;
+      else if( (s1>0)?(s2>s1):(s1<0 || s2>0) )
+        s = (e0-e2)/diag;
+      else
+        s = sqrt(s1*s1+s2*s2);
+
+      if(s>smax[x]){
+        smax[x] = s;
+        nmax[x] = n;
+        ws1[x]  = s1;
+        ws2[x]  = s2;
+      }
+    }
+  }
+
+  for(int x=1;x<width-1;x++){
+    const int n = nmax[x];
+    if(n==-1){
+      row_fds[x] = NO_FLOW;
+      continue;
+    }
+
+    double r;
+    if(mode==DINF_ANGLE_EXACT){
+      r = atan2(ws2[x],ws1[x]);
+      if(r<0)
+        r = 0;
+      else if(r>atan2(1.0,1.0))
+        r = atan2(1.0,1.0);
+    } else {
+      if(ws2[x]<0)
+        r = 0;
+      else if(ws1[x]<=0 || ws2[x]>ws1[x])
+        r = M_PI/4;
+      else
+        r = dinf_atan_approx(ws2[x]/ws1[x]);
+    }
+
+    row_fds[x] = af[n]*r+ac[n]*M_PI/2;
+  }
+
+  row_fds[0]       = elevations.isNoData(0,      y)?dinf_NO_DATA:dinf_FlowDir(elevations,0,      y);
+  row_fds[width-1] = elevations.isNoData(width-1,y)?dinf_NO_DATA:dinf_FlowDir(elevations,width-1,y);
+
+  const T no_data = elevations.noData();
+  for(int x=1;x<width-1;x++)
+    if(mid[x]==no_data)
+      row_fds[x] = dinf_NO_DATA;
+}
+
+
 /**
   @brief  Determine the D-infinite flow direction of every cell in a grid
   @author Richard Barnes (rbarnes@umn.edu)
 
-    This function runs dinf_FlowDir() on every cell in a grid which has a data
-    value.
+    This function runs dinf_FlowDirRow() on every row of a grid, in parallel.
 
   @param[in]  &elevations  A 2D grid of elevation data
   @param[out] &flowdirs    A 2D grid which will contain the flow directions
+  @param[in]  mode         How facet angles are calculated. See DinfAngleMode.
 */
 template <class T>
-void dinf_flow_directions(const Array2D<T> &elevations, Array2D<float> &flowdirs){
+void dinf_flow_directions(const Array2D<T> &elevations, Array2D<float> &flowdirs, DinfAngleMode mode=DINF_ANGLE_EXACT){
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("dinf_flow_directions");
   std::cerr<<"\nA Dinf Flow Directions"<<std::endl;
   std::cerr<<"C Tarboton, D.G. 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water Resources Research. Vol. 33. pp 309-319."<<std::endl;
 
@@ -136,14 +291,21 @@ void dinf_flow_directions(const Array2D<T> &elevations, Array2D<float> &flowdirs
 
   std::cerr<<"p Calculating Dinf flow directions..."<<std::endl;
   progress.start( elevations.size() );
-  #pragma omp parallel for
-  for(int y=0;y<elevations.height();y++){
-    progress.update( y*elevations.width() );
-    for(int x=0;x<elevations.width();x++)
-      if(elevations(x,y)==elevations.noData())
-        flowdirs(x,y) = flowdirs.noData();
-      else
-        flowdirs(x,y) = dinf_FlowDir(elevations,x,y);
+  #pragma omp parallel
+  {
+    std::vector<double> smax(elevations.width());
+    std::vector<int8_t> nmax(elevations.width());
+    std::vector<double> ws1 (elevations.width());
+    std::vector<double> ws2 (elevations.width());
+    std::vector<float>  row_fds(elevations.width());
+
+    #pragma omp for
+    for(int y=0;y<elevations.height();y++){
+      progress.update( y*elevations.width() );
+      dinf_FlowDirRow(elevations, y, row_fds.data(), mode, smax.data(), nmax.data(), ws1.data(), ws2.data());
+      for(int x=0;x<elevations.width();x++)
+        flowdirs(x,y) = row_fds[x];
+    }
   }
   std::cerr<<"t Succeeded in = "<<progress.stop()<<" s"<<std::endl;
 }
@@ -9,10 +9,13 @@
 #define _richdem_d8_methods_hpp_
 
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/constants.hpp"
 #include "richdem/common/grid_cell.hpp"
 #include "richdem/common/ProgressBar.hpp"
 #include <queue>
+#include <stdexcept>
+#include <vector>
 
 /**
   @brief  Returns the sign (+1, -1, 0) of a number. Branchless.
@@ -39,19 +42,26 @@ static T sgn(T val){
 
   This calculates the D8 flow accumulation of a grid of D8 flow directions by
   calculating each cell's dependency on its neighbours and then using a
-  priority-queue to process cells in a top-of-the-watershed-down fashion
+  priority-queue to process cells in a top-of-the-watershed-down fashion.
+
+  Each cell adds `weightf(x,y)` to the flow it receives and passes
+  `passf(x,y,flow)` of its total flow on to its downslope neighbour.
 
   @param[in]  &flowdirs  A D8 flowdir grid from d8_flow_directions()
-  @param[out] &area      Returns the up-slope area of each cell
+  @param[out] &area      Returns the accumulated flow of each cell
+  @param[in]  weightf    Flow originating in each cell
+  @param[in]  passf      Flow a cell passes on, given its total flow
 */
-template<class T, class U>
-void d8_flow_accum(const Array2D<T> &flowdirs, Array2D<U> &area){
+template<class T, class U, class WeightF, class PassF>
+static void d8_flow_accum_generic(
+  const Array2D<T> &flowdirs,
+  Array2D<U>       &area,
+  WeightF           weightf,
+  PassF             passf
+){
   std::queue<GridCell> sources;
   ProgressBar progress;
 
-  std::cerr<<"\nA D8 Flow Accumulation"<<std::endl;
-  std::cerr<<"C TODO"<<std::endl;
-
   std::cerr<<"The sources queue will require at most approximately "
            <<(flowdirs.size()*((long)sizeof(GridCell))/1024/1024)
            <<"MB of RAM."<<std::endl;
@@ -108,7 +118,7 @@ void d8_flow_accum(const Array2D<T> &flowdirs, Array2D<U> &area){
     ccount++;
     progress.update(ccount);
 
-    area(c.x,c.y)++;
+    area(c.x,c.y) += weightf(c.x,c.y);
 
     int n = flowdirs(c.x,c.y);
 
@@ -123,7 +133,7 @@ void d8_flow_accum(const Array2D<T> &flowdirs, Array2D<U> &area){
     if(flowdirs.isNoData(nx,ny))
       continue;
 
-    area(nx,ny)+=area(c.x,c.y);
+    area(nx,ny) += passf(c.x,c.y,area(c.x,c.y));
     --dependency(nx,ny);
 
     if(dependency(nx,ny)==0)
@@ -141,6 +151,288 @@ void d8_flow_accum(const Array2D<T> &flowdirs, Array2D<U> &area){
 
 
 
+
+
+
+
+/**
+  @brief  Calculates the D8 flow accumulation, given the D8 flow directions
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  This calculates the D8 flow accumulation of a grid of D8 flow directions by
+  calculating each cell's dependency on its neighbours and then using a
+  priority-queue to process cells in a top-of-the-watershed-down fashion
+
+  @param[in]  &flowdirs  A D8 flowdir grid from d8_flow_directions()
+  @param[out] &area      Returns the up-slope area of each cell
+*/
+template<class T, class U>
+void d8_flow_accum(const Array2D<T> &flowdirs, Array2D<U> &area){
+  ScopedTimer scoped_timer("d8_flow_accum");
+  std::cerr<<"\nA D8 Flow Accumulation"<<std::endl;
+  std::cerr<<"C TODO"<<std::endl;
+
+  d8_flow_accum_generic(
+    flowdirs, area,
+    [](const int x, const int y){ return 1; },
+    [](const int x, const int y, const U flow){ return flow; }
+  );
+}
+
+
+
+/**
+  @brief  Calculates the weighted D8 flow accumulation, given the D8 flow
+          directions
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Each cell contributes its weight, rather than 1, to its own accumulation and
+  to that of every cell downslope of it. The weights are read in place as the
+  cells are processed.
+
+  @param[in]  &flowdirs  A D8 flowdir grid from d8_flow_directions()
+  @param[in]  &weights   Flow originating in each cell. NoData weights
+                         contribute nothing.
+  @param[out] &area      Returns the accumulated weight of each cell
+*/
+template<class T, class W, class U>
+void d8_flow_accum(const Array2D<T> &flowdirs, const Array2D<W> &weights, Array2D<U> &area){
+  ScopedTimer scoped_timer("d8_flow_accum_weighted");
+  std::cerr<<"\nA D8 Weighted Flow Accumulation"<<std::endl;
+  std::cerr<<"C TODO"<<std::endl;
+
+  if(weights.width()!=flowdirs.width() || weights.height()!=flowdirs.height()){
+    std::cerr<<"E Weights and flow directions must have the same dimensions!"<<std::endl;
+    throw std::runtime_error("Weights and flow directions must have the same dimensions!");
+  }
+
+  d8_flow_accum_generic(
+    flowdirs, area,
+    [&](const int x, const int y) -> U { return weights.isNoData(x,y)?0:weights(x,y); },
+    [](const int x, const int y, const U flow){ return flow; }
+  );
+}
+
+
+
+/**
+  @brief  Calculates the weighted D8 flow accumulation with losses, given the
+          D8 flow directions
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Each cell contributes its weight to its own accumulation. It then retains a
+  fraction of its total flow (for instance, to infiltration or uptake) and
+  passes the rest on to its downslope neighbour. The weights and retentions
+  are read in place as the cells are processed.
+
+  @param[in]  &flowdirs   A D8 flowdir grid from d8_flow_directions()
+  @param[in]  &weights    Flow originating in each cell. NoData weights
+                          contribute nothing.
+  @param[in]  &retention  Fraction [0,1] of each cell's total flow which is not
+                          passed on. NoData cells retain nothing.
+  @param[out] &area       Returns the accumulated flow of each cell, before
+                          its retention is removed
+*/
+template<class T, class W, class R, class U>
+void d8_flow_accum(
+  const Array2D<T> &flowdirs,
+  const Array2D<W> &weights,
+  const Array2D<R> &retention,
+  Array2D<U>       &area
+){
+  ScopedTimer scoped_timer("d8_flow_accum_retention");
+  std::cerr<<"\nA D8 Weighted Flow Accumulation with Retention"<<std::endl;
+  std::cerr<<"C TODO"<<std::endl;
+
+  if(weights.width()!=flowdirs.width()   || weights.height()!=flowdirs.height()
+  || retention.width()!=flowdirs.width() || retention.height()!=flowdirs.height()){
+    std::cerr<<"E Weights, retentions, and flow directions must have the same dimensions!"<<std::endl;
+    throw std::runtime_error("Weights, retentions, and flow directions must have the same dimensions!");
+  }
+
+  d8_flow_accum_generic(
+    flowdirs, area,
+    [&](const int x, const int y) -> U { return weights.isNoData(x,y)?0:weights(x,y); },
+    [&](const int x, const int y, const U flow) -> U {
+      if(retention.isNoData(x,y))
+        return flow;
+      return flow*(1-retention(x,y));
+    }
+  );
+}
+
+
+
+
+/**
+  @brief  Calculates a topological ordering of the cells of a D8 flowdir grid
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Each cell appears in the ordering after every cell which flows into it.
+  Cells are visited in raster order. Whenever a cell with no unvisited upslope
+  neighbours is found, its downslope path is followed for as long as each cell
+  on the path has had all of its upslope neighbours visited. Successive cells
+  of the ordering are therefore usually neighbours, and the ordering as a
+  whole sweeps down the grid, so processing cells in this order touches memory
+  far more locally than the FIFO queue of d8_flow_accum() does.
+
+  Cells which are part of, or downslope of, a loop in the flow directions do
+  not appear in the ordering.
+
+  Following a path downslope relies on each cell having a single receiver, so
+  this is only used for D8. dinf_upslope_area() and the kernels run by
+  KernelFlowdir() split each cell's flow between several receivers; for those
+  methods, FlowProportions stores a topological order whose wavefronts are
+  sorted into raster order.
+
+  @param[in]  &flowdirs  A D8 flowdir grid from d8_flow_directions()
+  @param[out] &order     The data cells of `flowdirs` in topological order
+*/
+template<class T>
+void d8_topological_order(
+  const Array2D<T>                         &flowdirs,
+  std::vector<typename Array2D<T>::i_t>    &order
+){
+  typedef typename Array2D<T>::i_t i_t;
+
+  ProgressBar progress;
+
+  //Returns the index of the cell `i` flows into, or NO_I
+  const auto receiver = [&](const i_t i) -> i_t {
+    const int n = flowdirs(i);
+    if(n==NO_FLOW)
+      return Array2D<T>::NO_I;
+    int x,y;
+    flowdirs.iToxy(i,x,y);
+    const int nx = x+dx[n];
+    const int ny = y+dy[n];
+    if(!flowdirs.inGrid(nx,ny) || flowdirs.isNoData(nx,ny))
+      return Array2D<T>::NO_I;
+    return flowdirs.xyToI(nx,ny);
+  };
+
+  std::cerr<<"p Calculating dependency matrix..."<<std::endl;
+  progress.start( flowdirs.size() );
+  Array2D<int8_t> dependency(flowdirs,0);
+  #pragma omp parallel for
+  for(int y=0;y<flowdirs.height();y++){
+    progress.update( y*flowdirs.width() );
+    for(int x=0;x<flowdirs.width();x++)
+    for(int n=1;n<=8;n++){
+      const int nx = x+dx[n];
+      const int ny = y+dy[n];
+      if(flowdirs.inGrid(nx,ny) && !flowdirs.isNoData(nx,ny) && flowdirs(nx,ny)==d8_inverse[n])
+        dependency(x,y)++;
+    }
+  }
+  std::cerr<<"t Dependency calculation time = "<<progress.stop()<<" s"<<std::endl;
+
+  std::cerr<<"p Calculating topological order..."<<std::endl;
+  order.clear();
+  order.reserve(flowdirs.numDataCells());
+  progress.start( flowdirs.size() );
+  for(i_t i=0;i<flowdirs.size();i++){
+    progress.update(i);
+    if(flowdirs.isNoData(i) || dependency(i)!=0)
+      continue;
+
+    //Follow the path downslope until it reaches a cell which is still waiting
+    //on another of its upslope neighbours
+    for(i_t c=i;c!=Array2D<T>::NO_I;){
+      order.push_back(c);
+      dependency(c) = -1; //Mark as visited
+      c = receiver(c);
+      if(c!=Array2D<T>::NO_I && --dependency(c)!=0)
+        break;
+    }
+  }
+  std::cerr<<"t Topological order calculation time = "<<progress.stop()<<" s"<<std::endl;
+
+  std::cerr<<"m Cells not ordered due to loops = "<<(flowdirs.numDataCells()-order.size())<<std::endl;
+}
+
+
+
+/**
+  @brief  Calculates the D8 flow accumulation by visiting cells in a
+          topological order, such as that from d8_topological_order()
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Each cell adds 1 to its own accumulation and then passes its total on to the
+  cell it flows into. Since the order can be reused, this is the cheapest way
+  to calculate many accumulations from one set of flow directions.
+
+  @param[in]  &flowdirs  A D8 flowdir grid from d8_flow_directions()
+  @param[in]  &order     Topological order of the cells of `flowdirs`
+  @param[out] &area      Returns the up-slope area of each cell
+*/
+template<class T, class U>
+void d8_flow_accum_ordered(
+  const Array2D<T>                            &flowdirs,
+  const std::vector<typename Array2D<T>::i_t> &order,
+  Array2D<U>                                  &area
+){
+  Timer timer;
+  timer.start();
+
+  std::cerr<<"p Setting up the area matrix..."<<std::endl;
+  area.resize(flowdirs,0);
+  area.setNoData(-1);
+  #pragma omp parallel for
+  for(int y=0;y<flowdirs.height();y++)
+  for(int x=0;x<flowdirs.width();x++)
+    if(flowdirs.isNoData(x,y))
+      area(x,y) = area.noData();
+
+  std::cerr<<"p Calculating flow accumulation areas..."<<std::endl;
+  for(const auto i: order){
+    area(i)++;
+
+    const int n = flowdirs(i);
+    if(n==NO_FLOW)
+      continue;
+
+    int x,y;
+    flowdirs.iToxy(i,x,y);
+    const int nx = x+dx[n];
+    const int ny = y+dy[n];
+    if(!flowdirs.inGrid(nx,ny) || flowdirs.isNoData(nx,ny))
+      continue;
+
+    area(nx,ny) += area(i);
+  }
+  std::cerr<<"t Flow accumulation calculation time = "<<timer.stop()<<" s"<<std::endl;
+}
+
+
+
+/**
+  @brief  Calculates the D8 flow accumulation, given the D8 flow directions,
+          using a cache-friendly topological order
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  This gives the same result as d8_flow_accum(), but visits the cells in the
+  order produced by d8_topological_order(), which follows flow paths in a
+  sweep down the grid rather than jumping between them. The order uses
+  sizeof(i_t) extra bytes per cell.
+
+  @param[in]  &flowdirs  A D8 flowdir grid from d8_flow_directions()
+  @param[out] &area      Returns the up-slope area of each cell
+*/
+template<class T, class U>
+void d8_flow_accum_topological(const Array2D<T> &flowdirs, Array2D<U> &area){
+  ScopedTimer scoped_timer("d8_flow_accum_topological");
+  std::cerr<<"\nA D8 Flow Accumulation (Topological Order)"<<std::endl;
+  std::cerr<<"C TODO"<<std::endl;
+
+  std::vector<typename Array2D<T>::i_t> order;
+  d8_topological_order(flowdirs,order);
+  d8_flow_accum_ordered(flowdirs,order,area);
+}
+
+
+
+
 //d8_upslope_cells
 /**
   @brief  Calculates which cells ultimately D8-flow through a given cell
@@ -590,6 +882,7 @@ void d8_slope_riserun(
   Array2D<float>   &slopes,
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_slope_riserun");
   std::cerr<<"\nA Slope calculation (rise/run)"<<std::endl;
   std::cerr<<"C Horn, B.K.P., 1981. Hill shading and the reflectance map. Proceedings of the IEEE 69, 14–47. doi:10.1109/PROC.1981.11918"<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -612,6 +905,7 @@ void d8_slope_percentage(
   Array2D<float>   &slopes,
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_slope_percentage");
   std::cerr<<"\nA Slope calculation (percenage)"<<std::endl;
   std::cerr<<"C Horn, B.K.P., 1981. Hill shading and the reflectance map. Proceedings of the IEEE 69, 14–47. doi:10.1109/PROC.1981.11918"<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -634,6 +928,7 @@ void d8_slope_degrees(
   Array2D<float>   &slopes,
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_slope_degrees");
   std::cerr<<"\nA Slope calculation (degrees)"<<std::endl;
   std::cerr<<"C Horn, B.K.P., 1981. Hill shading and the reflectance map. Proceedings of the IEEE 69, 14–47. doi:10.1109/PROC.1981.11918"<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -656,6 +951,7 @@ void d8_slope_radians(
   Array2D<float>   &slopes,
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_slope_radians");
   std::cerr<<"\nA Slope calculation (radians)"<<std::endl;
   std::cerr<<"C Horn, B.K.P., 1981. Hill shading and the reflectance map. Proceedings of the IEEE 69, 14–47. doi:10.1109/PROC.1981.11918"<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -678,6 +974,7 @@ void d8_aspect(
   Array2D<float>   &aspects,
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_aspect");
   std::cerr<<"\nA Aspect attribute calculation"<<std::endl;
   std::cerr<<"C Horn, B.K.P., 1981. Hill shading and the reflectance map. Proceedings of the IEEE 69, 14–47. doi:10.1109/PROC.1981.11918"<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -700,6 +997,7 @@ void d8_curvature(
   Array2D<float>   &curvatures, 
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_curvature");
   std::cerr<<"\nA Curvature attribute calculation"<<std::endl;
   std::cerr<<"C Zevenbergen, L.W., Thorne, C.R., 1987. Quantitative analysis of land surface topography. Earth surface processes and landforms 12, 47–56."<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -723,6 +1021,7 @@ void d8_planform_curvature(
   Array2D<float>   &planform_curvatures,
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_planform_curvature");
   std::cerr<<"\nA Planform curvature attribute calculation"<<std::endl;
   std::cerr<<"C Zevenbergen, L.W., Thorne, C.R., 1987. Quantitative analysis of land surface topography. Earth surface processes and landforms 12, 47–56."<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -745,6 +1044,7 @@ void d8_profile_curvature(
   Array2D<float>   &profile_curvatures,
   float zscale = 1.0f
 ){
+  ScopedTimer scoped_timer("d8_profile_curvature");
   std::cerr<<"\nA Profile curvature attribute calculation"<<std::endl;
   std::cerr<<"C Zevenbergen, L.W., Thorne, C.R., 1987. Quantitative analysis of land surface topography. Earth surface processes and landforms 12, 47–56."<<std::endl;
   TerrainAttributator<T> ta(zscale);
@@ -8,17 +8,29 @@
 #define _richdem_dall_flowdirs_hpp_
 
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/ProgressBar.hpp"
 #include "richdem/common/grid_cell.hpp"
 #include "richdem/common/random.hpp"
 
 #include <iomanip> //TODO: Cut
+#include <array>
+#include <queue>
+#include <vector>
 
 enum FDMode {
   CALC_DEPENDENCIES,
   CALC_ACCUM
 };
 
+///Which engine the FA_* and Strahler_* functions accumulate with. The parallel
+///engine, KernelFlowdirParallel(), needs 8*sizeof(A)+1 more bytes per cell
+///than the serial engine, KernelFlowdir(): 65 bytes per cell for doubles.
+enum AccumEngine {
+  ACCUM_SERIAL,
+  ACCUM_PARALLEL
+};
+
 typedef struct {
   double x;
 } Params;
@@ -809,6 +821,70 @@ static void DistanceDispersionEstimate(
 
 
 
+/**
+  @brief  Counts the number of cells each cell must wait on before it can pass
+          its flow onwards
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  A cell depends on each of its neighbours which is higher than it. Each cell
+  counts its own dependencies, rather than incrementing the counts of its
+  lower neighbours, so rows can be processed in parallel without atomics.
+
+  @param[in]  elevations  A DEM
+  @param[out] dep         Number of dependencies of each cell. Zero for NoData
+                          cells.
+*/
+template<class E>
+static void KernelDependencies(const Array2D<E> &elevations, dep_t &dep){
+  #pragma omp parallel for
+  for(int y=0;y<elevations.height();y++)
+  for(int x=0;x<elevations.width();x++){
+    dep(x,y) = 0;
+    if(elevations.isNoData(x,y))
+      continue;
+    for(int n=1;n<=8;n++){
+      const int nx = x+dx[n];
+      const int ny = y+dy[n];
+      if(!elevations.inGrid(nx,ny))
+        continue;
+      if(elevations(x,y)<elevations(nx,ny))
+        dep(x,y)++;
+    }
+  }
+}
+
+
+
+/**
+  @brief  Accumulation function used by KernelFlowdirParallel(). Rather than
+          passing flow to a neighbour, it records the flow in the passing
+          cell's outflow slots so it can be merged in a fixed order later.
+*/
+template<class A>
+class CollectOutflow {
+ public:
+  std::vector<A>       *outflow;  ///< 8 slots per cell, one per direction
+  std::vector<uint8_t> *outflags; ///< Bit n-1 is set if flow went in direction n
+
+  void operator()(
+    const int             x,
+    const int             y,
+    const int             n,
+    dep_t                &dep,
+    Array2D<A>           &accum,
+    std::queue<GridCell> &q,
+    A                     flow
+  ) const {
+    assert(1<=n);
+    assert(n<=8);
+    const uint64_t i = accum.xyToI(x,y);
+    (*outflow)[8*i+n-1] += flow;
+    (*outflags)[i]      |= 1<<(n-1);
+  }
+};
+
+
+
 template<class KernelF, class AccumF, class E, class A, typename... Args>
 static void KernelFlowdir(
   KernelF           kernelf,
@@ -838,20 +914,7 @@ static void KernelFlowdir(
 
   std::cerr<<"p Calculating dependencies..."<<std::endl;
   progress.start(elevations.size());
-  //#pragma omp parallel for collapse(2)
-  for(int y=0;y<elevations.height();y++)
-  for(int x=0;x<elevations.width();x++){
-    for(int n=1;n<=8;n++){
-      const int nx = x+dx[n];
-      const int ny = y+dy[n];
-      if(!elevations.inGrid(nx,ny))
-        continue;
-      if(elevations.isNoData(nx,ny))
-        continue;
-      if(elevations(nx,ny)<elevations(x,y))
-        dep(nx,ny)++;
-    }
-  }
+  KernelDependencies(elevations,dep);
   progress.stop();
 
   for(int y=0;y<dep.height();y++)
@@ -899,15 +962,203 @@ static void KernelFlowdir(
 
   std::cerr<<"m Data cells      = "<<elevations.numDataCells()<<std::endl;
   std::cerr<<"m Cells processed = "<<progress.cellsProcessed()<<std::endl;
+  std::cerr<<"m Cells per second = "<<progress.cellsPerSecond()<<std::endl;
+  std::cerr<<"m Max accum       = "<<accum.max()              <<std::endl;
+  std::cerr<<"m Min accum       = "<<accum.min()              <<std::endl;
+  std::cerr<<"t Wall-time       = "<<overall.stop()<<" s"     <<std::endl;
+}
+
+/**
+  @brief  Parallel version of KernelFlowdir()
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Cells are processed in topological wavefronts. The first wavefront holds the
+  cells with no higher neighbours. Each later wavefront holds the cells whose
+  last higher neighbour was in the wavefront before it. The cells of a
+  wavefront do not depend on each other, so they are processed in parallel.
+
+  Kernels must be instantiated with CollectOutflow<A> as their accumulation
+  function. The flow each cell passes on is stored in its own outflow slots,
+  so no two threads ever write to the same cell. Before a cell is processed,
+  the flow from its higher neighbours is merged with `accumf` in the fixed
+  order n=1..8. The result therefore does not depend on the number of
+  threads, or on the order in which a wavefront is processed.
+
+  Flow passed to a neighbour which is not lower than the passing cell is
+  discarded. Kernels which modify their neighbours other than through
+  `accumf` (such as KernelOrlandini()) must use KernelFlowdir() instead, as
+  must kernels which draw random numbers (such as KernelFairfieldLeymarie()),
+  whose results would otherwise depend on the number of threads.
+
+  This uses 8*sizeof(A)+1 more bytes per cell than KernelFlowdir().
+
+  @param[in]     kernelf     Kernel instantiated with CollectOutflow<A>
+  @param[in]     accumf      Function used to merge flow into a cell
+  @param[in]     elevations  A DEM
+  @param[out]    accum       Accumulated flow
+  @param[in,out] args        Additional arguments passed to the kernel
+*/
+template<class KernelF, class AccumF, class E, class A, typename... Args>
+static void KernelFlowdirParallel(
+  KernelF           kernelf,
+  AccumF            accumf,
+  const Array2D<E> &elevations,
+  Array2D<A>       &accum,
+  Args&&... args
+){
+  typedef typename Array2D<E>::i_t i_t;
+
+  ProgressBar progress;
+  dep_t dep;
+
+  Timer overall;
+  overall.start();
+
+  accum.setAll(0);
+  accum.setNoData(ACCUM_NO_DATA);
+  for(i_t i=0;i<elevations.size();i++)
+    if(elevations.isNoData(i))
+      accum(i) = ACCUM_NO_DATA;
+
+  dep.resize(elevations);
+
+  std::cerr<<"p Calculating dependencies..."<<std::endl;
+  progress.start(elevations.size());
+  KernelDependencies(elevations,dep);
+  progress.stop();
+
+  std::vector<A>       outflow (8*(uint64_t)elevations.size(), 0);
+  std::vector<uint8_t> outflags(elevations.size(),             0);
+
+  CollectOutflow<A> collect;
+  collect.outflow  = &outflow;
+  collect.outflags = &outflags;
+
+  std::vector<i_t> wavefront;
+  std::vector<i_t> next_wavefront;
+  for(i_t i=0;i<elevations.size();i++)
+    if(dep(i)==0 && !elevations.isNoData(i))
+      wavefront.push_back(i);
+
+  std::cerr<<"p Calculating accumulation..."<<std::endl;
+  progress.start(accum.numDataCells());
+  uint64_t cells_processed = 0;
+  int32_t  wavefronts      = 0;
+  while(!wavefront.empty()){
+    progress.update(cells_processed);
+
+    #pragma omp parallel
+    {
+      std::queue<GridCell> q; //Kernels expect this, but it is not used here
+      std::vector<i_t>     my_next;
+
+      #pragma omp for schedule(static)
+      for(uint64_t wi=0;wi<wavefront.size();wi++){
+        int x,y;
+        elevations.iToxy(wavefront[wi],x,y);
+
+        //Merge flow from higher neighbours in a fixed order
+        for(int n=1;n<=8;n++){
+          const int nx = x+dx[n];
+          const int ny = y+dy[n];
+          if(!elevations.inGrid(nx,ny))
+            continue;
+          if(!(elevations(x,y)<elevations(nx,ny)))
+            continue;
+          const uint64_t ni   = elevations.xyToI(nx,ny);
+          const int      from = d8_inverse[n];
+          if(outflags[ni] & (1<<(from-1)))
+            accumf(nx,ny,from,dep,accum,q,outflow[8*ni+from-1]);
+        }
+
+        accum(x,y) += 1;
+        kernelf(FDMode::CALC_ACCUM,collect,elevations,accum,dep,q,x,y,std::forward<Args>(args)...);
+
+        assert(accum(x,y)<1e10);
+      }
+
+      //The implicit barrier above guarantees all of the wavefront's outflow
+      //has been recorded before its lower neighbours are released
+      #pragma omp for schedule(static)
+      for(uint64_t wi=0;wi<wavefront.size();wi++){
+        int x,y;
+        elevations.iToxy(wavefront[wi],x,y);
+        for(int n=1;n<=8;n++){
+          const int nx = x+dx[n];
+          const int ny = y+dy[n];
+          if(!elevations.inGrid(nx,ny))
+            continue;
+          if(elevations.isNoData(nx,ny))
+            continue;
+          if(!(elevations(nx,ny)<elevations(x,y)))
+            continue;
+          int8_t remaining;
+          auto &ndep = dep(nx,ny);
+          #pragma omp atomic capture
+          remaining = --ndep;
+          if(remaining==0)
+            my_next.push_back(elevations.xyToI(nx,ny));
+        }
+      }
+
+      #pragma omp critical
+      next_wavefront.insert(next_wavefront.end(),my_next.begin(),my_next.end());
+    }
+
+    cells_processed += wavefront.size();
+    wavefronts++;
+    wavefront.swap(next_wavefront);
+    next_wavefront.clear();
+  }
+  progress.stop();
+
+  std::cerr<<"m Data cells      = "<<elevations.numDataCells()<<std::endl;
+  std::cerr<<"m Cells processed = "<<cells_processed          <<std::endl;
+  std::cerr<<"m Wavefronts      = "<<wavefronts               <<std::endl;
   std::cerr<<"m Max accum       = "<<accum.max()              <<std::endl;
   std::cerr<<"m Min accum       = "<<accum.min()              <<std::endl;
   std::cerr<<"t Wall-time       = "<<overall.stop()<<" s"     <<std::endl;
 }
 
+/**
+  @brief  Runs a kernel on the chosen accumulation engine
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Kernels must be instantiated with a different accumulation function for each
+  engine, so both instantiations are passed.
+
+  @param[in]     engine      Engine to use
+  @param[in]     skernelf    Kernel instantiated for KernelFlowdir()
+  @param[in]     pkernelf    Kernel instantiated with CollectOutflow<A> for
+                             KernelFlowdirParallel()
+  @param[in]     accumf      Function used to merge flow into a cell
+  @param[in]     elevations  A DEM
+  @param[out]    accum       Accumulated flow
+  @param[in,out] args        Additional arguments passed to the kernel
+*/
+template<class SKernelF, class PKernelF, class AccumF, class E, class A, typename... Args>
+static void KernelFlowdirEngine(
+  const AccumEngine engine,
+  SKernelF          skernelf,
+  PKernelF          pkernelf,
+  AccumF            accumf,
+  const Array2D<E> &elevations,
+  Array2D<A>       &accum,
+  Args&&... args
+){
+  if(engine==ACCUM_PARALLEL)
+    KernelFlowdirParallel(pkernelf,accumf,elevations,accum,std::forward<Args>(args)...);
+  else
+    KernelFlowdir(skernelf,accumf,elevations,accum,std::forward<Args>(args)...);
+}
+
 template<class E, class A>
 void FA_FairfieldLeymarie(const Array2D<E> &elevations, Array2D<A> &accum){
+  ScopedTimer scoped_timer("FA_FairfieldLeymarie");
   std::cerr<<"\nA Fairfield (1991) \"Rho8\" Flow Accumulation"<<std::endl;
   std::cerr<<"C Fairfield, J., Leymarie, P., 1991. Drainage networks from grid digital elevation models. Water resources research 27, 709–717."<<std::endl;
+  //The kernel draws random numbers, so it runs on the serial engine to give
+  //the same result whatever the number of threads
   Array2D<d8_flowdir_t> fd(elevations);
   KernelFlowdir(KernelFairfieldLeymarie<decltype(PassAccumulation<A>),E,A>,PassAccumulation<A>,elevations,accum,fd);
 }
@@ -919,46 +1170,52 @@ void FA_Rho8(const Array2D<E> &elevations, Array2D<A> &accum){
 }
 
 template<class E, class A>
-void FA_Quinn(const Array2D<E> &elevations, Array2D<A> &accum){
+void FA_Quinn(const Array2D<E> &elevations, Array2D<A> &accum, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("FA_Quinn");
   std::cerr<<"\nA Quinn (1991) Flow Accumulation (aka MFD, MD8)"<<std::endl;
   std::cerr<<"C Quinn, P., Beven, K., Chevallier, P., Planchon, O., 1991. The Prediction Of Hillslope Flow Paths For Distributed Hydrological Modelling Using Digital Terrain Models. Hydrological Processes 5, 59–79."<<std::endl; 
-  KernelFlowdir(KernelHolmgren<decltype(PassAccumulation<A>),E,A>,PassAccumulation<A>,elevations,accum,(double)1.0);
+  KernelFlowdirEngine(engine,KernelHolmgren<decltype(PassAccumulation<A>),E,A>,KernelHolmgren<CollectOutflow<A>,E,A>,PassAccumulation<A>,elevations,accum,(double)1.0);
 }
 
 template<class E, class A>
-void FA_Holmgren(const Array2D<E> &elevations, Array2D<A> &accum, double x){
+void FA_Holmgren(const Array2D<E> &elevations, Array2D<A> &accum, double x, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("FA_Holmgren");
   std::cerr<<"\nA Holmgren (1994) Flow Accumulation (aka MFD, MD8)"<<std::endl;
   std::cerr<<"C Holmgren, P., 1994. Multiple flow direction algorithms for runoff modelling in grid based elevation models: an empirical evaluation. Hydrological processes 8, 327–334."<<std::endl;
   std::cerr<<"c x = "<<x<<std::endl;
-  KernelFlowdir(KernelHolmgren<decltype(PassAccumulation<A>),E,A>,PassAccumulation<A>,elevations,accum,x);
+  KernelFlowdirEngine(engine,KernelHolmgren<decltype(PassAccumulation<A>),E,A>,KernelHolmgren<CollectOutflow<A>,E,A>,PassAccumulation<A>,elevations,accum,x);
 }
 
 template<class E, class A>
-void FA_Freeman(const Array2D<E> &elevations, Array2D<A> &accum, double p){
+void FA_Freeman(const Array2D<E> &elevations, Array2D<A> &accum, double p, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("FA_Freeman");
   std::cerr<<"\nA Freeman (1991) Flow Accumulation (aka MFD, MD8)"<<std::endl;
   std::cerr<<"C Freeman, T.G., 1991. Calculating catchment area with divergent flow based on a regular grid. Computers & Geosciences 17, 413–422."<<std::endl;
   std::cerr<<"c p = "<<p<<std::endl;
-  KernelFlowdir(KernelFreeman<decltype(PassAccumulation<A>),E,A>,PassAccumulation<A>,elevations,accum,p);
+  KernelFlowdirEngine(engine,KernelFreeman<decltype(PassAccumulation<A>),E,A>,KernelFreeman<CollectOutflow<A>,E,A>,PassAccumulation<A>,elevations,accum,p);
 }
 
 template<class E, class A>
-void FA_Tarboton(const Array2D<E> &elevations, Array2D<A> &accum){
+void FA_Tarboton(const Array2D<E> &elevations, Array2D<A> &accum, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("FA_Tarboton");
   std::cerr<<"\nA Tarboton (1997) Flow Accumulation (aka D-Infinity, D∞)"<<std::endl;
   std::cerr<<"C Tarboton, D.G., 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water resources research 33, 309–319."<<std::endl;
   Array2D< std::pair<float,int8_t> > fd(elevations);
-  KernelFlowdir(KernelTarboton<decltype(PassAccumulation<A>),E,A>,PassAccumulation<A>,elevations,accum,fd);
+  KernelFlowdirEngine(engine,KernelTarboton<decltype(PassAccumulation<A>),E,A>,KernelTarboton<CollectOutflow<A>,E,A>,PassAccumulation<A>,elevations,accum,fd);
 }
 
 template<class E, class A>
-void FA_SeibertMcGlynn(const Array2D<E> &elevations, Array2D<A> &accum, double x){
+void FA_SeibertMcGlynn(const Array2D<E> &elevations, Array2D<A> &accum, double x, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("FA_SeibertMcGlynn");
   std::cerr<<"\nA Seibert and McGlynn (2007) Flow Accumulation (aka MD-Infinity, MD∞)"<<std::endl;
   std::cerr<<"W TODO: This flow accumulation method is not yet functional."<<std::endl;
   std::cerr<<"c x = "<<x<<std::endl;
-  KernelFlowdir(KernelSeibertMcGlynn<decltype(PassAccumulation<A>),E,A>,PassAccumulation<A>,elevations,accum,x);
+  KernelFlowdirEngine(engine,KernelSeibertMcGlynn<decltype(PassAccumulation<A>),E,A>,KernelSeibertMcGlynn<CollectOutflow<A>,E,A>,PassAccumulation<A>,elevations,accum,x);
 }
 
 template<class E, class A>
 void FA_Orlandini(const Array2D<E> &elevations, Array2D<A> &accum, OrlandiniMode mode, double lambda){
+  ScopedTimer scoped_timer("FA_Orlandini");
   std::cerr<<"\nA Orlandini et al. (2003) Flow Accumulation (aka D8-LTD, D8-LAD)"<<std::endl;
   std::cerr<<"C Orlandini, S., Moretti, G., Franchini, M., Aldighieri, B., Testa, B., 2003. Path-based methods for the determination of nondispersive drainage directions in grid-based digital elevation models: TECHNICAL NOTE. Water Resources Research 39(6). doi:10.1029/2002WR001639."<<std::endl;
   std::cerr<<"c lambda = "<<lambda<<std::endl;
@@ -967,15 +1224,16 @@ void FA_Orlandini(const Array2D<E> &elevations, Array2D<A> &accum, OrlandiniMode
 }
 
 template<class E, class A>
-void FA_OCallaghan(const Array2D<E> &elevations, Array2D<A> &accum){
+void FA_OCallaghan(const Array2D<E> &elevations, Array2D<A> &accum, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("FA_OCallaghan");
   std::cerr<<"\nA O'Callaghan (1984)/Marks (1984) Flow Accumulation (aka D8)"<<std::endl;
   std::cerr<<"C O'Callaghan, J.F., Mark, D.M., 1984. The Extraction of Drainage Networks from Digital Elevation Data. Computer vision, graphics, and image processing 28, 323--344."<<std::endl;
-  KernelFlowdir(KernelOCallaghan<decltype(PassAccumulation<A>),E,A>,PassAccumulation<A>,elevations,accum);
+  KernelFlowdirEngine(engine,KernelOCallaghan<decltype(PassAccumulation<A>),E,A>,KernelOCallaghan<CollectOutflow<A>,E,A>,PassAccumulation<A>,elevations,accum);
 }
 
 template<class E, class A>
-void FA_D8(const Array2D<E> &elevations, Array2D<A> &accum){
-  FA_OCallaghan(elevations,accum);
+void FA_D8(const Array2D<E> &elevations, Array2D<A> &accum, const AccumEngine engine=ACCUM_SERIAL){
+  FA_OCallaghan(elevations,accum,engine);
 }
 
 
@@ -993,8 +1251,11 @@ static inline void CleanseStrahler(Array2D<A> &accum){
 
 template<class E, class A>
 void Strahler_FairfieldLeymarie(const Array2D<E> &elevations, Array2D<A> &accum){
+  ScopedTimer scoped_timer("Strahler_FairfieldLeymarie");
   std::cerr<<"\nA Fairfield (1991) \"Rho8\" Strahler"<<std::endl;
   std::cerr<<"C Fairfield, J., Leymarie, P., 1991. Drainage networks from grid digital elevation models. Water resources research 27, 709–717."<<std::endl;
+  //The kernel draws random numbers, so it runs on the serial engine to give
+  //the same result whatever the number of threads
   Array2D<d8_flowdir_t> fd(elevations);
   KernelFlowdir(KernelFairfieldLeymarie<decltype(StrahlerNumber<A>),E,A>,StrahlerNumber<A>,elevations,accum,fd);
   CleanseStrahler(accum);
@@ -1007,35 +1268,39 @@ void Strahler_Rho8(const Array2D<E> &elevations, Array2D<A> &accum){
 }
 
 template<class E, class A>
-void Strahler_Quinn(const Array2D<E> &elevations, Array2D<A> &accum){
+void Strahler_Quinn(const Array2D<E> &elevations, Array2D<A> &accum, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("Strahler_Quinn");
   std::cerr<<"\nA Quinn (1991) Strahler"<<std::endl;
   std::cerr<<"C Quinn, P., Beven, K., Chevallier, P., Planchon, O., 1991. The Prediction Of Hillslope Flow Paths For Distributed Hydrological Modelling Using Digital Terrain Models. Hydrological Processes 5, 59–79."<<std::endl; 
-  KernelFlowdir(KernelHolmgren<decltype(StrahlerNumber<A>),E,A>,StrahlerNumber<A>,elevations,accum,(double)1.0);
+  KernelFlowdirEngine(engine,KernelHolmgren<decltype(StrahlerNumber<A>),E,A>,KernelHolmgren<CollectOutflow<A>,E,A>,StrahlerNumber<A>,elevations,accum,(double)1.0);
   CleanseStrahler(accum);
 }
 
 template<class E, class A>
-void Strahler_Holmgren(const Array2D<E> &elevations, Array2D<A> &accum, double x){
+void Strahler_Holmgren(const Array2D<E> &elevations, Array2D<A> &accum, double x, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("Strahler_Holmgren");
   std::cerr<<"\nA Holmgren (1994) Strahler"<<std::endl;
   std::cerr<<"C Holmgren, P., 1994. Multiple flow direction algorithms for runoff modelling in grid based elevation models: an empirical evaluation. Hydrological processes 8, 327–334."<<std::endl;
-  KernelFlowdir(KernelHolmgren<decltype(StrahlerNumber<A>),E,A>,StrahlerNumber<A>,elevations,accum,x);
+  KernelFlowdirEngine(engine,KernelHolmgren<decltype(StrahlerNumber<A>),E,A>,KernelHolmgren<CollectOutflow<A>,E,A>,StrahlerNumber<A>,elevations,accum,x);
   CleanseStrahler(accum);
 }
 
 template<class E, class A>
-void Strahler_Tarboton(const Array2D<E> &elevations, Array2D<A> &accum){
+void Strahler_Tarboton(const Array2D<E> &elevations, Array2D<A> &accum, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("Strahler_Tarboton");
   std::cerr<<"\nA Tarboton (1997) \"D-Infinity\" Strahler"<<std::endl;
   std::cerr<<"C Tarboton, D.G., 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water resources research 33, 309–319."<<std::endl;
   Array2D< std::pair<float,int8_t> > fd(elevations);
-  KernelFlowdir(KernelTarboton<decltype(StrahlerNumber<A>),E,A>,StrahlerNumber<A>,elevations,accum,fd);
+  KernelFlowdirEngine(engine,KernelTarboton<decltype(StrahlerNumber<A>),E,A>,KernelTarboton<CollectOutflow<A>,E,A>,StrahlerNumber<A>,elevations,accum,fd);
   CleanseStrahler(accum);
 }
 
 template<class E, class A>
-void Strahler_SeibertMcGlynn(const Array2D<E> &elevations, Array2D<A> &accum, double xparam){
+void Strahler_SeibertMcGlynn(const Array2D<E> &elevations, Array2D<A> &accum, double xparam, const AccumEngine engine=ACCUM_SERIAL){
+  ScopedTimer scoped_timer("Strahler_SeibertMcGlynn");
   std::cerr<<"\nA Seibert and McGlynn Strahler (TODO)"<<std::endl;
   std::cerr<<"W TODO: This flow accumulation method is not yet functional."<<std::endl;
-  KernelFlowdir(KernelSeibertMcGlynn<decltype(StrahlerNumber<A>),E,A>,StrahlerNumber<A>,elevations,accum,xparam);
+  KernelFlowdirEngine(engine,KernelSeibertMcGlynn<decltype(StrahlerNumber<A>),E,A>,KernelSeibertMcGlynn<CollectOutflow<A>,E,A>,StrahlerNumber<A>,elevations,accum,xparam);
   CleanseStrahler(accum);
 }
 
@@ -12,10 +12,13 @@
 
 #include <cmath>
 #include <queue>
+#include <stdexcept>
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/constants.hpp"
 #include "richdem/common/ProgressBar.hpp"
 #include "richdem/common/grid_cell.hpp"
+#include "richdem/flowdirs/dinf_flowdirs.hpp"
 
 //TODO: Can these be merged with the regular D8 directions?
 //X- and Y-offests of D-inf neighbours (TODO: More explanation, and why there are 9)
@@ -105,23 +108,26 @@ bool is_loop(const float_2d &flowdirs, int n, int x, int y, int c2x, int c2y){
   @brief  Calculate each cell's D-infinity flow accumulation value
   @author Tarboton (1997), Richard Barnes (rbarnes@umn.edu)
 
-    TODO
+  Each cell adds `weightf(x,y)` to the flow it receives and passes
+  `passf(x,y,flow)` of its total flow on to its downslope neighbours, split
+  between them according to its D-infinite flow direction.
 
   @param[in]  flowdirs   A grid of D-infinite flow directions
   @param[out] &area      A grid of flow accumulation values
+  @param[in]  weightf    Flow originating in each cell
+  @param[in]  passf      Flow a cell passes on, given its total flow
 */
-template <class T, class U>
-void dinf_upslope_area(
+template <class T, class U, class WeightF, class PassF>
+static void dinf_upslope_area_generic(
   const Array2D<T> &flowdirs,
-  Array2D<U> &area
+  Array2D<U>       &area,
+  WeightF           weightf,
+  PassF             passf
 ){
   Array2D<int8_t> dependency;
   std::queue<GridCell> sources;
   ProgressBar progress;
 
-  std::cerr<<"\nA D-infinity Upslope Area"<<std::endl;
-  std::cerr<<"C Tarboton, D.G. 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water Resources Research. Vol. 33. pp 309-319."<<std::endl;
-
   std::cerr<<"p Setting up the dependency matrix..."<<std::endl;
   dependency.resize(flowdirs);
   dependency.setAll(0);
@@ -216,11 +222,13 @@ void dinf_upslope_area(
     if(flowdirs.isNoData(c.x,c.y))  //TODO: This line shouldn't be necessary since NoData's do not get added below
       continue;
 
-    area(c.x,c.y)+=1;
+    area(c.x,c.y) += weightf(c.x,c.y);
 
     if(flowdirs(c.x,c.y)==NO_FLOW)
       continue;
 
+    const U passed = passf(c.x,c.y,area(c.x,c.y));
+
     int n_high,n_low,nhx,nhy,nlx,nly;
     where_do_i_flow(flowdirs(c.x,c.y),n_high,n_low);
     nhx = c.x+dinf_dx[n_high];
@@ -229,13 +237,13 @@ void dinf_upslope_area(
     float phigh,plow;
     area_proportion(flowdirs(c.x,c.y), n_high, n_low, phigh, plow);
     if(flowdirs.inGrid(nhx,nhy) && flowdirs(nhx,nhy)!=flowdirs.noData())
-      area(nhx,nhy)+=area(c.x,c.y)*phigh;
+      area(nhx,nhy)+=passed*phigh;
 
     if(n_low!=-1){
       nlx = c.x+dinf_dx[n_low];
       nly = c.y+dinf_dy[n_low];
       if(flowdirs.inGrid(nlx,nly) && flowdirs(nlx,nly)!=flowdirs.noData()){
-        area(nlx,nly)+=area(c.x,c.y)*plow;
+        area(nlx,nly)+=passed*plow;
         if((--dependency(nlx,nly))==0)
           sources.emplace(nlx,nly);
       }
@@ -247,4 +255,117 @@ void dinf_upslope_area(
   std::cerr<<"p Succeeded in = "<<progress.stop()<<" s"<<std::endl;
 }
 
+
+
+
+/**
+  @brief  Calculate each cell's D-infinity flow accumulation value
+  @author Tarboton (1997), Richard Barnes (rbarnes@umn.edu)
+
+    TODO
+
+  @param[in]  flowdirs   A grid of D-infinite flow directions
+  @param[out] &area      A grid of flow accumulation values
+*/
+template <class T, class U>
+void dinf_upslope_area(
+  const Array2D<T> &flowdirs,
+  Array2D<U> &area
+){
+  ScopedTimer scoped_timer("dinf_upslope_area");
+  std::cerr<<"\nA D-infinity Upslope Area"<<std::endl;
+  std::cerr<<"C Tarboton, D.G. 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water Resources Research. Vol. 33. pp 309-319."<<std::endl;
+
+  dinf_upslope_area_generic(
+    flowdirs, area,
+    [](const int x, const int y){ return 1; },
+    [](const int x, const int y, const U flow){ return flow; }
+  );
+}
+
+
+
+/**
+  @brief  Calculate each cell's weighted D-infinity flow accumulation value
+  @author Tarboton (1997), Richard Barnes (rbarnes@umn.edu)
+
+  Each cell contributes its weight, rather than 1, to its own accumulation and
+  to those of the cells downslope of it. The weights are read in place as the
+  cells are processed.
+
+  @param[in]  flowdirs   A grid of D-infinite flow directions
+  @param[in]  weights    Flow originating in each cell. NoData weights
+                         contribute nothing.
+  @param[out] &area      A grid of accumulated weights
+*/
+template <class T, class W, class U>
+void dinf_upslope_area(
+  const Array2D<T> &flowdirs,
+  const Array2D<W> &weights,
+  Array2D<U>       &area
+){
+  ScopedTimer scoped_timer("dinf_upslope_area_weighted");
+  std::cerr<<"\nA D-infinity Weighted Upslope Area"<<std::endl;
+  std::cerr<<"C Tarboton, D.G. 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water Resources Research. Vol. 33. pp 309-319."<<std::endl;
+
+  if(weights.width()!=flowdirs.width() || weights.height()!=flowdirs.height()){
+    std::cerr<<"E Weights and flow directions must have the same dimensions!"<<std::endl;
+    throw std::runtime_error("Weights and flow directions must have the same dimensions!");
+  }
+
+  dinf_upslope_area_generic(
+    flowdirs, area,
+    [&](const int x, const int y) -> U { return weights.isNoData(x,y)?0:weights(x,y); },
+    [](const int x, const int y, const U flow){ return flow; }
+  );
+}
+
+
+
+/**
+  @brief  Calculate each cell's weighted D-infinity flow accumulation value,
+          with losses
+  @author Tarboton (1997), Richard Barnes (rbarnes@umn.edu)
+
+  Each cell contributes its weight to its own accumulation. It then retains a
+  fraction of its total flow (for instance, to infiltration or uptake) and
+  passes the rest on to its downslope neighbours. The weights and retentions
+  are read in place as the cells are processed.
+
+  @param[in]  flowdirs   A grid of D-infinite flow directions
+  @param[in]  weights    Flow originating in each cell. NoData weights
+                         contribute nothing.
+  @param[in]  retention  Fraction [0,1] of each cell's total flow which is not
+                         passed on. NoData cells retain nothing.
+  @param[out] &area      A grid of accumulated flow, before each cell's
+                         retention is removed
+*/
+template <class T, class W, class R, class U>
+void dinf_upslope_area(
+  const Array2D<T> &flowdirs,
+  const Array2D<W> &weights,
+  const Array2D<R> &retention,
+  Array2D<U>       &area
+){
+  ScopedTimer scoped_timer("dinf_upslope_area_retention");
+  std::cerr<<"\nA D-infinity Weighted Upslope Area with Retention"<<std::endl;
+  std::cerr<<"C Tarboton, D.G. 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water Resources Research. Vol. 33. pp 309-319."<<std::endl;
+
+  if(weights.width()!=flowdirs.width()   || weights.height()!=flowdirs.height()
+  || retention.width()!=flowdirs.width() || retention.height()!=flowdirs.height()){
+    std::cerr<<"E Weights, retentions, and flow directions must have the same dimensions!"<<std::endl;
+    throw std::runtime_error("Weights, retentions, and flow directions must have the same dimensions!");
+  }
+
+  dinf_upslope_area_generic(
+    flowdirs, area,
+    [&](const int x, const int y) -> U { return weights.isNoData(x,y)?0:weights(x,y); },
+    [&](const int x, const int y, const U flow) -> U {
+      if(retention.isNoData(x,y))
+        return flow;
+      return flow*(1-retention(x,y));
+    }
+  );
+}
+
 #endif
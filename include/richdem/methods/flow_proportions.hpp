@@ -0,0 +1,555 @@
+/**
+  @file
+  @brief Precomputed flow proportions for repeated weighted flow accumulation
+
+  The FA_* functions of dall_methods.hpp recalculate each cell's partitioning
+  of flow every time they are run. When the same DEM is used with many
+  different weightings (rainfall scenarios, loadings, etc.) it is faster to
+  calculate the partitioning once, store it, and then accumulate each weighting
+  against the stored partitioning.
+
+  Richard Barnes (rbarnes@umn.edu), 2017
+*/
+#ifndef _richdem_flow_proportions_hpp_
+#define _richdem_flow_proportions_hpp_
+
+#include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
+#include "richdem/common/ProgressBar.hpp"
+#include "richdem/common/timer.hpp"
+#include "richdem/methods/dall_methods.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iostream>
+#include <queue>
+#include <stdexcept>
+#include <vector>
+
+/**
+  @brief  Stores the fraction of each cell's flow which is passed to each of
+          its neighbours, along with a topological ordering of the cells.
+  @author Richard Barnes (rbarnes@umn.edu)
+
+  Flow is stored in "pull" form: for each cell the list of neighbours which
+  pass flow into it (its donors) and the fraction of each donor's flow which
+  it receives. Cells are stored in topological wavefronts: each cell's donors
+  all belong to earlier wavefronts, so the cells of a wavefront can be
+  accumulated in parallel. Since each cell sums its donors in a fixed order,
+  the result does not depend on the number of threads used.
+
+  Memory use is sizeof(i_t)+8 bytes per data cell (`order` and `donor_start`),
+  plus sizeof(i_t)+sizeof(prop_t) bytes for each donor link (`donor_i` and
+  `donor_p`), plus 8 bytes per wavefront, plus one bit per cell. D8 methods
+  have at most one link per cell.
+
+  Use one of the FP_* functions to build the proportions and then call
+  accumulate() as many times as needed.
+*/
+class FlowProportions {
+ public:
+  typedef Array2D<float>::i_t i_t;
+  typedef float               prop_t;   ///< Storage type for flow fractions
+
+ private:
+  int32_t               width  = 0;
+  int32_t               height = 0;
+  std::vector<i_t>      order;          ///< Data cells in topological order
+  std::vector<uint64_t> level_start;    ///< Index in `order` at which each wavefront starts
+  std::vector<uint64_t> donor_start;    ///< Index in `donor_i` of the first donor of order[k]
+  std::vector<i_t>      donor_i;        ///< Donor cells
+  std::vector<prop_t>   donor_p;        ///< Fraction of the donor's flow received
+  std::vector<bool>     is_data;        ///< True for cells which are not NoData
+
+ public:
+  ///Width of the DEM the proportions were built from
+  int32_t getWidth()    const { return width;  }
+  ///Height of the DEM the proportions were built from
+  int32_t getHeight()   const { return height; }
+  ///Number of data cells
+  uint64_t numCells()   const { return order.size(); }
+  ///Number of topological wavefronts
+  uint64_t numLevels()  const { return level_start.empty()?0:level_start.size()-1; }
+  ///Number of donor-receiver links
+  uint64_t numLinks()   const { return donor_i.size(); }
+
+  /**
+    @brief  Calculates the flow proportions of a DEM using one of the kernels
+            of dall_methods.hpp
+
+    Each kernel is run once per cell with an accumulation of 1 and its output
+    is recorded by CollectOutflow. As in KernelFlowdirParallel(), flow passed
+    to a neighbour which is not lower than the passing cell is discarded.
+
+    The kernels are run in parallel, so kernels which draw random numbers
+    (such as KernelFairfieldLeymarie()) must use buildSerial() instead.
+
+    @param[in]     kernelf     Kernel instantiated with CollectOutflow<double>
+    @param[in]     elevations  A DEM
+    @param[in,out] args        Additional arguments passed to the kernel
+  */
+  template<class KernelF, class E, typename... Args>
+  void build(KernelF kernelf, const Array2D<E> &elevations, Args&&... args){
+    ScopedTimer scoped_timer("FlowProportions::build");
+    buildKernel(true,kernelf,elevations,std::forward<Args>(args)...);
+  }
+
+  /**
+    @brief  As build(), but runs the kernels on a single thread
+
+    The random number generator is not safe to share between threads, so this
+    is used for kernels which draw random numbers. It also means the
+    proportions of such kernels are reproducible for a given seed.
+
+    @param[in]     kernelf     Kernel instantiated with CollectOutflow<double>
+    @param[in]     elevations  A DEM
+    @param[in,out] args        Additional arguments passed to the kernel
+  */
+  template<class KernelF, class E, typename... Args>
+  void buildSerial(KernelF kernelf, const Array2D<E> &elevations, Args&&... args){
+    ScopedTimer scoped_timer("FlowProportions::buildSerial");
+    buildKernel(false,kernelf,elevations,std::forward<Args>(args)...);
+  }
+
+  /**
+    @brief  Calculates the flow proportions of a raster of D8 flow directions,
+            such as that produced by d8_flow_directions(). Each cell passes
+            all of its flow to the neighbour it points to.
+
+    @param[in]  flowdirs   A grid of D8 flow directions
+  */
+  template<class T>
+  void buildD8(const Array2D<T> &flowdirs){
+    ScopedTimer scoped_timer("FlowProportions::buildD8");
+    Timer overall;
+    overall.start();
+
+    width  = flowdirs.width();
+    height = flowdirs.height();
+
+    std::vector<uint8_t> outflags(flowdirs.size(), 0);
+
+    #pragma omp parallel for
+    for(int y=0;y<height;y++)
+    for(int x=0;x<width;x++){
+      if(flowdirs.isNoData(x,y))
+        continue;
+      const int n = flowdirs(x,y);
+      if(n==NO_FLOW)
+        continue;
+      const int nx = x+dx[n];
+      const int ny = y+dy[n];
+      if(!flowdirs.inGrid(nx,ny) || flowdirs.isNoData(nx,ny))
+        continue;
+      outflags[flowdirs.xyToI(x,y)] = 1<<(n-1);
+    }
+
+    buildTopology(flowdirs,outflags,[](const i_t, const int){ return 1; });
+
+    std::cerr<<"t Wall-time       = "<<overall.stop()<<" s"<<std::endl;
+  }
+
+  /**
+    @brief  Accumulates per-cell weights along the stored flow proportions
+
+    Each cell's accumulation is its own weight plus the given fraction of the
+    accumulation of each of its donors. With a weight of 1 everywhere this
+    gives the same result as the corresponding FA_* function.
+
+    @param[in]  weights  Input weight of each cell. NoData weights contribute
+                         nothing.
+    @param[out] accum    Accumulated weights. NoData where the DEM is NoData.
+  */
+  template<class W, class A>
+  void accumulate(const Array2D<W> &weights, Array2D<A> &accum) const {
+    if(weights.width()!=width || weights.height()!=height){
+      std::cerr<<"E Weights are "<<weights.width()<<"x"<<weights.height()<<" but the flow proportions are "<<width<<"x"<<height<<"!"<<std::endl;
+      throw std::runtime_error("Weights and flow proportions have different dimensions!");
+    }
+
+    accumulateImpl(
+      [&](const i_t i) -> A { return weights.isNoData(i)?0:(A)weights(i); },
+      accum
+    );
+  }
+
+  /**
+    @brief  Accumulates a weight of 1 per cell along the stored flow
+            proportions. This gives the same result as the FA_* functions.
+
+    @param[out] accum    Accumulated flow. NoData where the DEM is NoData.
+  */
+  template<class A>
+  void accumulate(Array2D<A> &accum) const {
+    accumulateImpl([](const i_t) -> A { return 1; }, accum);
+  }
+
+  /**
+    @brief  Accumulates several weightings in a single traversal
+
+    The accumulations of all of the weightings of a cell are stored next to
+    each other, so passing flow from a donor is a single vectorized loop over
+    the weightings. K weightings therefore cost little more than a single
+    traversal. Each weighting gives exactly the same result as it would if
+    accumulated on its own, since both pass flow with passFlow().
+
+    This uses K*sizeof(A) extra bytes per cell.
+
+    @param[in]  weights  One weight raster per weighting. NoData weights
+                         contribute nothing.
+    @param[out] accums   One raster of accumulated weights per weighting. NoData
+                         where the DEM is NoData.
+  */
+  template<class W, class A>
+  void accumulate(const std::vector< Array2D<W> > &weights, std::vector< Array2D<A> > &accums) const {
+    const uint64_t K = weights.size();
+
+    for(const auto &w: weights)
+      if(w.width()!=width || w.height()!=height){
+        std::cerr<<"E Weights are "<<w.width()<<"x"<<w.height()<<" but the flow proportions are "<<width<<"x"<<height<<"!"<<std::endl;
+        throw std::runtime_error("Weights and flow proportions have different dimensions!");
+      }
+
+    ScopedTimer scoped_timer("FlowProportions::accumulate_batched");
+    Timer overall;
+    overall.start();
+
+    std::cerr<<"p Accumulating "<<K<<" weightings..."<<std::endl;
+
+    const i_t size = (i_t)width*(i_t)height;
+
+    //Cells which are NoData in the DEM are NoData in every weighting. The
+    //weights are read here, in raster order, so that the traversal below only
+    //touches `acc`.
+    std::vector<A> acc(K*size);
+    #pragma omp parallel for
+    for(i_t i=0;i<size;i++)
+    for(uint64_t c=0;c<K;c++){
+      const auto &w = weights[c].getDataVec();
+      if(!is_data[i])
+        acc[K*i+c] = ACCUM_NO_DATA;
+      else if(w[i]==weights[c].noData())
+        acc[K*i+c] = 0;
+      else
+        acc[K*i+c] = w[i];
+    }
+
+    passFlow(acc.data(),K);
+
+    accums.resize(K);
+    for(uint64_t c=0;c<K;c++){
+      accums[c].resize(width,height);
+      accums[c].setNoData(ACCUM_NO_DATA);
+      A *const out = accums[c].getData();
+      #pragma omp parallel for
+      for(i_t i=0;i<size;i++)
+        out[i] = acc[K*i+c];
+    }
+
+    std::cerr<<"t Wall-time       = "<<overall.stop()<<" s"<<std::endl;
+  }
+
+ private:
+  ///Runs a kernel over every data cell, recording its outflow, and then
+  ///builds the topology. The kernels are only run in parallel if `parallel`.
+  template<class KernelF, class E, typename... Args>
+  void buildKernel(const bool parallel, KernelF kernelf, const Array2D<E> &elevations, Args&&... args){
+    ProgressBar progress;
+    Timer overall;
+    overall.start();
+
+    width  = elevations.width();
+    height = elevations.height();
+
+    const uint64_t size = elevations.size();
+
+    std::vector<double>  outflow (8*size, 0);
+    std::vector<uint8_t> outflags(size,   0);
+
+    CollectOutflow<double> collect;
+    collect.outflow  = &outflow;
+    collect.outflags = &outflags;
+
+    std::cerr<<"p Calculating flow proportions..."<<std::endl;
+    progress.start(size);
+    {
+      Array2D<double> unit(elevations,1);
+      dep_t           dep;                //Kernels expect this, but it is not used here
+
+      #pragma omp parallel if(parallel)
+      {
+        std::queue<GridCell> q;           //Kernels expect this, but it is not used here
+
+        #pragma omp for schedule(static)
+        for(int y=0;y<height;y++){
+          progress.update(y*(uint64_t)width);
+          for(int x=0;x<width;x++){
+            if(elevations.isNoData(x,y))
+              continue;
+            kernelf(FDMode::CALC_ACCUM,collect,elevations,unit,dep,q,x,y,std::forward<Args>(args)...);
+
+            //Discard flow which does not go downhill into the DEM
+            auto &flags = outflags[elevations.xyToI(x,y)];
+            for(int n=1;n<=8;n++){
+              const int nx = x+dx[n];
+              const int ny = y+dy[n];
+              if(!(flags & (1<<(n-1))))
+                continue;
+              if(!elevations.inGrid(nx,ny) || elevations.isNoData(nx,ny) || !(elevations(nx,ny)<elevations(x,y)))
+                flags &= ~(1<<(n-1));
+            }
+          }
+        }
+      }
+    }
+    std::cerr<<"t Flow proportions calculated in = "<<progress.stop()<<" s"<<std::endl;
+
+    buildTopology(elevations,outflags,[&](const i_t ni, const int n){
+      return outflow[8*(uint64_t)ni+n-1];
+    });
+
+    std::cerr<<"t Wall-time       = "<<overall.stop()<<" s"<<std::endl;
+  }
+
+  /**
+    @brief  Builds the topological order and donor lists from the directions
+            in which each cell passes flow
+
+    @param[in]  grid      Raster whose NoData cells are excluded
+    @param[in]  outflags  Bit n-1 is set if a cell passes flow in direction n
+    @param[in]  propf     propf(i,n) gives the fraction of cell i's flow
+                          passed in direction n
+  */
+  template<class T, class PropF>
+  void buildTopology(const Array2D<T> &grid, const std::vector<uint8_t> &outflags, PropF propf){
+    ProgressBar progress;
+    const uint64_t size = grid.size();
+
+    //Number of donors of each cell. A neighbour is a donor if it passes flow
+    //in our direction.
+    const auto IsDonor = [&](const int x, const int y, const int n) -> bool {
+      const int nx = x+dx[n];
+      const int ny = y+dy[n];
+      if(!grid.inGrid(nx,ny))
+        return false;
+      return outflags[grid.xyToI(nx,ny)] & (1<<(d8_inverse[n]-1));
+    };
+
+    std::cerr<<"p Calculating topological order..."<<std::endl;
+    progress.start(size);
+
+    dep_t dep(grid,0);
+    #pragma omp parallel for
+    for(int y=0;y<height;y++)
+    for(int x=0;x<width;x++){
+      if(grid.isNoData(x,y))
+        continue;
+      for(int n=1;n<=8;n++)
+        if(IsDonor(x,y,n))
+          dep(x,y)++;
+    }
+
+    order.clear();
+    order.reserve(grid.numDataCells());
+    level_start.clear();
+
+    for(i_t i=0;i<size;i++)
+      if(dep(i)==0 && !grid.isNoData(i))
+        order.push_back(i);
+
+    //Each wavefront is the set of cells whose last donor was in the previous
+    //wavefront. Each is sorted into raster order so that accumulation sweeps
+    //through memory rather than jumping around it.
+    uint64_t wstart = 0;
+    while(wstart<order.size()){
+      level_start.push_back(wstart);
+      const uint64_t wend = order.size();
+      std::sort(order.begin()+wstart,order.end());
+      progress.update(wend);
+      for(uint64_t k=wstart;k<wend;k++){
+        const i_t   i     = order[k];
+        const auto  flags = outflags[i];
+        int x,y;
+        grid.iToxy(i,x,y);
+        for(int n=1;n<=8;n++)
+          if((flags & (1<<(n-1))) && --dep(x+dx[n],y+dy[n])==0)
+            order.push_back(grid.xyToI(x+dx[n],y+dy[n]));
+      }
+      wstart = wend;
+    }
+    level_start.push_back(order.size());
+    std::cerr<<"t Topological order calculated in = "<<progress.stop()<<" s"<<std::endl;
+
+    if(order.size()!=grid.numDataCells()){
+      std::cerr<<"E Flow proportions contain a loop: only "<<order.size()<<" of "<<grid.numDataCells()<<" cells could be ordered!"<<std::endl;
+      throw std::runtime_error("Flow proportions contain a loop!");
+    }
+
+    //Build the donor lists in topological order
+    donor_start.assign(order.size()+1, 0);
+    #pragma omp parallel for
+    for(uint64_t k=0;k<order.size();k++){
+      int x,y;
+      grid.iToxy(order[k],x,y);
+      for(int n=1;n<=8;n++)
+        if(IsDonor(x,y,n))
+          donor_start[k+1]++;
+    }
+    for(uint64_t k=0;k<order.size();k++)
+      donor_start[k+1] += donor_start[k];
+
+    donor_i.resize(donor_start.back());
+    donor_p.resize(donor_start.back());
+    #pragma omp parallel for
+    for(uint64_t k=0;k<order.size();k++){
+      int x,y;
+      grid.iToxy(order[k],x,y);
+      uint64_t d = donor_start[k];
+      for(int n=1;n<=8;n++){
+        if(!IsDonor(x,y,n))
+          continue;
+        const i_t ni = grid.xyToI(x+dx[n],y+dy[n]);
+        donor_i[d] = ni;
+        donor_p[d] = propf(ni,d8_inverse[n]);
+        d++;
+      }
+    }
+
+    is_data.assign(size,false);
+    for(const auto i: order)
+      is_data[i] = true;
+
+    std::cerr<<"m Data cells      = "<<order.size()   <<std::endl;
+    std::cerr<<"m Wavefronts      = "<<numLevels()    <<std::endl;
+    std::cerr<<"m Donor links     = "<<donor_i.size() <<std::endl;
+  }
+
+  template<class WeightF, class A>
+  void accumulateImpl(WeightF weightf, Array2D<A> &accum) const {
+    ScopedTimer scoped_timer("FlowProportions::accumulate");
+    Timer overall;
+    overall.start();
+
+    accum.resize(width,height);
+    accum.setNoData(ACCUM_NO_DATA);
+    accum.setAll(ACCUM_NO_DATA);
+
+    std::cerr<<"p Accumulating weights..."<<std::endl;
+
+    A *const acc = accum.getData();
+    #pragma omp parallel for
+    for(uint64_t k=0;k<order.size();k++)
+      acc[order[k]] = weightf(order[k]);
+
+    passFlow(acc,1);
+
+    std::cerr<<"t Wall-time       = "<<overall.stop()<<" s"<<std::endl;
+  }
+
+  ///Passes flow down the wavefronts. `acc` holds K weightings per cell, next
+  ///to each other, each starting at the cell's own weight. Single and batched
+  ///accumulation both use this, so that they round in the same way even where
+  ///the compiler fuses multiplies and adds.
+  template<class A>
+  void passFlow(A *const acc, const uint64_t K) const {
+    #pragma omp parallel
+    for(uint64_t l=0;l<numLevels();l++){
+      //The implicit barrier at the end of each loop guarantees that all of a
+      //wavefront's donors are finished before it begins
+      #pragma omp for schedule(static)
+      for(uint64_t k=level_start[l];k<level_start[l+1];k++){
+        A *const dst = &acc[K*order[k]];
+        for(uint64_t d=donor_start[k];d<donor_start[k+1];d++){
+          const A *const src = &acc[K*donor_i[d]];
+          const A        p   = donor_p[d];
+          #pragma omp simd
+          for(uint64_t c=0;c<K;c++)
+            dst[c] += src[c]*p;
+        }
+      }
+    }
+  }
+};
+
+
+
+template<class E>
+void FP_FairfieldLeymarie(const Array2D<E> &elevations, FlowProportions &props){
+  ScopedTimer scoped_timer("FP_FairfieldLeymarie");
+  std::cerr<<"\nA Fairfield (1991) \"Rho8\" Flow Proportions"<<std::endl;
+  std::cerr<<"C Fairfield, J., Leymarie, P., 1991. Drainage networks from grid digital elevation models. Water resources research 27, 709–717."<<std::endl;
+  Array2D<d8_flowdir_t> fd(elevations);
+  //Rho8 draws random numbers, which must not be done from several threads
+  props.buildSerial(KernelFairfieldLeymarie<CollectOutflow<double>,E,double>,elevations,fd);
+}
+
+template<class E>
+void FP_Rho8(const Array2D<E> &elevations, FlowProportions &props){
+  //Algorithm headers are taken care of in FP_FairfieldLeymarie()
+  FP_FairfieldLeymarie(elevations,props);
+}
+
+template<class E>
+void FP_Quinn(const Array2D<E> &elevations, FlowProportions &props){
+  ScopedTimer scoped_timer("FP_Quinn");
+  std::cerr<<"\nA Quinn (1991) Flow Proportions (aka MFD, MD8)"<<std::endl;
+  std::cerr<<"C Quinn, P., Beven, K., Chevallier, P., Planchon, O., 1991. The Prediction Of Hillslope Flow Paths For Distributed Hydrological Modelling Using Digital Terrain Models. Hydrological Processes 5, 59–79."<<std::endl;
+  props.build(KernelHolmgren<CollectOutflow<double>,E,double>,elevations,(double)1.0);
+}
+
+template<class E>
+void FP_Holmgren(const Array2D<E> &elevations, FlowProportions &props, double x){
+  ScopedTimer scoped_timer("FP_Holmgren");
+  std::cerr<<"\nA Holmgren (1994) Flow Proportions (aka MFD, MD8)"<<std::endl;
+  std::cerr<<"C Holmgren, P., 1994. Multiple flow direction algorithms for runoff modelling in grid based elevation models: an empirical evaluation. Hydrological processes 8, 327–334."<<std::endl;
+  std::cerr<<"c x = "<<x<<std::endl;
+  props.build(KernelHolmgren<CollectOutflow<double>,E,double>,elevations,x);
+}
+
+template<class E>
+void FP_Freeman(const Array2D<E> &elevations, FlowProportions &props, double p){
+  ScopedTimer scoped_timer("FP_Freeman");
+  std::cerr<<"\nA Freeman (1991) Flow Proportions (aka MFD, MD8)"<<std::endl;
+  std::cerr<<"C Freeman, T.G., 1991. Calculating catchment area with divergent flow based on a regular grid. Computers & Geosciences 17, 413–422."<<std::endl;
+  std::cerr<<"c p = "<<p<<std::endl;
+  props.build(KernelFreeman<CollectOutflow<double>,E,double>,elevations,p);
+}
+
+template<class E>
+void FP_Tarboton(const Array2D<E> &elevations, FlowProportions &props){
+  ScopedTimer scoped_timer("FP_Tarboton");
+  std::cerr<<"\nA Tarboton (1997) Flow Proportions (aka D-Infinity, D∞)"<<std::endl;
+  std::cerr<<"C Tarboton, D.G., 1997. A new method for the determination of flow directions and upslope areas in grid digital elevation models. Water resources research 33, 309–319."<<std::endl;
+  Array2D< std::pair<float,int8_t> > fd(elevations);
+  props.build(KernelTarboton<CollectOutflow<double>,E,double>,elevations,fd);
+}
+
+template<class E>
+void FP_SeibertMcGlynn(const Array2D<E> &elevations, FlowProportions &props, double x){
+  ScopedTimer scoped_timer("FP_SeibertMcGlynn");
+  std::cerr<<"\nA Seibert and McGlynn (2007) Flow Proportions (aka MD-Infinity, MD∞)"<<std::endl;
+  std::cerr<<"W TODO: This flow accumulation method is not yet functional."<<std::endl;
+  std::cerr<<"c x = "<<x<<std::endl;
+  props.build(KernelSeibertMcGlynn<CollectOutflow<double>,E,double>,elevations,x);
+}
+
+template<class E>
+void FP_OCallaghan(const Array2D<E> &elevations, FlowProportions &props){
+  ScopedTimer scoped_timer("FP_OCallaghan");
+  std::cerr<<"\nA O'Callaghan (1984)/Marks (1984) Flow Proportions (aka D8)"<<std::endl;
+  std::cerr<<"C O'Callaghan, J.F., Mark, D.M., 1984. The Extraction of Drainage Networks from Digital Elevation Data. Computer vision, graphics, and image processing 28, 323--344."<<std::endl;
+  props.build(KernelOCallaghan<CollectOutflow<double>,E,double>,elevations);
+}
+
+template<class E>
+void FP_D8(const Array2D<E> &elevations, FlowProportions &props){
+  FP_OCallaghan(elevations,props);
+}
+
+template<class T>
+void FP_D8Flowdirs(const Array2D<T> &flowdirs, FlowProportions &props){
+  ScopedTimer scoped_timer("FP_D8Flowdirs");
+  std::cerr<<"\nA D8 Flow Proportions from Flow Directions"<<std::endl;
+  props.buildD8(flowdirs);
+}
+
+#endif
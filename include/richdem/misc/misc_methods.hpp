@@ -15,6 +15,7 @@
 #include <stdexcept>
 #include <cassert>
 #include "richdem/common/Array2D.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/constants.hpp"
 #include "richdem/common/ProgressBar.hpp"
 
@@ -40,6 +41,7 @@ double dem_surface_area(
 ){
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("dem_surface_area");
   std::cerr<<"\nA DEM Surface Elevation"<<std::endl;
   std::cerr<<"C Jenness, J.S., 2004. Calculating landscape surface area from digital elevation models. Wildlife Society Bulletin 32, 829--839. doi:10.2193/0091-7648(2004)032[0829:CLSAFD]2.0.CO;2"<<std::endl;
 
@@ -201,6 +203,7 @@ double Perimeter(
 ){
   ProgressBar progress;
 
+  ScopedTimer scoped_timer("Perimeter");
   std::cerr<<"\nA DEM Perimeter"<<std::endl;
   std::cerr<<"C TODO"<<std::endl;
 
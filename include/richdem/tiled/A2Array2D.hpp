@@ -10,6 +10,9 @@
 #include "richdem/common/Array2D.hpp"
 #include "richdem/tiled/lru.hpp"
 #include "gdal_priv.h"
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
 
 GDALDataType peekLayoutType(const std::string &layout_filename) {
   LayoutfileReader lf(layout_filename);
@@ -74,13 +77,15 @@ class A2Array2D {
     bool loaded            = false;
     bool created           = true;
     bool do_set_all        = false; //If true, then set all to 'set_all_val' when tile is loaded
+    bool reoriented        = false; //If true, the data in RAM (or in the cache) has already been flipped
+    std::string cache_filename;     //If set, evicted tiles are cached here rather than in 'filename'
     int create_with_width  = -1;
     int create_with_height = -1;
     T set_all_val          = 0;
     void lazySetAll(){
       if(do_set_all){
         do_set_all = false;
-        setAll(set_all_val);
+        this->setAll(set_all_val);
       }
     }
   };
@@ -114,10 +119,13 @@ class A2Array2D {
     if(lru.full()){
       auto tile_to_unload = lru.back();
 
-      if(readonly)
+      if(readonly){
         tile_to_unload->clear();
-      else
+      } else {
+        if(!tile_to_unload->cache_filename.empty())
+          tile_to_unload->setCacheFilename(tile_to_unload->cache_filename);
         tile_to_unload->dumpData();
+      }
 
       evictions++;
 
@@ -128,11 +136,12 @@ class A2Array2D {
     if(tile.created){
       tile.loadData();
       tile.printStamp(5,"Tile load, before reorientating"); //Print stamp before reorientating since this must match parallel_pf.exe
-      if(readonly){
+      if(readonly || !tile.reoriented){
         if((tile.geotransform[1]<0) ^ flipH)
           tile.flipHorz();
         if((tile.geotransform[5]>0) ^ flipV)
           tile.flipVert();
+        tile.reoriented = true;
       }
       tile.printStamp(5,"Tile load, after reorientating"); //Print stamp before reorientating since this must match parallel_pf.exe
     } else {
@@ -140,7 +149,8 @@ class A2Array2D {
         tile.resize(tile.create_with_width,tile.create_with_height);
       else
         tile.resize(per_tile_width,per_tile_height);
-      tile.created = true;
+      tile.created    = true;
+      tile.reoriented = true;
     }
     tile.loaded = true;
     lru.insert(&data[tile_y][tile_x]);
@@ -148,6 +158,36 @@ class A2Array2D {
     tile.lazySetAll();
   }
 
+  ///Ensures that all the tiles agree on a NoData value and retrieves the
+  ///properties needed to write them out as a single raster.
+  void _unifiedProperties(T &no_data, std::vector<double> &out_geotransform) const {
+    no_data = data[0][0].noData();
+    for(int32_t ty=0;ty<heightInTiles();ty++)
+    for(int32_t tx=0;tx<widthInTiles();tx++)
+      if(data[ty][tx].noData()!=no_data)
+        throw std::runtime_error("Files had differing NoData values :-(");
+
+    out_geotransform = data[0][0].geotransform;
+
+    if(out_geotransform.size()!=6){
+      std::cerr<<"Geotransform of output is not the right size. Found "<<out_geotransform.size()<<" expected 6."<<std::endl;
+      throw std::runtime_error("saveGDAL(): Invalid output geotransform.");
+    }
+  }
+
+  static std::string _xmlEscape(const std::string &str){
+    std::string ret;
+    for(const auto c: str)
+      switch(c){
+        case '&':  ret += "&amp;";  break;
+        case '<':  ret += "&lt;";   break;
+        case '>':  ret += "&gt;";   break;
+        case '"':  ret += "&quot;"; break;
+        default:   ret += c;
+      }
+    return ret;
+  }
+
  public:
 
   A2Array2D(std::string layoutfile, int cachesize){
@@ -543,18 +583,9 @@ class A2Array2D {
       throw std::runtime_error("Could not open file for GDAL save!");
     }
 
-    auto no_data = data[0][0].noData();
-    for(int32_t ty=0;ty<heightInTiles();ty++)
-    for(int32_t tx=0;tx<widthInTiles();tx++)
-      if(data[ty][tx].noData()!=no_data)
-        throw std::runtime_error("Files had differing NoData values :-(");
-
-    auto out_geotransform = data[0][0].geotransform;
-
-    if(out_geotransform.size()!=6){
-      std::cerr<<"Geotransform of output is not the right size. Found "<<out_geotransform.size()<<" expected 6."<<std::endl;
-      throw std::runtime_error("saveGDAL(): Invalid output geotransform.");
-    }
+    T no_data;
+    std::vector<double> out_geotransform;
+    _unifiedProperties(no_data, out_geotransform);
 
     fout->SetGeoTransform(out_geotransform.data());
     fout->SetProjection(data[0][0].projection.c_str());
@@ -580,6 +611,154 @@ class A2Array2D {
     GDALClose(fout);
   }
 
+  /**
+    @brief Merges all of the tiles into a single GeoTIFF, writing the output
+           one row of tiles at a time.
+
+    Unlike saveUnifiedGDAL(), tiles are not read through the LRU cache. Instead,
+    the tiles intersecting each band of output rows are decoded in parallel,
+    reoriented, and stitched into a buffer which is then written with a single
+    call. Since the output is striped, this writes GDAL's blocks in order and
+    every block exactly once. Peak memory is roughly two rows of tiles.
+
+    @param[in] outputname  Name of the GeoTIFF to write
+  */
+  void saveUnifiedGDALStreaming(const std::string outputname){
+    if(!readonly){
+      std::cerr<<"Streaming merge requires tiles which are on disk; falling back to saveUnifiedGDAL()."<<std::endl;
+      saveUnifiedGDAL(outputname);
+      return;
+    }
+
+    GDALDriver *poDriver = GetGDALDriverManager()->GetDriverByName("GTiff");
+    if(poDriver==NULL){
+      std::cerr<<"Could not open GDAL driver!"<<std::endl;
+      throw std::runtime_error("Could not open GDAL driver!");
+    }
+
+    char **papszOptions = NULL;
+    papszOptions = CSLSetNameValue(papszOptions, "TILED",   "NO"       );
+    papszOptions = CSLSetNameValue(papszOptions, "BIGTIFF", "IF_SAFER" );
+
+    GDALDataset *fout = poDriver->Create(outputname.c_str(), width(), height(), 1, myGDALType(), papszOptions);
+    CSLDestroy(papszOptions);
+    if(fout==NULL){
+      std::cerr<<"Could not open file '"<<outputname<<"' for GDAL save!"<<std::endl;
+      throw std::runtime_error("Could not open file for GDAL save!");
+    }
+
+    T no_data;
+    std::vector<double> out_geotransform;
+    _unifiedProperties(no_data, out_geotransform);
+
+    fout->SetGeoTransform(out_geotransform.data());
+    fout->SetProjection(data[0][0].projection.c_str());
+
+    GDALRasterBand *oband = fout->GetRasterBand(1);
+    oband->SetNoDataValue(no_data);
+
+    const int64_t out_width = width();
+    std::vector<T> band_buffer;
+
+    for(int32_t ty=0;ty<heightInTiles();ty++){
+      std::cerr<<"p Merging tile row "<<(ty+1)<<" of "<<heightInTiles()<<std::endl;
+
+      const int32_t band_height = stdTileHeight();
+      band_buffer.assign(out_width*band_height, no_data);
+
+      //Each thread opens its own handle to the tile it is decoding, so the
+      //decodes are independent of each other and of the output file.
+      #pragma omp parallel for schedule(dynamic)
+      for(int32_t tx=0;tx<widthInTiles();tx++){
+        if(isNullTile(tx,ty))
+          continue;
+
+        const auto &ptile = data[ty][tx];
+        Array2D<T> tile(ptile.filename, false, 0, 0, 0, 0, false, true);
+
+        if((tile.geotransform[1]<0) ^ flipH)
+          tile.flipHorz();
+        if((tile.geotransform[5]>0) ^ flipV)
+          tile.flipVert();
+
+        const int64_t xoff = (int64_t)tx*stdTileWidth();
+        for(int32_t y=0;y<tile.height();y++)
+          std::copy(
+            tile.getData()+(int64_t)y*tile.width(),
+            tile.getData()+(int64_t)(y+1)*tile.width(),
+            band_buffer.begin()+(int64_t)y*out_width+xoff
+          );
+      }
+
+      auto temp = oband->RasterIO(GF_Write, 0, ty*stdTileHeight(), out_width, band_height, band_buffer.data(), out_width, band_height, myGDALType(), 0, 0);
+      if(temp!=CE_None)
+        std::cerr<<"Error writing file! Continuing in the hopes that some work can be salvaged."<<std::endl;
+    }
+
+    GDALClose(fout);
+  }
+
+  /**
+    @brief Writes a GDAL Virtual Raster (VRT) which references the tiles in
+           place, rather than physically merging them.
+
+    A VRT cannot express the reorientation of a tile, so this throws if any
+    tile would need to be flipped.
+
+    @param[in] outputname  Name of the VRT file to write
+  */
+  void saveVRT(const std::string outputname){
+    T no_data;
+    std::vector<double> out_geotransform;
+    _unifiedProperties(no_data, out_geotransform);
+
+    for(int32_t ty=0;ty<heightInTiles();ty++)
+    for(int32_t tx=0;tx<widthInTiles();tx++){
+      if(isNullTile(tx,ty))
+        continue;
+      const auto &tile = data[ty][tx];
+      if( ((tile.geotransform[1]<0) ^ flipH) || ((tile.geotransform[5]>0) ^ flipV) ){
+        std::cerr<<"'"<<tile.filename<<"' would need to be reoriented, which a VRT cannot do. Use a physical merge instead."<<std::endl;
+        throw std::runtime_error("Tile orientation cannot be represented in a VRT!");
+      }
+    }
+
+    const char *type_name = GDALGetDataTypeName(myGDALType());
+
+    std::ofstream fout(outputname);
+    if(!fout.good()){
+      std::cerr<<"Could not open file '"<<outputname<<"' for VRT save!"<<std::endl;
+      throw std::runtime_error("Could not open file for VRT save!");
+    }
+
+    fout<<std::setprecision(17);
+    fout<<"<VRTDataset rasterXSize=\""<<width()<<"\" rasterYSize=\""<<height()<<"\">\n";
+    fout<<"  <SRS>"<<_xmlEscape(data[0][0].projection)<<"</SRS>\n";
+    fout<<"  <GeoTransform>";
+    for(int i=0;i<6;i++)
+      fout<<(i>0?", ":"")<<out_geotransform[i];
+    fout<<"</GeoTransform>\n";
+    fout<<"  <VRTRasterBand dataType=\""<<type_name<<"\" band=\"1\">\n";
+    fout<<"    <NoDataValue>"<<(double)no_data<<"</NoDataValue>\n";
+
+    for(int32_t ty=0;ty<heightInTiles();ty++)
+    for(int32_t tx=0;tx<widthInTiles();tx++){
+      if(isNullTile(tx,ty))
+        continue;
+      const auto &tile = data[ty][tx];
+      fout<<"    <SimpleSource>\n";
+      fout<<"      <SourceFilename relativeToVRT=\"0\">"<<_xmlEscape(tile.filename)<<"</SourceFilename>\n";
+      fout<<"      <SourceBand>1</SourceBand>\n";
+      fout<<"      <SourceProperties RasterXSize=\""<<tile.width()<<"\" RasterYSize=\""<<tile.height()<<"\" DataType=\""<<type_name<<"\"/>\n";
+      fout<<"      <SrcRect xOff=\"0\" yOff=\"0\" xSize=\""<<tile.width()<<"\" ySize=\""<<tile.height()<<"\"/>\n";
+      fout<<"      <DstRect xOff=\""<<((int64_t)tx*stdTileWidth())<<"\" yOff=\""<<((int64_t)ty*stdTileHeight())<<"\" xSize=\""<<tile.width()<<"\" ySize=\""<<tile.height()<<"\"/>\n";
+      fout<<"    </SimpleSource>\n";
+    }
+
+    fout<<"  </VRTRasterBand>\n";
+    fout<<"</VRTDataset>\n";
+  }
+
   void setNoData(const T &ndval){
     for(auto &row: data)
     for(auto &tile: row)
@@ -622,6 +801,42 @@ class A2Array2D {
   void loadTile(int tx, int ty){
     _LoadTile(tx,ty);
   }
+
+  /**
+    @brief Loads a tile, if necessary, and returns it.
+
+    @return A reference to the tile. This is only valid until the next tile is
+            loaded, since that may evict this one.
+  */
+  Array2D<T>& getTile(int32_t tx, int32_t ty){
+    assert(!isNullTile(tx,ty));
+    _LoadTile(tx,ty);
+    return data[ty][tx];
+  }
+
+  /**
+    @brief Allows the tiles of a layout file to be modified.
+
+    Ordinarily, tiles loaded from a layout file are read-only and evicting them
+    discards any changes. After calling this, evicted tiles are instead cached
+    to disk and reloaded from there, leaving the original files untouched.
+
+    @param[in] cache_template Template for the cache filenames. "%f" is
+                              replaced by each tile's basename.
+  */
+  void setCacheTemplate(const std::string &cache_template){
+    if(cache_template.find("%f")==std::string::npos)
+      throw std::runtime_error("Cache filename template must contain '%f'!");
+
+    readonly = false;
+    for(auto &row: data)
+    for(auto &tile: row){
+      if(tile.null_tile)
+        continue;
+      tile.cache_filename = cache_template;
+      tile.cache_filename.replace(tile.cache_filename.find("%f"), 2, tile.basename);
+    }
+  }
 };
 
 #endif
\ No newline at end of file
@@ -11,7 +11,9 @@
 #include "richdem/common/Layoutfile.hpp"
 #include "richdem/common/communication.hpp"
 #include "richdem/common/memory.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/timer.hpp"
+#include "richdem/common/trace.hpp"
 #include "richdem/common/Array2D.hpp"
 #include "richdem/common/grid_cell.hpp"
 #include "perimeters.hpp"
@@ -42,6 +44,7 @@ const int TAG_TILE_DATA   = 1;
 const int TAG_DONE_FIRST  = 2;
 const int TAG_SECOND_DATA = 3;
 const int TAG_DONE_SECOND = 4;
+const int TAG_TRACE       = 5;
 
 const int SYNC_MSG_KILL = 0;
 const int JOB_FIRST     = 2;
@@ -148,6 +151,13 @@ class TileInfo{
 typedef std::vector< std::vector< TileInfo > > TileGrid;
 
 
+///Tile coordinates attached to a tile's trace events
+std::map<std::string,std::string> TraceArgs(const TileInfo &tile){
+  return {{"gridx",std::to_string(tile.gridx)}, {"gridy",std::to_string(tile.gridy)}};
+}
+
+
+
 class TimeInfo {
  private:
   friend class cereal::access;
@@ -461,6 +471,7 @@ class ConsumerSpecifics {
       std::cerr<<"d Opening "<<tile.filename<<" as flowdirs."<<std::endl;
     #endif
 
+    TraceScope trace_load("Load", "io", TraceArgs(tile));
     timer_io.start();
     flowdirs = Array2D<flowdir_t>(tile.filename, false, tile.x, tile.y, tile.width, tile.height);
 
@@ -482,9 +493,11 @@ class ConsumerSpecifics {
     if(tile.flip & FLIP_HORZ)
       flowdirs.flipHorz();
     timer_io.stop();
+    trace_load.end();
 
     flowdirs.printStamp(5,"LoadFromEvict() after reorientation");
 
+    TraceScope trace_calc("First round", "calc", TraceArgs(tile));
     timer_calc.start();
     FlowAccumulation(flowdirs,accum);
     timer_calc.stop();
@@ -501,6 +514,8 @@ class ConsumerSpecifics {
   }
 
   void FirstRound(const TileInfo &tile, Job1<T> &job1){
+    TraceScope trace("Follow perimeter paths", "calc", TraceArgs(tile));
+
     //-2 removes duplicate cells on vertical edges which would otherwise
     //overlap horizontal edges
     links.resize(2*flowdirs.width()+2*(flowdirs.height()-2), FLOW_TERMINATES);
@@ -551,6 +566,7 @@ class ConsumerSpecifics {
 
     auto &accum_offset = job2;
 
+    TraceScope trace_calc("Second round", "calc", TraceArgs(tile));
     timer_calc.start();
     for(int s=0;s<(int)accum_offset.size();s++){
       if(accum_offset.at(s)==0)
@@ -560,11 +576,13 @@ class ConsumerSpecifics {
       FollowPathAdd(x,y,flowdirs,accum,accum_offset.at(s));
     }
     timer_calc.stop();
+    trace_calc.end();
 
     //At this point we're done with the calculation! Boo-yeah!
 
     accum.printStamp(5,"Saving output before reorientation");
 
+    TraceScope trace_save("Save", "io", TraceArgs(tile));
     timer_io.start();
     if(tile.flip & FLIP_HORZ)
       accum.flipHorz();
@@ -580,6 +598,7 @@ class ConsumerSpecifics {
   }
 
   void SaveToCache(const TileInfo &tile){
+    TraceScope trace("Save", "io", TraceArgs(tile));
     timer_io.start();
     flowdirs.setCacheFilename(tile.retention+"-flowdirs.dat");
     accum.setCacheFilename(tile.retention+"-accum.dat");
@@ -589,6 +608,7 @@ class ConsumerSpecifics {
   }
 
   void LoadFromCache(const TileInfo &tile){
+    TraceScope trace("Load", "io", TraceArgs(tile));
     timer_io.start();
     flowdirs = Array2D<flowdir_t>(tile.retention+"-flowdirs.dat", true);
     accum    = Array2D<accum_t  >(tile.retention+"-accum.dat",    true);
@@ -596,6 +616,7 @@ class ConsumerSpecifics {
   }
 
   void SaveToRetain(TileInfo &tile, StorageType<T> &storage){
+    TraceScope trace("Save", "io", TraceArgs(tile));
     timer_io.start();
     auto &temp  = storage[std::make_pair(tile.gridy,tile.gridx)];
     temp.first  = std::move(flowdirs);
@@ -604,6 +625,7 @@ class ConsumerSpecifics {
   }
 
   void LoadFromRetain(TileInfo &tile, StorageType<T> &storage){
+    TraceScope trace("Load", "io", TraceArgs(tile));
     timer_io.start();
     auto &temp = storage.at(std::make_pair(tile.gridy,tile.gridx));
     flowdirs   = std::move(temp.first);
@@ -918,6 +940,8 @@ void Consumer(){
   TileInfo      tile;
   StorageType<T> storage;
 
+  Trace::get().setProcess(CommRank());
+
   //Have the consumer process messages as long as they are coming using a
   //blocking receive to wait.
   while(true){
@@ -928,6 +952,11 @@ void Consumer(){
     //This message indicates that everything is done and the Consumer should shut
     //down.
     if(the_job==SYNC_MSG_KILL){
+      //The kill message says whether the Producer wants this process's trace
+      int send_trace;
+      CommRecv(&send_trace, nullptr, 0);
+      if(send_trace)
+        CommSend(&Trace::get().getEvents(), nullptr, 0, TAG_TRACE);
       return;
 
     //This message indicates that the consumer should prepare to perform the
@@ -959,11 +988,12 @@ void Consumer(){
 
       timer_overall.stop();
 
-      long vmpeak, vmhwm;
+      uint64_t vmpeak, vmhwm;
       ProcessMemUsage(vmpeak,vmhwm);
 
       job1.time_info = TimeInfo(consumer.timer_calc.accumulated(),timer_overall.accumulated(),consumer.timer_io.accumulated(),vmpeak,vmhwm);
 
+      TraceScope trace_send("Send", "comm", TraceArgs(tile));
       CommSend(&job1,nullptr,0,TAG_DONE_FIRST);
     } else if (the_job==JOB_SECOND){
       Timer timer_overall;
@@ -986,10 +1016,11 @@ void Consumer(){
 
       timer_overall.stop();
 
-      long vmpeak, vmhwm;
+      uint64_t vmpeak, vmhwm;
       ProcessMemUsage(vmpeak,vmhwm);
 
       TimeInfo temp(consumer.timer_calc.accumulated(), timer_overall.accumulated(), consumer.timer_io.accumulated(),vmpeak,vmhwm);
+      TraceScope trace_send("Send", "comm", TraceArgs(tile));
       CommSend(&temp, nullptr, 0, TAG_DONE_SECOND);
     }
   }
@@ -1007,7 +1038,7 @@ void Consumer(){
 //modified, is then redelegated to a Consumer which ultimately finishes the
 //processing.
 template<class T>
-void Producer(TileGrid &tiles){
+void Producer(TileGrid &tiles, const std::string trace_file){
   Timer timer_overall;
   timer_overall.start();
 
@@ -1028,6 +1059,7 @@ void Producer(TileGrid &tiles){
 
   //Distribute jobs to the consumers. Since this is non-blocking, all of the
   //jobs will be sent and then we will wait to hear back below.
+  TraceScope trace_send1("Send first-round jobs", "comm");
   for(int y=0;y<gridheight;y++)
   for(int x=0;x<gridwidth;x++){
     if(tiles[y][x].nullTile)
@@ -1038,16 +1070,20 @@ void Producer(TileGrid &tiles){
     jobs_out++;
   }
 
+  trace_send1.end();
+
   std::cerr<<"m Jobs created = "<<jobs_out<<std::endl;
 
   //Grid to hold returned jobs
   Job1Grid<T> jobs1(tiles.size(), std::vector< Job1<T> >(tiles[0].size()));
+  TraceScope trace_recv1("Wait for first round", "comm");
   while(jobs_out--){
     std::cerr<<"p Jobs remaining = "<<jobs_out<<std::endl;
     Job1<T> temp;
     CommRecv(&temp, nullptr, -1);
     jobs1.at(temp.gridy).at(temp.gridx) = temp;
   }
+  trace_recv1.end();
 
   std::cerr<<"n First stage Tx = "<<CommBytesSent()<<" B"<<std::endl;
   std::cerr<<"n First stage Rx = "<<CommBytesRecv()<<" B"<<std::endl;
@@ -1056,14 +1092,25 @@ void Producer(TileGrid &tiles){
   //Get timing info
   TimeInfo time_first_total;
   for(int y=0;y<gridheight;y++)
-  for(int x=0;x<gridwidth;x++)
-    time_first_total += jobs1[y][x].time_info;
+  for(int x=0;x<gridwidth;x++){
+    if(tiles[y][x].nullTile)
+      continue;
+    const auto &ti = jobs1[y][x].time_info;
+    time_first_total += ti;
+    Instrumentation::get().record("tiles", {
+      {"stage",1}, {"gridx",x}, {"gridy",y}, {"calc",ti.calc}, {"io",ti.io},
+      {"overall",ti.overall}, {"vmpeak",ti.vmpeak}, {"vmhwm",ti.vmhwm}
+    });
+  }
 
 
   ////////////////////////////////////////////////////////////
   //PRODUCER NODE PERFORMS PROCESSING ON ALL THE RETURNED DATA
 
-  producer.Calculations(tiles,jobs1);
+  {
+    TraceScope trace("Aggregation", "calc");
+    producer.Calculations(tiles,jobs1);
+  }
 
   ////////////////////////////////////////////////////////////
   //SEND OUT JOBS TO FINALIZE GLOBAL SOLUTION
@@ -1072,6 +1119,7 @@ void Producer(TileGrid &tiles){
   jobs_out = 0; 
   msgs     = std::vector<msg_type>();
 
+  TraceScope trace_send2("Send second-round jobs", "comm");
   for(int y=0;y<gridheight;y++)
   for(int x=0;x<gridwidth;x++){
     if(tiles[y][x].nullTile)
@@ -1088,18 +1136,36 @@ void Producer(TileGrid &tiles){
   //timing and memory statistics from the consumers.
   TimeInfo time_second_total;
 
+  trace_send2.end();
+  TraceScope trace_recv2("Wait for second round", "comm");
   while(jobs_out--){
     std::cerr<<"p Jobs left to receive = "<<jobs_out<<std::endl;
     TimeInfo temp;
     CommRecv(&temp, nullptr, -1);
     time_second_total += temp;
+    Instrumentation::get().record("tiles", {
+      {"stage",2}, {"calc",temp.calc}, {"io",temp.io}, {"overall",temp.overall},
+      {"vmpeak",temp.vmpeak}, {"vmhwm",temp.vmhwm}
+    });
   }
 
+  trace_recv2.end();
+
   //Send out a message to tell the consumers to politely quit. Their job is
-  //done.
-  for(int i=1;i<CommSize();i++){
-    int temp;
-    CommSend(&temp,nullptr,i,SYNC_MSG_KILL);
+  //done. The message also asks them for their trace events, if we want them.
+  const int send_trace = !trace_file.empty();
+  for(int i=1;i<CommSize();i++)
+    CommSend(&send_trace,nullptr,i,SYNC_MSG_KILL);
+
+  if(send_trace){
+    Trace::get().nameProcess(0, "Producer");
+    for(int i=1;i<CommSize();i++){
+      Trace::get().nameProcess(i, "Consumer "+std::to_string(i));
+      std::vector<TraceEvent> events;
+      CommRecv(&events, nullptr, -1);
+      Trace::get().merge(events);
+    }
+    Trace::get().writeJSON(trace_file);
   }
 
   timer_overall.stop();
@@ -1122,10 +1188,25 @@ void Producer(TileGrid &tiles){
   std::cerr<<"t Producer overall time = "<<timer_overall.accumulated()       <<" s"<<std::endl;
   std::cerr<<"t Producer calc time = "   <<producer.timer_calc.accumulated() <<" s"<<std::endl;
 
-  long vmpeak, vmhwm;
+  uint64_t vmpeak, vmhwm;
   ProcessMemUsage(vmpeak,vmhwm);
   std::cerr<<"r Producer's VmPeak = "   <<vmpeak <<std::endl;
   std::cerr<<"r Producer's VmHWM = "    <<vmhwm  <<std::endl;
+
+  auto &stats = Instrumentation::get();
+  stats.value("first_stage.overall",  time_first_total.overall);
+  stats.value("first_stage.io",       time_first_total.io);
+  stats.value("first_stage.calc",     time_first_total.calc);
+  stats.value("first_stage.vmpeak",   time_first_total.vmpeak);
+  stats.value("first_stage.vmhwm",    time_first_total.vmhwm);
+  stats.value("second_stage.overall", time_second_total.overall);
+  stats.value("second_stage.io",      time_second_total.io);
+  stats.value("second_stage.calc",    time_second_total.calc);
+  stats.value("second_stage.vmpeak",  time_second_total.vmpeak);
+  stats.value("second_stage.vmhwm",   time_second_total.vmhwm);
+  stats.value("producer.overall",     timer_overall.accumulated());
+  stats.value("producer.calc",        producer.timer_calc.accumulated());
+  stats.sampleMemory();
 }
 
 
@@ -1145,11 +1226,15 @@ void Preparer(
   int bheight,
   int flipH,
   int flipV,
-  std::string analysis
+  std::string analysis,
+  const std::string trace_file
 ){
   Timer timer_overall;
   timer_overall.start();
 
+  Trace::get().setProcess(0);
+  TraceScope trace_prep("Prepare tiles", "io");
+
   TileGrid tiles;
   std::string  filename;
   GDALDataType file_type;        //All tiles must have a common file_type
@@ -1381,6 +1466,7 @@ void Preparer(
 
   CommBroadcast(&file_type,0);
   timer_overall.stop();
+  trace_prep.end();
   std::cerr<<"t Preparer time = "<<timer_overall.accumulated()<<" s"<<std::endl;
 
   if(reptile!=nullptr){
@@ -1391,19 +1477,19 @@ void Preparer(
 
   switch(file_type){
     case GDT_Byte:
-      return Producer<uint8_t >(tiles);
+      return Producer<uint8_t >(tiles, trace_file);
     case GDT_UInt16:
-      return Producer<uint16_t>(tiles);
+      return Producer<uint16_t>(tiles, trace_file);
     case GDT_Int16:
-      return Producer<int16_t >(tiles);
+      return Producer<int16_t >(tiles, trace_file);
     case GDT_UInt32:
-      return Producer<uint32_t>(tiles);
+      return Producer<uint32_t>(tiles, trace_file);
     case GDT_Int32:
-      return Producer<int32_t >(tiles);
+      return Producer<int32_t >(tiles, trace_file);
     case GDT_Float32:
-      return Producer<float   >(tiles);
+      return Producer<float   >(tiles, trace_file);
     case GDT_Float64:
-      return Producer<double  >(tiles);
+      return Producer<double  >(tiles, trace_file);
     case GDT_CInt16:
     case GDT_CInt32:
     case GDT_CFloat32:
@@ -1427,6 +1513,7 @@ int main(int argc, char **argv){
     std::string retention;
     std::string input_file;
     std::string output_name;
+    std::string trace_file;
     int         bwidth    = -1;
     int         bheight   = -1;
     int         flipH     = false;
@@ -1468,6 +1555,12 @@ int main(int argc, char **argv){
           CommBroadcast(&good_to_go,0);
           CommFinalize();
           return -1;
+        } else if(strcmp(argv[i],"--trace")==0){
+          if(i+1==argc)
+            throw std::invalid_argument("--trace followed by no argument.");
+          trace_file = argv[i+1];
+          i++;
+          continue;
         } else if(strcmp(argv[i],"--flipH")==0 || strcmp(argv[i],"-H")==0){
           flipH = true;
         } else if(strcmp(argv[i],"--flipV")==0 || strcmp(argv[i],"-V")==0){
@@ -1507,7 +1600,7 @@ int main(int argc, char **argv){
       else
         output_err = ia.what();
 
-      std::cerr<<"parallel_d8_accum.exe [--flipV] [--flipH] [--bwidth #] [--bheight #] <many/one> <retention> <input> <output>"<<std::endl;
+      std::cerr<<"parallel_d8_accum.exe [--flipV] [--flipH] [--bwidth #] [--bheight #] [--trace <file>] <many/one> <retention> <input> <output>"<<std::endl;
       std::cerr<<"\tUse '--help' to show help."<<std::endl;
 
       std::cerr<<"E "<<output_err<<std::endl;
@@ -1527,6 +1620,7 @@ int main(int argc, char **argv){
     std::cerr<<"c Block height = "           <<bheight   <<std::endl;
     std::cerr<<"c Flip horizontal = "        <<flipH     <<std::endl;
     std::cerr<<"c Flip vertical = "          <<flipV     <<std::endl;
+    std::cerr<<"c Trace file = "             <<trace_file<<std::endl;
 
     #ifdef WITH_COMPRESSION
       std::cerr<<"c Cache compression = TRUE"<<std::endl;
@@ -1535,7 +1629,7 @@ int main(int argc, char **argv){
     #endif
 
     CommBroadcast(&good_to_go,0);
-    Preparer(many_or_one, retention, input_file, output_name, bwidth, bheight, flipH, flipV, analysis);
+    Preparer(many_or_one, retention, input_file, output_name, bwidth, bheight, flipH, flipV, analysis, trace_file);
 
     timer_master.stop();
     std::cerr<<"t Total wall-time = "<<timer_master.accumulated()<<" s"<<std::endl;
@@ -15,10 +15,13 @@
 #include "richdem/common/Layoutfile.hpp"
 #include "richdem/common/communication.hpp"
 #include "richdem/common/memory.hpp"
+#include "richdem/common/instrumentation.hpp"
 #include "richdem/common/timer.hpp"
+#include "richdem/common/trace.hpp"
 #include "richdem/common/Array2D.hpp"
 #include "richdem/common/grid_cell.hpp"
 #include "Zhou2016pf.hpp"
+#include "mastergraph.hpp"
 //#include "Barnes2014pf.hpp" //NOTE: Used only for timing tests
 
 //We use the cstdint library here to ensure that the program behaves as expected
@@ -44,6 +47,7 @@ const int TAG_TILE_DATA   = 1;
 const int TAG_DONE_FIRST  = 2;
 const int TAG_SECOND_DATA = 3;
 const int TAG_DONE_SECOND = 4;
+const int TAG_TRACE       = 5;
 
 const int SYNC_MSG_KILL = 0;
 const int JOB_FIRST     = 2;
@@ -109,6 +113,13 @@ class TileInfo{
 typedef std::vector< std::vector< TileInfo > > TileGrid;
 
 
+///Tile coordinates attached to a tile's trace events
+std::map<std::string,std::string> TraceArgs(const TileInfo &tile){
+  return {{"gridx",std::to_string(tile.gridx)}, {"gridy",std::to_string(tile.gridy)}};
+}
+
+
+
 class TimeInfo {
  private:
   friend class cereal::access;
@@ -196,9 +207,11 @@ class ConsumerSpecifics {
     spillover_graph.resize(2*tile.width+2*tile.height);
 
     //Read in the data associated with the job
+    TraceScope trace_load("Load", "io", TraceArgs(tile));
     timer_io.start();
     dem = Array2D<elev_t>(tile.filename, false, tile.x, tile.y, tile.width, tile.height, tile.many);
     timer_io.stop();
+    trace_load.end();
 
     //TODO: Figure out a clever way to allow tiles of different widths/heights
     if(dem.width()!=tile.width){
@@ -223,6 +236,7 @@ class ConsumerSpecifics {
     //know whether the tile is being flipped since it uses this information to
     //determine which edges connect to Special Watershed 1 (which is the
     //outside of the DEM as a whole).
+    TraceScope trace_calc("First round", "calc", TraceArgs(tile));
     timer_calc.start();
     Zhou2015Labels(dem, labels, spillover_graph, tile.edge, tile.flip & FLIP_HORZ, tile.flip & FLIP_VERT);
     timer_calc.stop();
@@ -233,6 +247,7 @@ class ConsumerSpecifics {
   }
 
   void SaveToCache(const TileInfo &tile){
+    TraceScope trace("Save", "io", TraceArgs(tile));
     timer_io.start();
     dem.setCacheFilename(tile.retention+"dem.dat");
     labels.setCacheFilename(tile.retention+"dem.dat");
@@ -242,6 +257,7 @@ class ConsumerSpecifics {
   }
 
   void LoadFromCache(const TileInfo &tile){
+    TraceScope trace("Load", "io", TraceArgs(tile));
     timer_io.start();
     dem    = Array2D<elev_t >(tile.retention+"dem.dat"   ,true); //TODO: There should be an exception if this fails
     labels = Array2D<label_t>(tile.retention+"labels.dat",true);
@@ -249,6 +265,7 @@ class ConsumerSpecifics {
   }
 
   void SaveToRetain(TileInfo &tile, StorageType<elev_t> &storage){
+    TraceScope trace("Save", "io", TraceArgs(tile));
     timer_io.start();
     auto &temp  = storage[std::make_pair(tile.gridy,tile.gridx)];
     temp.first  = std::move(dem);
@@ -257,6 +274,7 @@ class ConsumerSpecifics {
   }
 
   void LoadFromRetain(TileInfo &tile, StorageType<elev_t> &storage){
+    TraceScope trace("Load", "io", TraceArgs(tile));
     timer_io.start();
     auto &temp = storage.at(std::make_pair(tile.gridy,tile.gridx));
     dem        = std::move(temp.first);
@@ -265,6 +283,8 @@ class ConsumerSpecifics {
   }
 
   void FirstRound(const TileInfo &tile, Job1<elev_t> &job1){
+    TraceScope trace("Collect perimeter", "calc", TraceArgs(tile));
+
     job1.graph = std::move(spillover_graph);
 
     //The tile's edge info is needed to solve the global problem. Collect it.
@@ -304,17 +324,20 @@ class ConsumerSpecifics {
   }
 
   void SecondRound(const TileInfo &tile, Job2<elev_t> &job2){
+    TraceScope trace_calc("Second round", "calc", TraceArgs(tile));
     timer_calc.start();
     for(int32_t y=0;y<dem.height();y++)
     for(int32_t x=0;x<dem.width();x++)
       if(labels(x,y)>1 && dem(x,y)<job2.at(labels(x,y)))
         dem(x,y) = job2.at(labels(x,y));
     timer_calc.stop();
+    trace_calc.end();
 
     //At this point we're done with the calculation! Boo-yeah!
 
     dem.printStamp(5,"Unorientated output stamp");
 
+    TraceScope trace_save("Save", "io", TraceArgs(tile));
     timer_io.start();
     dem.saveGDAL(tile.outputname, tile.analysis, tile.x, tile.y);
     timer_io.stop();
@@ -332,62 +355,6 @@ class ProducerSpecifics {
  private:
   std::vector<elev_t> graph_elev;
 
-  void HandleEdge(
-    const std::vector<elev_t>  &elev_a,
-    const std::vector<elev_t>  &elev_b,
-    const std::vector<label_t> &label_a,
-    const std::vector<label_t> &label_b,
-    std::vector< std::map<label_t, elev_t> > &mastergraph,
-    const label_t label_a_offset,
-    const label_t label_b_offset
-  ){
-    //Guarantee that all vectors are of the same length
-    assert(elev_a.size ()==elev_b.size ());
-    assert(label_a.size()==label_b.size());
-    assert(elev_a.size ()==label_b.size());
-
-    int len = elev_a.size();
-
-    for(int i=0;i<len;i++){
-      auto c_l = label_a[i];
-      if(c_l>1) c_l+=label_a_offset;
-
-      for(int ni=i-1;ni<=i+1;ni++){
-        if(ni<0 || ni==len)
-          continue;
-        auto n_l = label_b[ni];
-        if(n_l>1) n_l+=label_b_offset;
-        //TODO: Does this really matter? We could just ignore these entries
-        if(c_l==n_l) //Only happens when labels are both 1
-          continue;
-
-        auto elev_over = std::max(elev_a[i],elev_b[ni]);
-        if(mastergraph.at(c_l).count(n_l)==0 || elev_over<mastergraph.at(c_l)[n_l]){
-          mastergraph[c_l][n_l] = elev_over;
-          mastergraph[n_l][c_l] = elev_over;
-        }
-      }
-    }
-  }
-
-  void HandleCorner(
-    const elev_t  elev_a,
-    const elev_t  elev_b,
-    label_t       l_a,
-    label_t       l_b,
-    std::vector< std::map<label_t, elev_t> > &mastergraph,
-    const label_t l_a_offset,
-    const label_t l_b_offset
-  ){
-    if(l_a>1) l_a += l_a_offset;
-    if(l_b>1) l_b += l_b_offset;
-    auto elev_over = std::max(elev_a,elev_b);
-    if(mastergraph.at(l_a).count(l_b)==0 || elev_over<mastergraph.at(l_a)[l_b]){
-      mastergraph[l_a][l_b] = elev_over;
-      mastergraph[l_b][l_a] = elev_over;
-    }
-  }
-
  public:
   void Calculations(TileGrid &tiles, Job1Grid<elev_t> &jobs1){
     //Merge all of the graphs together into one very big graph. Clear information
@@ -399,84 +366,15 @@ class ProducerSpecifics {
     Timer timer_mg_construct;
     timer_mg_construct.start();
 
-    const int gridheight = tiles.size();
-    const int gridwidth  = tiles[0].size();
-    
-    //Get a tile size so we can calculate the max label
-    label_t maxlabel = 0;
-    for(int y=0;y<gridheight;y++)
-    for(int x=0;x<gridwidth;x++)
-      maxlabel+=jobs1[y][x].graph.size();
-    std::cerr<<"!Total labels required: "<<maxlabel<<std::endl;
-
-    std::vector< std::map<label_t, elev_t> > mastergraph(maxlabel);
-
-    label_t label_offset = 0;
-    for(int y=0;y<gridheight;y++)
-    for(int x=0;x<gridwidth;x++){
-      if(tiles[y][x].nullTile)
-        continue;
-
-      auto &this_job = jobs1.at(y).at(x);
-
-      tiles[y][x].label_offset = label_offset;
-
-      for(int l=0;l<(int)this_job.graph.size();l++)
-      for(auto const &skey: this_job.graph[l]){
-        label_t first_label  = l;
-        label_t second_label = skey.first;
-        if(first_label >1) first_label +=label_offset;
-        if(second_label>1) second_label+=label_offset;
-        //We insert both ends of the bidirectional edge because in the watershed
-        //labeling process, we only inserted one. We need both here because we
-        //don't know which end of the edge we will approach from as we traverse
-        //the spillover graph.
-        mastergraph.at(first_label)[second_label] = skey.second;
-        mastergraph.at(second_label)[first_label] = skey.second;
+    auto mastergraph = ConstructMastergraph(
+      jobs1,
+      [&](const int x, const int y){ return tiles[y][x].nullTile; },
+      [&](const int x, const int y, const label_t offset, const label_t increment){
+        tiles[y][x].label_offset    = offset;
+        tiles[y][x].label_increment = increment;
       }
-      tiles[y][x].label_increment = this_job.graph.size();
-      label_offset                += this_job.graph.size();
-      this_job.graph.clear();
-    }
-
-    std::cerr<<"Handling adjacent edges and corners..."<<std::endl;
-    for(int y=0;y<gridheight;y++)
-    for(int x=0;x<gridwidth;x++){
-      if(tiles[y][x].nullTile)
-        continue;
-
-      auto &c = jobs1[y][x];
-
-      if(y>0            && !tiles[y-1][x].nullTile)
-        HandleEdge(c.top_elev,   jobs1[y-1][x].bot_elev,   c.top_label,   jobs1[y-1][x].bot_label,   mastergraph, tiles[y][x].label_offset, tiles[y-1][x].label_offset);
-
-      if(y<gridheight-1 && !tiles[y+1][x].nullTile)
-        HandleEdge(c.bot_elev,   jobs1[y+1][x].top_elev,   c.bot_label,   jobs1[y+1][x].top_label,   mastergraph, tiles[y][x].label_offset, tiles[y+1][x].label_offset);
-      
-      if(x>0            && !tiles[y][x-1].nullTile)
-        HandleEdge(c.left_elev,  jobs1[y][x-1].right_elev, c.left_label,  jobs1[y][x-1].right_label, mastergraph, tiles[y][x].label_offset, tiles[y][x-1].label_offset);
-      
-      if(x<gridwidth-1  && !tiles[y][x+1].nullTile)
-        HandleEdge(c.right_elev, jobs1[y][x+1].left_elev,  c.right_label, jobs1[y][x+1].left_label,  mastergraph, tiles[y][x].label_offset, tiles[y][x+1].label_offset);
-
-
-      //I wish I had wrote it all in LISP.
-      //Top left
-      if(y>0 && x>0                      && !tiles[y-1][x-1].nullTile)   
-        HandleCorner(c.top_elev.front(), jobs1[y-1][x-1].bot_elev.back(),  c.top_label.front(), jobs1[y-1][x-1].bot_label.back(),  mastergraph, tiles[y][x].label_offset, tiles[y-1][x-1].label_offset);
-      
-      //Bottom right
-      if(y<gridheight-1 && x<gridwidth-1 && !tiles[y+1][x+1].nullTile) 
-        HandleCorner(c.bot_elev.back(),  jobs1[y+1][x+1].top_elev.front(), c.bot_label.back(),  jobs1[y+1][x+1].top_label.front(), mastergraph, tiles[y][x].label_offset, tiles[y+1][x+1].label_offset);
-      
-      //Top right
-      if(y>0 && x<gridwidth-1            && !tiles[y-1][x+1].nullTile)            
-        HandleCorner(c.top_elev.back(),  jobs1[y-1][x+1].bot_elev.front(), c.top_label.back(),  jobs1[y-1][x+1].bot_label.front(), mastergraph, tiles[y][x].label_offset, tiles[y-1][x+1].label_offset);
-      
-      //Bottom left
-      if(x>0 && y<gridheight-1           && !tiles[y+1][x-1].nullTile) 
-        HandleCorner(c.bot_elev.front(), jobs1[y+1][x-1].top_elev.back(),  c.bot_label.front(), jobs1[y+1][x-1].top_label.back(),  mastergraph, tiles[y][x].label_offset, tiles[y+1][x-1].label_offset);
-    }
+    );
+    std::cerr<<"!Total labels required: "<<mastergraph.size()<<std::endl;
     timer_mg_construct.stop();
 
     std::cerr<<"!Mastergraph constructed in "<<timer_mg_construct.accumulated()<<"s. "<<std::endl;
@@ -489,49 +387,7 @@ class ProducerSpecifics {
     std::cerr<<"Performing aggregated priority flood"<<std::endl;
     Timer agg_pflood_timer;
     agg_pflood_timer.start();
-    typedef std::pair<elev_t, label_t>  graph_node;
-    std::priority_queue<graph_node, std::vector<graph_node>, std::greater<graph_node> > open;
-    std::queue<graph_node> pit;
-    std::vector<bool>   visited(maxlabel,false); //TODO
-    graph_elev.resize(maxlabel);                 //TODO
-
-    open.emplace(std::numeric_limits<elev_t>::lowest(),1);
-
-    while(open.size()>0 || pit.size()>0){
-      graph_node c;
-      if(pit.size()>0){
-        c = pit.front();
-        pit.pop();
-      } else {
-        c = open.top();
-        open.pop();
-      }
-
-      auto my_elev       = c.first;
-      auto my_vertex_num = c.second;
-      if(visited[my_vertex_num])
-        continue;
-
-      graph_elev[my_vertex_num] = my_elev;
-      visited   [my_vertex_num] = true;
-
-      for(auto &n: mastergraph[my_vertex_num]){
-        auto n_vertex_num = n.first;
-        auto n_elev       = n.second;
-        if(visited[n_vertex_num])
-          continue;
-        open.emplace(std::max(my_elev,n_elev),n_vertex_num);
-        //Turning on these lines activates the improved priority flood. It is
-        //disabled to make the algorithm easier to verify by inspection, and
-        //because it made little difference in the overall speed of the algorithm.
-
-        // if(n_elev<=my_elev){
-        //   pit.emplace(my_elev,n_vertex_num);
-        // } else {
-        //   open.emplace(n_elev,n_vertex_num);
-        // }
-      }
-    }
+    graph_elev = FloodMastergraph(mastergraph);
     agg_pflood_timer.stop();
     std::cerr<<"!Aggregated priority flood time: "<<agg_pflood_timer.accumulated()<<"s."<<std::endl;
     timer_calc.stop();
@@ -596,6 +452,8 @@ void Consumer(){
   TileInfo      tile;
   StorageType<T> storage;
 
+  Trace::get().setProcess(CommRank());
+
   //Have the consumer process messages as long as they are coming using a
   //blocking receive to wait.
   while(true){
@@ -606,6 +464,11 @@ void Consumer(){
     //This message indicates that everything is done and the Consumer should shut
     //down.
     if(the_job==SYNC_MSG_KILL){
+      //The kill message says whether the Producer wants this process's trace
+      int send_trace;
+      CommRecv(&send_trace, nullptr, 0);
+      if(send_trace)
+        CommSend(&Trace::get().getEvents(), nullptr, 0, TAG_TRACE);
       return;
 
     //This message indicates that the consumer should prepare to perform the
@@ -637,11 +500,12 @@ void Consumer(){
 
       timer_overall.stop();
 
-      long vmpeak, vmhwm;
+      uint64_t vmpeak, vmhwm;
       ProcessMemUsage(vmpeak,vmhwm);
 
       job1.time_info = TimeInfo(consumer.timer_calc.accumulated(),timer_overall.accumulated(),consumer.timer_io.accumulated(),vmpeak,vmhwm);
 
+      TraceScope trace_send("Send", "comm", TraceArgs(tile));
       CommSend(&job1,nullptr,0,TAG_DONE_FIRST);
     } else if (the_job==JOB_SECOND){
       Timer timer_overall;
@@ -664,10 +528,11 @@ void Consumer(){
 
       timer_overall.stop();
 
-      long vmpeak, vmhwm;
+      uint64_t vmpeak, vmhwm;
       ProcessMemUsage(vmpeak,vmhwm);
 
       TimeInfo temp(consumer.timer_calc.accumulated(), timer_overall.accumulated(), consumer.timer_io.accumulated(),vmpeak,vmhwm);
+      TraceScope trace_send("Send", "comm", TraceArgs(tile));
       CommSend(&temp, nullptr, 0, TAG_DONE_SECOND);
     }
   }
@@ -685,7 +550,7 @@ void Consumer(){
 //modified, is then redelegated to a Consumer which ultimately finishes the
 //processing.
 template<class T>
-void Producer(TileGrid &tiles){
+void Producer(TileGrid &tiles, const std::string trace_file){
   Timer timer_overall;
   timer_overall.start();
 
@@ -706,6 +571,7 @@ void Producer(TileGrid &tiles){
 
   //Distribute jobs to the consumers. Since this is non-blocking, all of the
   //jobs will be sent and then we will wait to hear back below.
+  TraceScope trace_send1("Send first-round jobs", "comm");
   for(int y=0;y<gridheight;y++)
   for(int x=0;x<gridwidth;x++){
     if(tiles[y][x].nullTile)
@@ -723,16 +589,20 @@ void Producer(TileGrid &tiles){
   //increase in the complexity of this code. I have opted for a more resource-
   //intensive implementation in order to try to keep the code simple.
 
+  trace_send1.end();
+
   std::cerr<<"m Jobs created = "<<jobs_out<<std::endl;
 
   //Grid to hold returned jobs
   Job1Grid<T> jobs1(tiles.size(), std::vector< Job1<T> >(tiles[0].size()));
+  TraceScope trace_recv1("Wait for first round", "comm");
   while(jobs_out--){
     std::cerr<<"p Jobs remaining = "<<jobs_out<<std::endl;
     Job1<T> temp;
     CommRecv(&temp, nullptr, -1);
     jobs1.at(temp.gridy).at(temp.gridx) = temp;
   }
+  trace_recv1.end();
 
   std::cerr<<"n First stage Tx = "<<CommBytesSent()<<" B"<<std::endl;
   std::cerr<<"n First stage Rx = "<<CommBytesRecv()<<" B"<<std::endl;
@@ -741,14 +611,25 @@ void Producer(TileGrid &tiles){
   //Get timing info
   TimeInfo time_first_total;
   for(int y=0;y<gridheight;y++)
-  for(int x=0;x<gridwidth;x++)
-    time_first_total += jobs1[y][x].time_info;
+  for(int x=0;x<gridwidth;x++){
+    if(tiles[y][x].nullTile)
+      continue;
+    const auto &ti = jobs1[y][x].time_info;
+    time_first_total += ti;
+    Instrumentation::get().record("tiles", {
+      {"stage",1}, {"gridx",x}, {"gridy",y}, {"calc",ti.calc}, {"io",ti.io},
+      {"overall",ti.overall}, {"vmpeak",ti.vmpeak}, {"vmhwm",ti.vmhwm}
+    });
+  }
 
 
   ////////////////////////////////////////////////////////////
   //PRODUCER NODE PERFORMS PROCESSING ON ALL THE RETURNED DATA
 
-  producer.Calculations(tiles,jobs1);
+  {
+    TraceScope trace("Aggregation", "calc");
+    producer.Calculations(tiles,jobs1);
+  }
 
   ////////////////////////////////////////////////////////////
   //SEND OUT JOBS TO FINALIZE GLOBAL SOLUTION
@@ -757,6 +638,7 @@ void Producer(TileGrid &tiles){
   jobs_out = 0; 
   msgs     = std::vector<msg_type>();
 
+  TraceScope trace_send2("Send second-round jobs", "comm");
   for(int y=0;y<gridheight;y++)
   for(int x=0;x<gridwidth;x++){
     if(tiles[y][x].nullTile)
@@ -773,18 +655,36 @@ void Producer(TileGrid &tiles){
   //timing and memory statistics from the consumers.
   TimeInfo time_second_total;
 
+  trace_send2.end();
+  TraceScope trace_recv2("Wait for second round", "comm");
   while(jobs_out--){
     std::cerr<<"p Jobs left to receive = "<<jobs_out<<std::endl;
     TimeInfo temp;
     CommRecv(&temp, nullptr, -1);
     time_second_total += temp;
+    Instrumentation::get().record("tiles", {
+      {"stage",2}, {"calc",temp.calc}, {"io",temp.io}, {"overall",temp.overall},
+      {"vmpeak",temp.vmpeak}, {"vmhwm",temp.vmhwm}
+    });
   }
 
+  trace_recv2.end();
+
   //Send out a message to tell the consumers to politely quit. Their job is
-  //done.
-  for(int i=1;i<CommSize();i++){
-    int temp;
-    CommSend(&temp,nullptr,i,SYNC_MSG_KILL);
+  //done. The message also asks them for their trace events, if we want them.
+  const int send_trace = !trace_file.empty();
+  for(int i=1;i<CommSize();i++)
+    CommSend(&send_trace,nullptr,i,SYNC_MSG_KILL);
+
+  if(send_trace){
+    Trace::get().nameProcess(0, "Producer");
+    for(int i=1;i<CommSize();i++){
+      Trace::get().nameProcess(i, "Consumer "+std::to_string(i));
+      std::vector<TraceEvent> events;
+      CommRecv(&events, nullptr, -1);
+      Trace::get().merge(events);
+    }
+    Trace::get().writeJSON(trace_file);
   }
 
   timer_overall.stop();
@@ -807,10 +707,25 @@ void Producer(TileGrid &tiles){
   std::cerr<<"t Producer overall time = "<<timer_overall.accumulated()       <<" s"<<std::endl;
   std::cerr<<"t Producer calc time = "   <<producer.timer_calc.accumulated() <<" s"<<std::endl;
 
-  long vmpeak, vmhwm;
+  uint64_t vmpeak, vmhwm;
   ProcessMemUsage(vmpeak,vmhwm);
   std::cerr<<"r Producer's VmPeak = "   <<vmpeak <<std::endl;
   std::cerr<<"r Producer's VmHWM = "    <<vmhwm  <<std::endl;
+
+  auto &stats = Instrumentation::get();
+  stats.value("first_stage.overall",  time_first_total.overall);
+  stats.value("first_stage.io",       time_first_total.io);
+  stats.value("first_stage.calc",     time_first_total.calc);
+  stats.value("first_stage.vmpeak",   time_first_total.vmpeak);
+  stats.value("first_stage.vmhwm",    time_first_total.vmhwm);
+  stats.value("second_stage.overall", time_second_total.overall);
+  stats.value("second_stage.io",      time_second_total.io);
+  stats.value("second_stage.calc",    time_second_total.calc);
+  stats.value("second_stage.vmpeak",  time_second_total.vmpeak);
+  stats.value("second_stage.vmhwm",   time_second_total.vmhwm);
+  stats.value("producer.overall",     timer_overall.accumulated());
+  stats.value("producer.calc",        producer.timer_calc.accumulated());
+  stats.sampleMemory();
 }
 
 
@@ -830,11 +745,15 @@ void Preparer(
   int bheight,
   int flipH,
   int flipV,
-  std::string analysis
+  std::string analysis,
+  const std::string trace_file
 ){
   Timer timer_overall;
   timer_overall.start();
 
+  Trace::get().setProcess(0);
+  TraceScope trace_prep("Prepare tiles", "io");
+
   TileGrid tiles;
   std::string  filename;
   GDALDataType file_type;        //All tiles must have a common file_type
@@ -1064,6 +983,7 @@ void Preparer(
 
   CommBroadcast(&file_type,0);
   timer_overall.stop();
+  trace_prep.end();
   std::cerr<<"t Preparer time = "<<timer_overall.accumulated()<<" s"<<std::endl;
 
   std::cerr<<"c Flip horizontal = "<<((reptile->flip & FLIP_HORZ)?"YES":"NO")<<std::endl;
@@ -1072,19 +992,19 @@ void Preparer(
 
   switch(file_type){
     case GDT_Byte:
-      return Producer<uint8_t >(tiles);
+      return Producer<uint8_t >(tiles, trace_file);
     case GDT_UInt16:
-      return Producer<uint16_t>(tiles);
+      return Producer<uint16_t>(tiles, trace_file);
     case GDT_Int16:
-      return Producer<int16_t >(tiles);
+      return Producer<int16_t >(tiles, trace_file);
     case GDT_UInt32:
-      return Producer<uint32_t>(tiles);
+      return Producer<uint32_t>(tiles, trace_file);
     case GDT_Int32:
-      return Producer<int32_t >(tiles);
+      return Producer<int32_t >(tiles, trace_file);
     case GDT_Float32:
-      return Producer<float   >(tiles);
+      return Producer<float   >(tiles, trace_file);
     case GDT_Float64:
-      return Producer<double  >(tiles);
+      return Producer<double  >(tiles, trace_file);
     case GDT_CInt16:
     case GDT_CInt32:
     case GDT_CFloat32:
@@ -1108,6 +1028,7 @@ int main(int argc, char **argv){
     std::string retention;
     std::string input_file;
     std::string output_name;
+    std::string trace_file;
     int         bwidth    = -1;
     int         bheight   = -1;
     int         flipH     = false;
@@ -1149,6 +1070,12 @@ int main(int argc, char **argv){
           CommBroadcast(&good_to_go,0);
           CommFinalize();
           return -1;
+        } else if(strcmp(argv[i],"--trace")==0){
+          if(i+1==argc)
+            throw std::invalid_argument("--trace followed by no argument.");
+          trace_file = argv[i+1];
+          i++;
+          continue;
         } else if(strcmp(argv[i],"--flipH")==0 || strcmp(argv[i],"-H")==0){
           flipH = true;
         } else if(strcmp(argv[i],"--flipV")==0 || strcmp(argv[i],"-V")==0){
@@ -1188,7 +1115,7 @@ int main(int argc, char **argv){
       else
         output_err = ia.what();
 
-      std::cerr<<"parallel_pflood.exe [--flipV] [--flipH] [--bwidth #] [--bheight #] <many/one> <retention> <input> <output>"<<std::endl;
+      std::cerr<<"parallel_pflood.exe [--flipV] [--flipH] [--bwidth #] [--bheight #] [--trace <file>] <many/one> <retention> <input> <output>"<<std::endl;
       std::cerr<<"\tUse '--help' to show help."<<std::endl;
 
       std::cerr<<"E "<<output_err<<std::endl;
@@ -1208,9 +1135,10 @@ int main(int argc, char **argv){
     std::cerr<<"c Block height = "           <<bheight   <<std::endl;
     std::cerr<<"c Flip horizontal = "        <<flipH     <<std::endl;
     std::cerr<<"c Flip vertical = "          <<flipV     <<std::endl;
+    std::cerr<<"c Trace file = "             <<trace_file<<std::endl;
     std::cerr<<"c World Size = "             <<CommSize()<<std::endl;
     CommBroadcast(&good_to_go,0);
-    Preparer(many_or_one, retention, input_file, output_name, bwidth, bheight, flipH, flipV, analysis);
+    Preparer(many_or_one, retention, input_file, output_name, bwidth, bheight, flipH, flipV, analysis, trace_file);
 
     timer_master.stop();
     std::cerr<<"t Total wall-time = "<<timer_master.accumulated()<<" s"<<std::endl;
@@ -0,0 +1,233 @@
+//Joins the spillover graphs of the tiles of a DEM into a single graph and
+//floods it, as described in:
+//    Barnes, R., 2016. "Parallel priority-flood depression filling for trillion
+//    cell digital elevation models on desktops or clusters". Computers &
+//    Geosciences. doi:10.1016/j.cageo.2016.07.001
+//
+//This is shared by parallel_pflood.exe and ../tiled_priority_flood. Each tile
+//is described by a perimeter object with the members
+//
+//    std::vector<elev_t > top_elev,  bot_elev,  left_elev,  right_elev;
+//    std::vector<label_t> top_label, bot_label, left_label, right_label;
+//    std::vector< std::map<label_t, elev_t> > graph;
+//
+//where `graph` is the tile's spillover graph from Zhou2015Labels(). Label 1 is
+//the outside of the DEM and is shared by every tile; other labels are offset so
+//that each tile's are unique.
+#ifndef _parallel_pflood_mastergraph_hpp_
+#define _parallel_pflood_mastergraph_hpp_
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <limits>
+#include <map>
+#include <queue>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+template<class elev_t, class label_t> using Mastergraph = std::vector< std::map<label_t, elev_t> >;
+
+//Links the watersheds along the shared edge of two adjacent tiles
+template<class elev_t, class label_t>
+void HandleEdge(
+  const std::vector<elev_t>  &elev_a,
+  const std::vector<elev_t>  &elev_b,
+  const std::vector<label_t> &label_a,
+  const std::vector<label_t> &label_b,
+  Mastergraph<elev_t,label_t> &mastergraph,
+  const label_t label_a_offset,
+  const label_t label_b_offset
+){
+  //Guarantee that all vectors are of the same length
+  assert(elev_a.size ()==elev_b.size ());
+  assert(label_a.size()==label_b.size());
+  assert(elev_a.size ()==label_b.size());
+
+  int len = elev_a.size();
+
+  for(int i=0;i<len;i++){
+    auto c_l = label_a[i];
+    if(c_l>1) c_l+=label_a_offset;
+
+    for(int ni=i-1;ni<=i+1;ni++){
+      if(ni<0 || ni==len)
+        continue;
+      auto n_l = label_b[ni];
+      if(n_l>1) n_l+=label_b_offset;
+      //TODO: Does this really matter? We could just ignore these entries
+      if(c_l==n_l) //Only happens when labels are both 1
+        continue;
+
+      auto elev_over = std::max(elev_a[i],elev_b[ni]);
+      if(mastergraph.at(c_l).count(n_l)==0 || elev_over<mastergraph.at(c_l)[n_l]){
+        mastergraph[c_l][n_l] = elev_over;
+        mastergraph[n_l][c_l] = elev_over;
+      }
+    }
+  }
+}
+
+//Links the watersheds of the corner cells of two diagonally adjacent tiles
+template<class elev_t, class label_t>
+void HandleCorner(
+  const elev_t  elev_a,
+  const elev_t  elev_b,
+  label_t       l_a,
+  label_t       l_b,
+  Mastergraph<elev_t,label_t> &mastergraph,
+  const label_t l_a_offset,
+  const label_t l_b_offset
+){
+  if(l_a>1) l_a += l_a_offset;
+  if(l_b>1) l_b += l_b_offset;
+  auto elev_over = std::max(elev_a,elev_b);
+  if(mastergraph.at(l_a).count(l_b)==0 || elev_over<mastergraph.at(l_a)[l_b]){
+    mastergraph[l_a][l_b] = elev_over;
+    mastergraph[l_b][l_a] = elev_over;
+  }
+}
+
+//Merges the spillover graphs of the tiles in `perims` into one very big graph
+//and links the watersheds of adjacent tiles. `is_null(x,y)` is true for tiles
+//with no data. `set_labels(x,y,offset,increment)` is told the offset added to
+//tile (x,y)'s labels and the number of labels it has. Each tile's graph is
+//cleared as it is merged in order to save space.
+template<class Perim, class NullF, class LabelsF>
+auto ConstructMastergraph(
+  std::vector< std::vector<Perim> > &perims,
+  NullF   is_null,
+  LabelsF set_labels
+) -> typename std::remove_reference<decltype(perims[0][0].graph)>::type {
+  typedef typename std::remove_reference<decltype(perims[0][0].graph)>::type mastergraph_t;
+  typedef typename mastergraph_t::value_type::key_type                     label_t;
+
+  const int gridheight = perims.size();
+  const int gridwidth  = perims[0].size();
+
+  label_t maxlabel = 0;
+  for(int y=0;y<gridheight;y++)
+  for(int x=0;x<gridwidth;x++)
+    maxlabel += perims[y][x].graph.size();
+
+  mastergraph_t mastergraph(maxlabel);
+  std::vector< std::vector<label_t> > offsets(gridheight, std::vector<label_t>(gridwidth,0));
+
+  label_t label_offset = 0;
+  for(int y=0;y<gridheight;y++)
+  for(int x=0;x<gridwidth;x++){
+    if(is_null(x,y))
+      continue;
+
+    auto &this_perim = perims[y][x];
+
+    offsets[y][x] = label_offset;
+
+    for(int l=0;l<(int)this_perim.graph.size();l++)
+    for(auto const &skey: this_perim.graph[l]){
+      label_t first_label  = l;
+      label_t second_label = skey.first;
+      if(first_label >1) first_label +=label_offset;
+      if(second_label>1) second_label+=label_offset;
+      //We insert both ends of the bidirectional edge because in the watershed
+      //labeling process, we only inserted one. We need both here because we
+      //don't know which end of the edge we will approach from as we traverse
+      //the spillover graph.
+      mastergraph.at(first_label)[second_label] = skey.second;
+      mastergraph.at(second_label)[first_label] = skey.second;
+    }
+    set_labels(x,y,label_offset,(label_t)this_perim.graph.size());
+    label_offset += this_perim.graph.size();
+    this_perim.graph.clear();
+  }
+
+  for(int y=0;y<gridheight;y++)
+  for(int x=0;x<gridwidth;x++){
+    if(is_null(x,y))
+      continue;
+
+    auto &c = perims[y][x];
+
+    if(y>0            && !is_null(x,y-1))
+      HandleEdge(c.top_elev,   perims[y-1][x].bot_elev,   c.top_label,   perims[y-1][x].bot_label,   mastergraph, offsets[y][x], offsets[y-1][x]);
+    if(y<gridheight-1 && !is_null(x,y+1))
+      HandleEdge(c.bot_elev,   perims[y+1][x].top_elev,   c.bot_label,   perims[y+1][x].top_label,   mastergraph, offsets[y][x], offsets[y+1][x]);
+    if(x>0            && !is_null(x-1,y))
+      HandleEdge(c.left_elev,  perims[y][x-1].right_elev, c.left_label,  perims[y][x-1].right_label, mastergraph, offsets[y][x], offsets[y][x-1]);
+    if(x<gridwidth-1  && !is_null(x+1,y))
+      HandleEdge(c.right_elev, perims[y][x+1].left_elev,  c.right_label, perims[y][x+1].left_label,  mastergraph, offsets[y][x], offsets[y][x+1]);
+
+    //I wish I had wrote it all in LISP.
+    //Top left
+    if(y>0 && x>0                      && !is_null(x-1,y-1))
+      HandleCorner(c.top_elev.front(), perims[y-1][x-1].bot_elev.back(),  c.top_label.front(), perims[y-1][x-1].bot_label.back(),  mastergraph, offsets[y][x], offsets[y-1][x-1]);
+    //Bottom right
+    if(y<gridheight-1 && x<gridwidth-1 && !is_null(x+1,y+1))
+      HandleCorner(c.bot_elev.back(),  perims[y+1][x+1].top_elev.front(), c.bot_label.back(),  perims[y+1][x+1].top_label.front(), mastergraph, offsets[y][x], offsets[y+1][x+1]);
+    //Top right
+    if(y>0 && x<gridwidth-1            && !is_null(x+1,y-1))
+      HandleCorner(c.top_elev.back(),  perims[y-1][x+1].bot_elev.front(), c.top_label.back(),  perims[y-1][x+1].bot_label.front(), mastergraph, offsets[y][x], offsets[y-1][x+1]);
+    //Bottom left
+    if(x>0 && y<gridheight-1           && !is_null(x-1,y+1))
+      HandleCorner(c.bot_elev.front(), perims[y+1][x-1].top_elev.back(),  c.bot_label.front(), perims[y+1][x-1].top_label.back(),  mastergraph, offsets[y][x], offsets[y+1][x-1]);
+  }
+
+  return mastergraph;
+}
+
+//Performs a Priority-Flood on the mastergraph, starting from the outside of
+//the DEM (label 1). Returns the elevation to which each (offset) label must be
+//raised.
+template<class elev_t, class label_t>
+std::vector<elev_t> FloodMastergraph(const Mastergraph<elev_t,label_t> &mastergraph){
+  const label_t maxlabel = mastergraph.size();
+
+  typedef std::pair<elev_t, label_t>  graph_node;
+  std::priority_queue<graph_node, std::vector<graph_node>, std::greater<graph_node> > open;
+  std::queue<graph_node> pit;
+  std::vector<bool>   visited(maxlabel,false); //TODO
+  std::vector<elev_t> graph_elev(maxlabel);    //TODO
+
+  open.emplace(std::numeric_limits<elev_t>::lowest(),1);
+
+  while(open.size()>0 || pit.size()>0){
+    graph_node c;
+    if(pit.size()>0){
+      c = pit.front();
+      pit.pop();
+    } else {
+      c = open.top();
+      open.pop();
+    }
+
+    auto my_elev       = c.first;
+    auto my_vertex_num = c.second;
+    if(visited[my_vertex_num])
+      continue;
+
+    graph_elev[my_vertex_num] = my_elev;
+    visited   [my_vertex_num] = true;
+
+    for(auto &n: mastergraph[my_vertex_num]){
+      auto n_vertex_num = n.first;
+      auto n_elev       = n.second;
+      if(visited[n_vertex_num])
+        continue;
+      open.emplace(std::max(my_elev,n_elev),n_vertex_num);
+      //Turning on these lines activates the improved priority flood. It is
+      //disabled to make the algorithm easier to verify by inspection, and
+      //because it made little difference in the overall speed of the algorithm.
+
+      // if(n_elev<=my_elev){
+      //   pit.emplace(my_elev,n_vertex_num);
+      // } else {
+      //   open.emplace(n_elev,n_vertex_num);
+      // }
+    }
+  }
+
+  return graph_elev;
+}
+
+#endif
@@ -0,0 +1,235 @@
+//Out-of-core, single-machine version of the algorithm discussed in:
+//    Barnes, R., 2016. "Parallel priority-flood depression filling for trillion
+//    cell digital elevation models on desktops or clusters". Computers &
+//    Geosciences. doi:10.1016/j.cageo.2016.07.001
+//
+//Rather than distributing tiles to MPI consumers, tiles are managed by an
+//A2Array2D whose cache size bounds the amount of RAM used. Each tile is visited
+//exactly twice: once to label its watersheds and build its spillover graph and
+//once to raise its cells to the elevations found by the aggregated flood.
+//
+//The A2Array2D's cache is not safe to share between threads, so the tiles are
+//visited one at a time. Only the raising of a tile's cells uses several threads.
+#include "richdem/common/version.hpp"
+#include "richdem/common/Layoutfile.hpp"
+#include "richdem/common/Array2D.hpp"
+#include "richdem/common/constants.hpp"
+#include "richdem/common/memory.hpp"
+#include "richdem/common/timer.hpp"
+#include "richdem/tiled/A2Array2D.hpp"
+#include "../parallel_priority_flood/Zhou2016pf.hpp"
+#include "../parallel_priority_flood/mastergraph.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <queue>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+typedef uint32_t label_t;
+
+//Perimeter and spillover information gathered from each tile during the first
+//pass. This is the same information a consumer returns to the producer in
+//parallel_pflood.exe.
+template<class elev_t>
+class TilePerimeter {
+ public:
+  std::vector<elev_t > top_elev,  bot_elev,  left_elev,  right_elev;
+  std::vector<label_t> top_label, bot_label, left_label, right_label;
+  std::vector< std::map<label_t, elev_t> > graph;
+  label_t label_offset    = 0;
+  label_t label_increment = 0;
+  bool    null_tile       = true;
+};
+
+template<class elev_t> using PerimeterGrid = std::vector< std::vector< TilePerimeter<elev_t> > >;
+
+template<class T>
+void Master(std::string layoutfile, int cachesize, std::string tempfile_name, std::string output_filename, std::string flip_style){
+  Timer total_time;
+  Timer timer_first, timer_graph, timer_second, timer_save;
+  total_time.start();
+
+  std::string temp_dem_name = tempfile_name;
+  temp_dem_name.replace(temp_dem_name.find("%f"), 2, "%f-dem");
+  std::string temp_labels_name = tempfile_name;
+  temp_labels_name.replace(temp_labels_name.find("%f"), 2, "%f-labels");
+
+  A2Array2D<T> dem(layoutfile,cachesize);
+
+  if(flip_style=="fliph" || flip_style=="fliphv")
+    dem.flipH = true;
+  if(flip_style=="flipv" || flip_style=="fliphv")
+    dem.flipV = true;
+
+  //Partially-filled tiles are written to the cache, never to the inputs
+  dem.setCacheTemplate(temp_dem_name);
+
+  A2Array2D<label_t> labels(temp_labels_name,dem,cachesize);
+
+  const int gridheight = dem.heightInTiles();
+  const int gridwidth  = dem.widthInTiles();
+
+  PerimeterGrid<T> perims(gridheight, std::vector< TilePerimeter<T> >(gridwidth));
+
+  std::cerr<<"p Labeling watersheds of individual tiles..."<<std::endl;
+  timer_first.start();
+  for(int32_t ty=0;ty<gridheight;ty++)
+  for(int32_t tx=0;tx<gridwidth; tx++){
+    if(dem.isNullTile(tx,ty))
+      continue;
+
+    //Tiles next to null tiles drain to the outside of the DEM, just as tiles
+    //on the edge of the DEM do
+    uint8_t edge = 0;
+    if(ty==0            || dem.isNullTile(tx,ty-1)) edge |= GRID_TOP;
+    if(ty==gridheight-1 || dem.isNullTile(tx,ty+1)) edge |= GRID_BOTTOM;
+    if(tx==0            || dem.isNullTile(tx-1,ty)) edge |= GRID_LEFT;
+    if(tx==gridwidth-1  || dem.isNullTile(tx+1,ty)) edge |= GRID_RIGHT;
+
+    auto &dem_tile   = dem.getTile(tx,ty);
+    auto &label_tile = labels.getTile(tx,ty);
+    auto &perim      = perims[ty][tx];
+
+    //The upper limit on unique watersheds is the number of edge cells.
+    //Zhou2015Labels shrinks the graph to the number actually needed.
+    perim.graph.resize(2*dem_tile.width()+2*dem_tile.height());
+
+    //Tiles have already been reoriented in RAM by the A2Array2D, so there is
+    //no flipping for Zhou2015Labels to account for.
+    Zhou2015Labels(dem_tile, label_tile, perim.graph, edge, false, false);
+
+    perim.null_tile   = false;
+    perim.top_elev    = dem_tile.topRow     ();
+    perim.bot_elev    = dem_tile.bottomRow  ();
+    perim.left_elev   = dem_tile.leftColumn ();
+    perim.right_elev  = dem_tile.rightColumn();
+    perim.top_label   = label_tile.topRow     ();
+    perim.bot_label   = label_tile.bottomRow  ();
+    perim.left_label  = label_tile.leftColumn ();
+    perim.right_label = label_tile.rightColumn();
+  }
+  timer_first.stop();
+
+  std::cerr<<"p Performing aggregated priority flood..."<<std::endl;
+  timer_graph.start();
+  auto mastergraph = ConstructMastergraph(
+    perims,
+    [&](const int x, const int y){ return perims[y][x].null_tile; },
+    [&](const int x, const int y, const label_t offset, const label_t increment){
+      perims[y][x].label_offset    = offset;
+      perims[y][x].label_increment = increment;
+    }
+  );
+  std::cerr<<"m Total labels required = "<<mastergraph.size()<<std::endl;
+
+  //The perimeters are no longer needed
+  for(auto &row: perims)
+  for(auto &p: row){
+    p.top_elev.clear();  p.bot_elev.clear();  p.left_elev.clear();  p.right_elev.clear();
+    p.top_label.clear(); p.bot_label.clear(); p.left_label.clear(); p.right_label.clear();
+  }
+
+  auto graph_elev = FloodMastergraph(mastergraph);
+  mastergraph.clear();
+  timer_graph.stop();
+
+  std::cerr<<"p Raising tiles to their spill elevations..."<<std::endl;
+  timer_second.start();
+  for(int32_t ty=0;ty<gridheight;ty++)
+  for(int32_t tx=0;tx<gridwidth; tx++){
+    if(dem.isNullTile(tx,ty))
+      continue;
+
+    auto &dem_tile     = dem.getTile(tx,ty);
+    auto &label_tile   = labels.getTile(tx,ty);
+    const auto &perim  = perims[ty][tx];
+    const auto *offset = graph_elev.data()+perim.label_offset;
+
+    #pragma omp parallel for
+    for(int32_t y=0;y<dem_tile.height();y++)
+    for(int32_t x=0;x<dem_tile.width();x++){
+      const auto label = label_tile(x,y);
+      if(label>1 && dem_tile(x,y)<offset[label])
+        dem_tile(x,y) = offset[label];
+    }
+  }
+  timer_second.stop();
+
+  std::cerr<<"p Saving results..."<<std::endl;
+  timer_save.start();
+  dem.saveGDAL(output_filename);
+  timer_save.stop();
+
+  total_time.stop();
+
+  uint64_t vmpeak, vmhwm;
+  ProcessMemUsage(vmpeak,vmhwm);
+
+  std::cerr<<"t First pass = "       <<timer_first.accumulated() <<" s"<<std::endl;
+  std::cerr<<"t Mastergraph = "      <<timer_graph.accumulated() <<" s"<<std::endl;
+  std::cerr<<"t Second pass = "      <<timer_second.accumulated()<<" s"<<std::endl;
+  std::cerr<<"t Save = "             <<timer_save.accumulated()  <<" s"<<std::endl;
+  std::cerr<<"t Total time = "       <<total_time.accumulated()<<" s ("<<(total_time.accumulated()/3600)<<"hr)"<<std::endl;
+  std::cerr<<"m dem evictions = "    <<dem.getEvictions()   <<std::endl;
+  std::cerr<<"m labels evictions = " <<labels.getEvictions()<<std::endl;
+  std::cerr<<"m VmPeak = "           <<vmpeak<<std::endl;
+  std::cerr<<"m VmHWM = "            <<vmhwm <<std::endl;
+}
+
+int main(int argc, char **argv){
+  std::string analysis = PrintRichdemHeader(argc,argv);
+  std::cerr<<"A Tiled Priority-Flood (Out-of-Core)"<<std::endl;
+  std::cerr<<"C Barnes, R., 2016. \"Parallel priority-flood depression filling for trillion cell digital elevation models on desktops or clusters\". Computers & Geosciences. doi:10.1016/j.cageo.2016.07.001"<<std::endl;
+  if(argc!=6){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Layout File> <Cache size> <Temp Files> <Output Files> <noflip/fliph/flipv/fliphv>"<<std::endl;
+    std::cerr<<"\tor use 'table' for cache size"<<std::endl;
+    std::cerr<<"\t<Temp Files> and <Output Files> must contain '%f', which is replaced by each tile's basename"<<std::endl;
+    return -1;
+  }
+  auto file_type         = peekLayoutType(argv[1]);
+  std::string flip_style = argv[5];
+
+  if(argv[2]==std::string("table")){
+    long dtype_size = GDALGetDataTypeSizeBytes(file_type);
+    long tile_size  = peekLayoutTileSize(argv[1]);
+    for(int i=2;i<500;i++)
+      std::cerr<<std::setw(2)<<i<<"  "<<((dtype_size+sizeof(label_t))*tile_size*i/1000000.0)<<" MB"<<std::endl;
+    return -1;
+  }
+
+  int cachesize = std::stoi(argv[2]);
+  std::string tempfile_name(argv[3]);
+  std::string output_filename(argv[4]);
+
+  if(tempfile_name.find("%f")==std::string::npos || output_filename.find("%f")==std::string::npos){
+    std::cerr<<"<Temp Files> and <Output Files> must both contain '%f'!"<<std::endl;
+    return -1;
+  }
+
+  switch(file_type){
+    case GDT_Byte:
+      Master<uint8_t >(argv[1],cachesize,tempfile_name,output_filename,flip_style);break;
+    case GDT_UInt16:
+      Master<uint16_t>(argv[1],cachesize,tempfile_name,output_filename,flip_style);break;
+    case GDT_Int16:
+      Master<int16_t >(argv[1],cachesize,tempfile_name,output_filename,flip_style);break;
+    case GDT_UInt32:
+      Master<uint32_t>(argv[1],cachesize,tempfile_name,output_filename,flip_style);break;
+    case GDT_Int32:
+      Master<int32_t >(argv[1],cachesize,tempfile_name,output_filename,flip_style);break;
+    case GDT_Float32:
+      Master<float   >(argv[1],cachesize,tempfile_name,output_filename,flip_style);break;
+    case GDT_Float64:
+      Master<double  >(argv[1],cachesize,tempfile_name,output_filename,flip_style);break;
+    default:
+      std::cerr<<"Unrecognised data type!"<<std::endl;
+      return -1;
+  }
+
+  return 0;
+}
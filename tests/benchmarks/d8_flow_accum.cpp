@@ -0,0 +1,109 @@
+//Compares D8 flow accumulation using the FIFO queue of d8_flow_accum() against
+//the topological-order engines on flow directions derived from a synthetic
+//DEM. Run under `perf stat -e cache-misses,cache-references` to compare memory
+//traffic.
+#include "../terrain_gen/PerlinNoise.h"
+#include "richdem/common/Array2D.hpp"
+#include "richdem/common/memory.hpp"
+#include "richdem/common/timer.hpp"
+#include "richdem/common/version.hpp"
+#include "richdem/depressions/priority_flood.hpp"
+#include "richdem/methods/d8_methods.hpp"
+#include "richdem/methods/flow_proportions.hpp"
+#include <iostream>
+#include <string>
+#include <vector>
+
+int main(int argc, char **argv){
+  PrintRichdemHeader(argc,argv);
+
+  if(argc!=4){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Size> <Repetitions> <all/queue/topo/ordered/props>"<<std::endl;
+    return -1;
+  }
+
+  const int         tsize  = std::stoi(argv[1]);
+  const int         reps   = std::stoi(argv[2]);
+  const std::string engine = argv[3];
+
+  Array2D<d8_flowdir_t> fds;
+  {
+    PerlinNoise pn;
+    Array2D<float> dem(tsize,tsize);
+    for(int y=0;y<tsize;y++)
+    for(int x=0;x<tsize;x++)
+      dem(x,y) = pn.noise(10*x/(double)tsize,10*y/(double)tsize,0.8);
+    priority_flood_flowdirs(dem,fds);
+  }
+
+  Array2D<int32_t> ref, area;
+  Timer timer_queue, timer_topo, timer_order, timer_ordered, timer_build, timer_props;
+  bool same = true;
+
+  const auto check = [&](){
+    if(!ref.empty() && !(area==ref))
+      same = false;
+  };
+
+  if(engine=="all" || engine=="queue")
+    for(int r=0;r<reps;r++){
+      timer_queue.start();
+      d8_flow_accum(fds,ref);
+      timer_queue.stop();
+    }
+
+  if(engine=="all" || engine=="topo")
+    for(int r=0;r<reps;r++){
+      timer_topo.start();
+      d8_flow_accum_topological(fds,area);
+      timer_topo.stop();
+      check();
+    }
+
+  if(engine=="all" || engine=="ordered"){
+    std::vector<Array2D<d8_flowdir_t>::i_t> order;
+    timer_order.start();
+    d8_topological_order(fds,order);
+    timer_order.stop();
+    for(int r=0;r<reps;r++){
+      timer_ordered.start();
+      d8_flow_accum_ordered(fds,order,area);
+      timer_ordered.stop();
+      check();
+    }
+  }
+
+  if(engine=="all" || engine=="props"){
+    FlowProportions props;
+    timer_build.start();
+    FP_D8Flowdirs(fds,props);
+    timer_build.stop();
+    for(int r=0;r<reps;r++){
+      timer_props.start();
+      props.accumulate(area);
+      timer_props.stop();
+      check();
+    }
+  }
+
+  uint64_t vmpeak, vmhwm;
+  ProcessMemUsage(vmpeak,vmhwm);
+
+  const double cells = (double)fds.size()*reps;
+  const auto report = [&](const std::string &name, Timer &timer){
+    if(timer.accumulated()>0)
+      std::cout<<name<<timer.accumulated()<<" s ("<<(cells/timer.accumulated())<<" cells/s)"<<std::endl;
+  };
+
+  report("FIFO queue:                 ",timer_queue);
+  report("Topological:                ",timer_topo);
+  report("Ordered, reusing the order: ",timer_ordered);
+  report("FlowProportions:            ",timer_props);
+  std::cout<<"Order calculation:          "<<timer_order.accumulated()<<" s"<<std::endl;
+  std::cout<<"FlowProportions build:      "<<timer_build.accumulated()<<" s"<<std::endl;
+  std::cout<<"Peak RSS:                   "<<vmhwm<<" kB"<<std::endl;
+  if(engine=="all")
+    std::cout<<"Results identical:          "<<(same?"yes":"NO")<<std::endl;
+
+  return same?0:-1;
+}
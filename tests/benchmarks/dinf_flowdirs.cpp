@@ -0,0 +1,76 @@
+//Compares the row-wise D-infinite evaluator against calling dinf_FlowDir() on
+//each cell, as dinf_flow_directions() used to do, on a synthetic float DEM.
+#include "../terrain_gen/PerlinNoise.h"
+#include "richdem/common/Array2D.hpp"
+#include "richdem/common/timer.hpp"
+#include "richdem/common/version.hpp"
+#include "richdem/flowdirs/dinf_flowdirs.hpp"
+#include <cmath>
+#include <iostream>
+#include <string>
+
+template<class T>
+void dinf_flow_directions_cellwise(const Array2D<T> &elevations, Array2D<float> &flowdirs){
+  flowdirs.resize(elevations);
+  flowdirs.setNoData(dinf_NO_DATA);
+  #pragma omp parallel for
+  for(int y=0;y<elevations.height();y++)
+  for(int x=0;x<elevations.width();x++)
+    if(elevations(x,y)==elevations.noData())
+      flowdirs(x,y) = flowdirs.noData();
+    else
+      flowdirs(x,y) = dinf_FlowDir(elevations,x,y);
+}
+
+double MaxDifference(const Array2D<float> &a, const Array2D<float> &b){
+  double maxdiff = 0;
+  for(int y=0;y<a.height();y++)
+  for(int x=0;x<a.width();x++)
+    maxdiff = std::max(maxdiff, (double)std::abs(a(x,y)-b(x,y)));
+  return maxdiff;
+}
+
+int main(int argc, char **argv){
+  PrintRichdemHeader(argc,argv);
+
+  if(argc!=3){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Size> <Repetitions>"<<std::endl;
+    return -1;
+  }
+
+  const int tsize = std::stoi(argv[1]);
+  const int reps  = std::stoi(argv[2]);
+
+  PerlinNoise pn;
+  Array2D<float> dem(tsize,tsize);
+  for(int y=0;y<tsize;y++)
+  for(int x=0;x<tsize;x++)
+    dem(x,y) = pn.noise(10*x/(double)tsize,10*y/(double)tsize,0.8);
+
+  Array2D<float> ref, exact, approx;
+  Timer timer_ref, timer_exact, timer_approx;
+
+  for(int r=0;r<reps;r++){
+    timer_ref.start();
+    dinf_flow_directions_cellwise(dem,ref);
+    timer_ref.stop();
+
+    timer_exact.start();
+    dinf_flow_directions(dem,exact,DINF_ANGLE_EXACT);
+    timer_exact.stop();
+
+    timer_approx.start();
+    dinf_flow_directions(dem,approx,DINF_ANGLE_APPROX);
+    timer_approx.stop();
+  }
+
+  const double cells = (double)dem.size()*reps;
+
+  std::cout<<"Cellwise:       "<<timer_ref.accumulated()   <<" s ("<<(cells/timer_ref.accumulated()   )<<" cells/s)"<<std::endl;
+  std::cout<<"Rowwise exact:  "<<timer_exact.accumulated() <<" s ("<<(cells/timer_exact.accumulated() )<<" cells/s)"<<std::endl;
+  std::cout<<"Rowwise approx: "<<timer_approx.accumulated()<<" s ("<<(cells/timer_approx.accumulated())<<" cells/s)"<<std::endl;
+  std::cout<<"Max difference, exact:  "<<MaxDifference(ref,exact) <<" rad"<<std::endl;
+  std::cout<<"Max difference, approx: "<<MaxDifference(ref,approx)<<" rad"<<std::endl;
+
+  return 0;
+}
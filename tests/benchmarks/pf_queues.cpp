@@ -0,0 +1,177 @@
+//Compares priority queues for the Priority-Flood open set. The pushes and pops
+//made by original_priority_flood() and improved_priority_flood() on a DEM are
+//recorded and then replayed against each queue, so that every queue sees
+//exactly the same work. The fills are also timed end-to-end with each queue, as
+//is priority_flood_flowdirs() with the queues which keep ties in FIFO order.
+#include "../terrain_gen/PerlinNoise.h"
+#include "richdem/common/Array2D.hpp"
+#include "richdem/common/priority_queues.hpp"
+#include "richdem/common/timer.hpp"
+#include "richdem/common/version.hpp"
+#include "richdem/depressions/priority_flood.hpp"
+#include <cstdint>
+#include <iomanip>
+#include <iostream>
+#include <string>
+#include <vector>
+
+typedef float elev_t;
+
+//A push of (x,y,z) or, if x is -1, a pop
+struct QueueOp {
+  int32_t x, y;
+  elev_t  z;
+};
+
+//The default queue, but every push and pop is written to `trace`
+template<class T>
+class RecordingQueue : public GridCellZ_pq<T> {
+ public:
+  static std::vector<QueueOp> trace;
+  void emplace(const int x, const int y, const T z){
+    trace.push_back(QueueOp{x,y,z});
+    GridCellZ_pq<T>::emplace(x,y,z);
+  }
+  void pop(){
+    trace.push_back(QueueOp{-1,-1,0});
+    GridCellZ_pq<T>::pop();
+  }
+};
+
+template<class T>
+std::vector<QueueOp> RecordingQueue<T>::trace;
+
+//Replay a trace `reps` times. Returns the time taken and, in `checksum`, the
+//sum of the elevations popped, which is the same for any correct queue.
+template<template<class> class Queue>
+double Replay(const std::vector<QueueOp> &trace, const int reps, double &checksum){
+  Timer timer;
+  checksum = 0;
+  for(int r=0;r<reps;r++){
+    Queue<elev_t> q;
+    double sum = 0;
+    timer.start();
+    for(const auto &op: trace){
+      if(op.x==-1){
+        sum += q.top().z;
+        q.pop();
+      } else {
+        q.emplace(op.x,op.y,op.z);
+      }
+    }
+    timer.stop();
+    checksum = sum;
+  }
+  return timer.accumulated()/reps;
+}
+
+template<template<class> class Queue>
+double Fill(const Array2D<elev_t> &dem, const int reps, bool &same, const Array2D<elev_t> &expected){
+  Timer timer;
+  for(int r=0;r<reps;r++){
+    auto filled = dem;
+    timer.start();
+    improved_priority_flood<Queue>(filled);
+    timer.stop();
+    if(!(filled==expected))
+      same = false;
+  }
+  return timer.accumulated()/reps;
+}
+
+//The first queue timed sets `expected`; the rest are compared against it
+template<template<class> class Queue>
+double FlowDirs(const Array2D<elev_t> &dem, const int reps, bool &same, Array2D<d8_flowdir_t> &expected){
+  Timer timer;
+  for(int r=0;r<reps;r++){
+    Array2D<d8_flowdir_t> flowdirs;
+    timer.start();
+    priority_flood_flowdirs<Queue>(dem,flowdirs);
+    timer.stop();
+    if(expected.empty())
+      expected = flowdirs;
+    else if(!(flowdirs==expected))
+      same = false;
+  }
+  return timer.accumulated()/reps;
+}
+
+int main(int argc, char **argv){
+  PrintRichdemHeader(argc,argv);
+
+  if(argc!=3){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Input DEM or Perlin size> <Repetitions>"<<std::endl;
+    return -1;
+  }
+
+  const int reps = std::stoi(argv[2]);
+
+  Array2D<elev_t> dem;
+  const std::string input = argv[1];
+  if(input.find_first_not_of("0123456789")==std::string::npos){
+    const int tsize = std::stoi(input);
+    PerlinNoise pn;
+    dem = Array2D<elev_t>(tsize,tsize);
+    for(int y=0;y<tsize;y++)
+    for(int x=0;x<tsize;x++)
+      dem(x,y) = pn.noise(10*x/(double)tsize,10*y/(double)tsize,0.8);
+  } else {
+    dem = Array2D<elev_t>(input,false);
+  }
+
+  std::vector< std::pair<std::string, std::vector<QueueOp> > > traces;
+  {
+    auto filled = dem;
+    RecordingQueue<elev_t>::trace.clear();
+    original_priority_flood<RecordingQueue>(filled);
+    traces.emplace_back("original", std::move(RecordingQueue<elev_t>::trace));
+  }
+  Array2D<elev_t> expected = dem;
+  {
+    RecordingQueue<elev_t>::trace.clear();
+    improved_priority_flood<RecordingQueue>(expected);
+    traces.emplace_back("improved", std::move(RecordingQueue<elev_t>::trace));
+  }
+
+  bool same = true;
+  std::cout<<std::fixed<<std::setprecision(4);
+
+  for(const auto &t: traces){
+    std::cout<<"\nTrace from "<<t.first<<"_priority_flood(): "<<t.second.size()<<" operations"<<std::endl;
+    double ref_sum, sum;
+    const auto report = [&](const std::string &name, const double time){
+      std::cout<<"  "<<std::left<<std::setw(24)<<name<<time<<" s ("<<(t.second.size()/time/1e6)<<" Mops/s)"<<std::endl;
+      if(sum!=ref_sum)
+        same = false;
+    };
+    double time = Replay<GridCellZ_pq>(t.second,reps,ref_sum); sum = ref_sum;
+    report("std::priority_queue",time);
+    time = Replay<BinaryHeapQueue    >(t.second,reps,sum); report("Binary heap",   time);
+    time = Replay<QuaternaryHeapQueue>(t.second,reps,sum); report("4-ary heap",    time);
+    time = Replay<PairingHeapQueue   >(t.second,reps,sum); report("Pairing heap",  time);
+    time = Replay<RadixHeapQueue     >(t.second,reps,sum); report("Radix heap",    time);
+    time = Replay<BucketQueue        >(t.second,reps,sum); report("Bucket queue",  time);
+    time = Replay<GridCellZk_pq      >(t.second,reps,sum); report("GridCellZk_pq", time);
+    time = Replay<StableBucketQueue  >(t.second,reps,sum); report("Stable buckets",time);
+  }
+
+  std::cout<<"\nimproved_priority_flood() end-to-end:"<<std::endl;
+  const auto report = [&](const std::string &name, const double time){
+    std::cout<<"  "<<std::left<<std::setw(24)<<name<<time<<" s"<<std::endl;
+  };
+  report("std::priority_queue", Fill<GridCellZ_pq       >(dem,reps,same,expected));
+  report("Binary heap",         Fill<BinaryHeapQueue    >(dem,reps,same,expected));
+  report("4-ary heap",          Fill<QuaternaryHeapQueue>(dem,reps,same,expected));
+  report("Pairing heap",        Fill<PairingHeapQueue   >(dem,reps,same,expected));
+  report("Radix heap",          Fill<RadixHeapQueue     >(dem,reps,same,expected));
+  report("Bucket queue",        Fill<BucketQueue        >(dem,reps,same,expected));
+
+  std::cout<<"\npriority_flood_flowdirs() end-to-end:"<<std::endl;
+  Array2D<d8_flowdir_t> fd_expected;
+  report("GridCellZk_pq",  FlowDirs<GridCellZk_pq    >(dem,reps,same,fd_expected));
+  report("Stable buckets", FlowDirs<StableBucketQueue>(dem,reps,same,fd_expected));
+
+  std::cout<<"\nResults identical: "<<(same?"yes":"NO")<<std::endl;
+
+  return same?0:-1;
+}
@@ -0,0 +1,216 @@
+//Times RichDEM's depression-filling, flow direction, flat resolution, and flow
+//accumulation algorithms on Perlin-noise DEMs of several sizes and roughnesses,
+//plus any DEMs given on the command line, and appends one row per run to a CSV
+//so that performance can be tracked from commit to commit.
+#include "../terrain_gen/PerlinNoise.h"
+#include "richdem/common/Array2D.hpp"
+#include "richdem/common/memory.hpp"
+#include "richdem/common/timer.hpp"
+#include "richdem/common/version.hpp"
+#include "richdem/depressions/Lindsay2016.hpp"
+#include "richdem/depressions/Zhou2016pf.hpp"
+#include "richdem/depressions/priority_flood.hpp"
+#include "richdem/flats/flat_resolution.hpp"
+#include "richdem/flowdirs/d8_flowdirs.hpp"
+#include "richdem/flowdirs/dinf_flowdirs.hpp"
+#include "richdem/methods/d8_methods.hpp"
+#include "richdem/methods/dall_methods.hpp"
+#include <cstdint>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <vector>
+
+//Roughness of the synthetic terrain. Rougher terrain has more octaves of noise
+//and, therefore, more and smaller depressions and flats.
+struct Roughness {
+  std::string name;
+  int         octaves;
+};
+
+const std::vector<Roughness> roughnesses = {
+  {"smooth",   1},
+  {"moderate", 4},
+  {"rough",    8}
+};
+
+//Fractal Perlin noise. The reference permutation is used so that the same
+//terrain is produced on every run.
+Array2D<float> MakeTerrain(const int tsize, const int octaves){
+  PerlinNoise pn;
+  Array2D<float> dem(tsize,tsize);
+  #pragma omp parallel for collapse(2)
+  for(int y=0;y<tsize;y++)
+  for(int x=0;x<tsize;x++){
+    double freq = 10.0/tsize;
+    double amp  = 1;
+    double val  = 0;
+    for(int o=0;o<octaves;o++){
+      val  += amp*pn.noise(freq*x,freq*y,0.8);
+      freq *= 2;
+      amp  /= 2;
+    }
+    dem(x,y) = 1000*val;
+  }
+  return dem;
+}
+
+class Suite {
+ private:
+  std::ofstream csv;
+
+ public:
+  Suite(const std::string &filename){
+    std::ifstream fin(filename);
+    const bool exists = fin.good() && fin.peek()!=std::ifstream::traits_type::eof();
+    fin.close();
+
+    csv.open(filename, std::ios::app);
+    if(!csv.good())
+      throw std::runtime_error("Could not open '"+filename+"' for writing!");
+    if(!exists)
+      csv<<"git_hash,dem,width,height,data_cells,algorithm,wall_s,cells_per_s,peak_rss_kb,threads"<<std::endl;
+  }
+
+  //Runs `alg` once and records how long it took and how much memory it
+  //needed. Inputs should be prepared beforehand so they are not timed.
+  void run(
+    const std::string &dem_name,
+    const Array2D<float> &dem,
+    const std::string &algorithm,
+    std::function<void()> alg
+  ){
+    ResetPeakMemUsage();
+
+    Timer timer;
+    timer.start();
+    alg();
+    timer.stop();
+
+    uint64_t vmpeak, vmhwm;
+    ProcessMemUsage(vmpeak,vmhwm);
+
+    const double cells = dem.numDataCells();
+    std::cerr<<"t "<<dem_name<<" "<<algorithm<<" = "<<timer.accumulated()<<" s"<<std::endl;
+    csv<<git_hash                          <<","
+       <<dem_name                          <<","
+       <<dem.width()                       <<","
+       <<dem.height()                      <<","
+       <<(uint64_t)cells                   <<","
+       <<algorithm                         <<","
+       <<timer.accumulated()               <<","
+       <<(cells/timer.accumulated())       <<","
+       <<vmhwm                             <<","
+       <<omp_get_max_threads()             <<std::endl;
+  }
+
+  void runAll(const std::string &dem_name, const Array2D<float> &dem){
+    Array2D<float> work;
+
+    //Depression filling. Each algorithm gets a fresh copy of the DEM.
+    const auto fill = [&](const std::string &name, std::function<void(Array2D<float>&)> f){
+      work = dem;
+      run(dem_name, dem, name, [&](){ f(work); });
+    };
+
+    fill("original_priority_flood", [](Array2D<float> &d){ original_priority_flood(d); });
+    fill("improved_priority_flood", [](Array2D<float> &d){ improved_priority_flood(d); });
+    fill("priority_flood_epsilon",  [](Array2D<float> &d){ priority_flood_epsilon (d); });
+    fill("priority_flood_epsilon_steps", [](Array2D<float> &d){ priority_flood_epsilon_steps(d); });
+    fill("Zhou2016",                [](Array2D<float> &d){ Zhou2016               (d); });
+    fill("Lindsay2016", [](Array2D<float> &d){
+      Lindsay2016(d, COMPLETE_BREACHING, false, std::numeric_limits<uint32_t>::max(), std::numeric_limits<float>::max());
+    });
+    fill("Lindsay2016Parallel",     [](Array2D<float> &d){ Lindsay2016Parallel    (d); });
+
+    //The remaining algorithms need a DEM without depressions. The plain fill
+    //leaves flats for flat resolution to work on; the epsilon fill drains
+    //everywhere, which the flow metrics need.
+    Array2D<float> filled = dem;
+    improved_priority_flood(filled);
+    Array2D<float> eps_filled = dem;
+    priority_flood_epsilon(eps_filled);
+
+    Array2D<d8_flowdir_t> flowdirs;
+    run(dem_name, dem, "d8_flow_directions",    [&](){ d8_flow_directions(filled,flowdirs); });
+    {
+      Array2D<float> dinf;
+      run(dem_name, dem, "dinf_flow_directions", [&](){ dinf_flow_directions(filled,dinf); });
+    }
+    {
+      Array2D<d8_flowdir_t> pf_flowdirs;
+      run(dem_name, dem, "priority_flood_flowdirs", [&](){ priority_flood_flowdirs(dem,pf_flowdirs); });
+      run(dem_name, dem, "parallel_priority_flood_flowdirs", [&](){ parallel_priority_flood_flowdirs(dem,pf_flowdirs); });
+    }
+    {
+      Array2D<int32_t> flat_mask, labels;
+      run(dem_name, dem, "resolve_flats_barnes", [&](){ resolve_flats_barnes(filled,flowdirs,flat_mask,labels); });
+    }
+
+    {
+      Array2D<d8_flowdir_t> eps_flowdirs;
+      d8_flow_directions(eps_filled,eps_flowdirs);
+      Array2D<int32_t> area;
+      run(dem_name, dem, "d8_flow_accum", [&](){ d8_flow_accum(eps_flowdirs,area); });
+    }
+
+    //Flow accumulation by each of the flow metrics
+    Array2D<double> accum;
+    const auto fa = [&](const std::string &name, std::function<void()> f){
+      accum = Array2D<double>(eps_filled,0);
+      run(dem_name, dem, name, f);
+    };
+
+    fa("FA_FairfieldLeymarie", [&](){ FA_FairfieldLeymarie(eps_filled,accum);           });
+    fa("FA_Rho8",              [&](){ FA_Rho8             (eps_filled,accum);           });
+    fa("FA_Quinn",             [&](){ FA_Quinn            (eps_filled,accum);           });
+    fa("FA_Holmgren",          [&](){ FA_Holmgren         (eps_filled,accum,4.0);       });
+    fa("FA_Freeman",           [&](){ FA_Freeman          (eps_filled,accum,1.1);       });
+    fa("FA_Tarboton",          [&](){ FA_Tarboton         (eps_filled,accum);           });
+    fa("FA_SeibertMcGlynn",    [&](){ FA_SeibertMcGlynn   (eps_filled,accum,4.0);       });
+    fa("FA_Orlandini_LAD",     [&](){ FA_Orlandini        (eps_filled,accum,LAD,1.0);   });
+    fa("FA_Orlandini_LTD",     [&](){ FA_Orlandini        (eps_filled,accum,LTD,1.0);   });
+    fa("FA_OCallaghan",        [&](){ FA_OCallaghan       (eps_filled,accum);           });
+  }
+};
+
+int main(int argc, char **argv){
+  PrintRichdemHeader(argc,argv);
+
+  if(argc<3){
+    std::cerr<<"Syntax: "<<argv[0]<<" <Output CSV> <Sizes, e.g. 500,1000,2000> [DEM files...]"<<std::endl;
+    return -1;
+  }
+
+  std::vector<int> sizes;
+  {
+    std::stringstream ss(argv[2]);
+    std::string size;
+    while(std::getline(ss,size,','))
+      sizes.push_back(std::stoi(size));
+  }
+
+  if(!ResetPeakMemUsage())
+    std::cerr<<"W Could not reset the peak RSS between runs: peak_rss_kb will be the peak of the whole process so far!"<<std::endl;
+
+  Suite suite(argv[1]);
+
+  for(const auto tsize: sizes)
+  for(const auto &r: roughnesses){
+    const std::string name = "perlin_"+r.name+"_"+std::to_string(tsize);
+    std::cerr<<"\nm Generating "<<name<<std::endl;
+    const auto dem = MakeTerrain(tsize,r.octaves);
+    suite.runAll(name,dem);
+  }
+
+  for(int i=3;i<argc;i++){
+    std::cerr<<"\nm Loading "<<argv[i]<<std::endl;
+    const Array2D<float> dem(argv[i],false);
+    suite.runAll(argv[i],dem);
+  }
+
+  return 0;
+}
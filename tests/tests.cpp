@@ -3,11 +3,20 @@
 #include "richdem/common/Array2D.hpp"
 
 #include "richdem/methods/d8_methods.hpp"
+#include "richdem/methods/dinf_methods.hpp"
+#include "richdem/flowdirs/d8_flowdirs.hpp"
+#include "richdem/flowdirs/dinf_flowdirs.hpp"
+#include "richdem/methods/flow_proportions.hpp"
 #include "richdem/common/grid_cell.hpp"
+#include "richdem/common/index_stream.hpp"
+#include "richdem/depressions/depression_hierarchy.hpp"
+#include "richdem/depressions/Lindsay2016.hpp"
 #include "richdem/depressions/Zhou2016pf.hpp"
 #include "richdem/depressions/priority_flood.hpp"
 
 #include <experimental/filesystem>
+#include <random>
+#include <set>
 
 namespace fs = std::experimental::filesystem;
 
@@ -96,6 +105,248 @@ TEST_CASE("Checking flow accumulation", "[FlowAcc]") {
 
 
 
+TEST_CASE("Checking weighted flow accumulation", "[FlowAcc]") {
+  Array2D<float> elevations(19,13,0);
+  elevations.setNoData(-9999);
+  for(int y=0;y<elevations.height();y++)
+  for(int x=0;x<elevations.width();x++)
+    elevations(x,y) = ((x*5+y*11)%17==0)?-9999:(x-9)*(x-9)+(y-6)*(y-6)+(x*y)%3;
+
+  Array2D<double> weights(elevations,0), retention(elevations,0), ones(elevations,1);
+  for(int y=0;y<weights.height();y++)
+  for(int x=0;x<weights.width();x++){
+    weights(x,y)   = 1+(x+y)%4;
+    retention(x,y) = ((x*y)%5)/10.0;
+  }
+
+  SECTION("D8"){
+    Array2D<d8_flowdir_t> fds;
+    d8_flow_directions(elevations,fds);
+
+    Array2D<double> area, warea, rarea, tarea;
+    d8_flow_accum(fds,area);
+    d8_flow_accum(fds,ones,warea);
+    d8_flow_accum(fds,weights,retention,rarea);
+    d8_flow_accum_topological(fds,tarea);
+    REQUIRE( tarea==area );
+
+    for(int y=0;y<elevations.height();y++)
+    for(int x=0;x<elevations.width();x++){
+      if(fds.isNoData(x,y))
+        continue;
+      REQUIRE( warea(x,y)==area(x,y) );
+
+      //Each cell holds its own weight plus what its donors passed on
+      double expected = weights(x,y);
+      for(int n=1;n<=8;n++){
+        const int nx = x+dx[n];
+        const int ny = y+dy[n];
+        if(fds.inGrid(nx,ny) && !fds.isNoData(nx,ny) && fds(nx,ny)==d8_inverse[n])
+          expected += rarea(nx,ny)*(1-retention(nx,ny));
+      }
+      REQUIRE( rarea(x,y)==Approx(expected) );
+    }
+  }
+
+  SECTION("D-infinity"){
+    Array2D<float> fds;
+    dinf_flow_directions(elevations,fds);
+
+    Array2D<double> area, warea, rarea, zeros(elevations,0);
+    dinf_upslope_area(fds,area);
+    dinf_upslope_area(fds,ones,warea);
+    dinf_upslope_area(fds,ones,zeros,rarea);
+    REQUIRE( warea==area );
+    REQUIRE( rarea==area );
+  }
+}
+
+
+
+template<class T>
+void CheckD8RowsAgainstCells(){
+  //Small integer elevations guarantee plenty of ties between neighbours
+  for(int w=1;w<12;w++)
+  for(int h=1;h<9;h++){
+    Array2D<T> elevations(w,h,0);
+    elevations.setNoData(-9);
+    for(int y=0;y<h;y++)
+    for(int x=0;x<w;x++)
+      elevations(x,y) = ((x*7+y*13+x*y)%11==0)?-9:(x*3+y*5+x*y)%4;
+
+    Array2D<d8_flowdir_t> fds;
+    d8_flow_directions(elevations,fds);
+
+    for(int y=0;y<h;y++)
+    for(int x=0;x<w;x++)
+      if(elevations.isNoData(x,y))
+        REQUIRE( fds(x,y)==FLOWDIR_NO_DATA );
+      else
+        REQUIRE( fds(x,y)==d8_FlowDir(elevations,x,y) );
+  }
+}
+
+TEST_CASE("Checking D8 flow directions", "[FlowDirs]") {
+  SECTION("float")  { CheckD8RowsAgainstCells<float  >(); }
+  SECTION("double") { CheckD8RowsAgainstCells<double >(); }
+  SECTION("int16")  { CheckD8RowsAgainstCells<int16_t>(); }
+}
+
+
+
+template<class T>
+void CheckDinfRowsAgainstCells(){
+  //Small integer elevations guarantee plenty of ties between facets
+  for(int w=1;w<12;w++)
+  for(int h=1;h<9;h++){
+    Array2D<T> elevations(w,h,0);
+    elevations.setNoData(-9);
+    for(int y=0;y<h;y++)
+    for(int x=0;x<w;x++)
+      elevations(x,y) = ((x*7+y*13+x*y)%11==0)?-9:(x*3+y*5+x*y)%4;
+
+    Array2D<float> exact, approx;
+    dinf_flow_directions(elevations,exact);
+    dinf_flow_directions(elevations,approx,DINF_ANGLE_APPROX);
+
+    for(int y=0;y<h;y++)
+    for(int x=0;x<w;x++){
+      if(elevations.isNoData(x,y)){
+        REQUIRE( exact (x,y)==dinf_NO_DATA );
+        REQUIRE( approx(x,y)==dinf_NO_DATA );
+        continue;
+      }
+      REQUIRE( exact(x,y)==dinf_FlowDir(elevations,x,y) );
+      //The approximation's error, plus rounding to float
+      REQUIRE( std::abs(approx(x,y)-exact(x,y))<=1.2e-5+1e-6 );
+    }
+  }
+}
+
+TEST_CASE("Checking D-infinity flow directions", "[FlowDirs]") {
+  SECTION("float")  { CheckDinfRowsAgainstCells<float  >(); }
+  SECTION("double") { CheckDinfRowsAgainstCells<double >(); }
+  SECTION("int16")  { CheckDinfRowsAgainstCells<int16_t>(); }
+
+  SECTION("Irregular terrain"){
+    //Irregular elevations exercise the whole range of facet angles
+    Array2D<double> elevations(37,29,0);
+    elevations.setNoData(-9999);
+    for(int y=0;y<elevations.height();y++)
+    for(int x=0;x<elevations.width();x++)
+      elevations(x,y) = std::sin(0.37*x+0.11*y*y)+std::cos(0.23*x*y)+0.05*x;
+
+    Array2D<float> exact, approx;
+    dinf_flow_directions(elevations,exact);
+    dinf_flow_directions(elevations,approx,DINF_ANGLE_APPROX);
+    for(int y=0;y<elevations.height();y++)
+    for(int x=0;x<elevations.width();x++){
+      REQUIRE( exact(x,y)==dinf_FlowDir(elevations,x,y) );
+      REQUIRE( std::abs(approx(x,y)-exact(x,y))<=1.2e-5+1e-6 );
+    }
+
+    for(int i=0;i<=1000;i++){
+      const double t = i/1000.0;
+      REQUIRE( std::abs(dinf_atan_approx(t)-std::atan(t))<=1.2e-5 );
+    }
+  }
+}
+
+
+
+TEST_CASE("Checking flow proportions", "[FlowProps]") {
+  Array2D<float> elevations(23,17,0);
+  elevations.setNoData(-9999);
+  for(int y=0;y<elevations.height();y++)
+  for(int x=0;x<elevations.width();x++)
+    elevations(x,y) = ((x*7+y*13)%19==0)?-9999:(x-11)*(x-11)+(y-8)*(y-8)+(x*y)%5;
+
+  Array2D<double> weights(elevations,0), weights_plus_one(elevations,0);
+  for(int y=0;y<weights.height();y++)
+  for(int x=0;x<weights.width();x++){
+    weights(x,y)          = (x+2*y)%3;
+    weights_plus_one(x,y) = weights(x,y)+1;
+  }
+
+  FlowProportions props;
+  FP_Holmgren(elevations,props,4.0);
+
+  Array2D<double> fa(elevations), accum, waccum, waccum_plus_one;
+  FA_Holmgren(elevations,fa,4.0);
+  props.accumulate(accum);
+  props.accumulate(weights,waccum);
+  props.accumulate(weights_plus_one,waccum_plus_one);
+
+  for(int y=0;y<elevations.height();y++)
+  for(int x=0;x<elevations.width();x++){
+    if(elevations.isNoData(x,y)){
+      REQUIRE( accum.isNoData(x,y) );
+      continue;
+    }
+    REQUIRE( accum(x,y)==Approx(fa(x,y)).epsilon(1e-5) );
+    //Accumulation is linear in the weights
+    REQUIRE( waccum_plus_one(x,y)==Approx(waccum(x,y)+accum(x,y)).epsilon(1e-9) );
+  }
+
+  SECTION("Accumulation engines"){
+    //The parallel engine merges flows in a fixed order, so it may round
+    //differently than the serial engine, but not by much
+    Array2D<double> serial(elevations,0), parallel(elevations,0);
+    FA_Holmgren(elevations,serial,4.0);
+    FA_Holmgren(elevations,parallel,4.0,ACCUM_PARALLEL);
+    for(int y=0;y<elevations.height();y++)
+    for(int x=0;x<elevations.width();x++)
+      REQUIRE( parallel(x,y)==Approx(serial(x,y)).epsilon(1e-9) );
+
+    Array2D<double> d8_serial(elevations,0), d8_parallel(elevations,0);
+    FA_D8(elevations,d8_serial);
+    FA_D8(elevations,d8_parallel,ACCUM_PARALLEL);
+    REQUIRE( d8_parallel==d8_serial );
+  }
+
+  SECTION("Batched weightings"){
+    std::vector< Array2D<double> > batch_accums;
+    props.accumulate(std::vector< Array2D<double> >{weights,weights_plus_one},batch_accums);
+    REQUIRE( batch_accums.size()==2 );
+    REQUIRE( batch_accums[0]==waccum );
+    REQUIRE( batch_accums[1]==waccum_plus_one );
+  }
+
+  SECTION("Rho8 is reproducible"){
+    //Rho8 draws random numbers, so it is built on one thread and the same
+    //seed always gives the same proportions
+    FlowProportions first, second;
+    Array2D<double> first_accum, second_accum;
+    seed_rand(7);
+    FP_Rho8(elevations,first);
+    seed_rand(7);
+    FP_Rho8(elevations,second);
+    first.accumulate(first_accum);
+    second.accumulate(second_accum);
+    REQUIRE( first_accum==second_accum );
+  }
+
+  SECTION("D8 flow directions"){
+    Array2D<d8_flowdir_t> fds;
+    d8_flow_directions(elevations,fds);
+
+    Array2D<int32_t> area;
+    d8_flow_accum(fds,area);
+
+    FlowProportions d8props;
+    FP_D8Flowdirs(fds,d8props);
+    Array2D<int32_t> d8accum;
+    d8props.accumulate(d8accum);
+
+    for(int y=0;y<elevations.height();y++)
+    for(int x=0;x<elevations.width();x++)
+      if(!elevations.isNoData(x,y))
+        REQUIRE( d8accum(x,y)==area(x,y) );
+  }
+}
+
+
+
 TEST_CASE("Checking GridCellZk_pq", "[GridCell]") {
   GridCellZk_pq<int> pq;
 
@@ -137,6 +388,673 @@ TEST_CASE("Checking GridCellZk_pq", "[GridCell]") {
 }
 
 
+TEST_CASE("Checking Priority-Flood queues", "[GridCell]") {
+  Array2D<float> elevations(41,37,0);
+  elevations.setNoData(-9999);
+  for(int y=0;y<elevations.height();y++)
+  for(int x=0;x<elevations.width();x++)
+    elevations(x,y) = ((x*7+y*13)%23==0)?-9999:((x*31+y*17)%11)+0.5f*((x*y)%3);
+
+  Array2D<float> expected = elevations;
+  improved_priority_flood(expected);
+
+  const auto check = [&](Array2D<float> filled){
+    for(int y=0;y<elevations.height();y++)
+    for(int x=0;x<elevations.width();x++)
+      REQUIRE( filled(x,y)==expected(x,y) );
+  };
+
+  SECTION("Binary heap"){
+    auto filled = elevations;
+    improved_priority_flood<BinaryHeapQueue>(filled);
+    check(filled);
+  }
+
+  SECTION("4-ary heap"){
+    auto filled = elevations;
+    improved_priority_flood<QuaternaryHeapQueue>(filled);
+    check(filled);
+  }
+
+  SECTION("Pairing heap"){
+    auto filled = elevations;
+    original_priority_flood<PairingHeapQueue>(filled);
+    check(filled);
+  }
+
+  SECTION("Radix heap"){
+    auto filled = elevations;
+    original_priority_flood<RadixHeapQueue>(filled);
+    check(filled);
+  }
+
+  SECTION("Bucket queue"){
+    auto filled = elevations;
+    improved_priority_flood<BucketQueue>(filled);
+    check(filled);
+
+    //Zhou2016 floods NoData cells, so it is compared against itself
+    auto zhou_expected = elevations;
+    auto zhou          = elevations;
+    Zhou2016(zhou_expected);
+    Zhou2016<BucketQueue>(zhou);
+    REQUIRE( zhou==zhou_expected );
+  }
+
+  SECTION("Stable bucket queue"){
+    Array2D<d8_flowdir_t> fd_expected, fd;
+    priority_flood_flowdirs<GridCellZk_pq>(elevations,fd_expected);
+    priority_flood_flowdirs<StableBucketQueue>(elevations,fd);
+    for(int y=0;y<elevations.height();y++)
+    for(int x=0;x<elevations.width();x++)
+      REQUIRE( fd(x,y)==fd_expected(x,y) );
+
+    auto breached_expected = elevations;
+    auto breached          = elevations;
+    Lindsay2016(breached_expected, COMPLETE_BREACHING, false, std::numeric_limits<uint32_t>::max(), std::numeric_limits<float>::max());
+    Lindsay2016<GridCellZk_pq>(breached, COMPLETE_BREACHING, false, std::numeric_limits<uint32_t>::max(), std::numeric_limits<float>::max());
+    REQUIRE( breached==breached_expected );
+
+    //Cells of equal elevation, including NaN and both zeros, come out in the
+    //order they went in
+    GridCellZk_pq<float>     a;
+    StableBucketQueue<float> b;
+    const std::vector<float> zs = {2, 0.f, std::numeric_limits<float>::quiet_NaN(), -0.f, 2, 1, std::numeric_limits<float>::quiet_NaN(), 0.f, 1};
+    for(int i=0;i<(int)zs.size();i++){
+      a.emplace(i,0,zs[i]);
+      b.emplace(i,0,zs[i]);
+    }
+    while(!a.empty()){
+      REQUIRE( b.size()==a.size() );
+      REQUIRE( b.top().x==a.top().x );
+      a.pop();
+      b.pop();
+    }
+    REQUIRE( b.empty() );
+  }
+
+  SECTION("Key order"){
+    const std::vector<float> zs = {std::numeric_limits<float>::quiet_NaN(), -std::numeric_limits<float>::infinity(), -1e9f, -2.5f, -0.f, 1e-30f, 2.5f, 1e9f};
+    for(size_t i=1;i+1<zs.size();i++)
+      REQUIRE( ElevationKey<float>::get(zs[i])<ElevationKey<float>::get(zs[i+1]) );
+    REQUIRE( ElevationKey<float>::get(zs[0])<ElevationKey<float>::get(zs[1]) );
+    REQUIRE( ElevationKey<int16_t>::get(-5)<ElevationKey<int16_t>::get(3) );
+  }
+}
+
+
+TEST_CASE("Checking tile-parallel breaching", "[Breach]") {
+  //Terraced terrain with many flats and pits, some NoData holes, and a NoData
+  //border on one side
+  Array2D<float> dem(53,47,0);
+  dem.setNoData(-9999);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = (x==0 || (x*7+y*13)%61==0) ? -9999 : (float)(((x*31+y*17)%11)/3 + ((x/9+y/7)%4));
+
+  for(const int tile: {1, 5, 16, 100}){
+    auto breached = dem;
+    Lindsay2016Parallel(breached,tile,tile+2);
+
+    for(int y=0;y<dem.height();y++)
+    for(int x=0;x<dem.width();x++){
+      if(dem.isNoData(x,y)){
+        REQUIRE( breached.isNoData(x,y) );
+        continue;
+      }
+
+      //Only strict pits are raised, and only to just below their lowest
+      //neighbour
+      float lowest    = std::numeric_limits<float>::max();
+      bool  by_nodata = false;
+      for(int n=1;n<=8;n++){
+        if(!dem.inGrid(x+dx[n],y+dy[n]))
+          continue;
+        by_nodata |= dem.isNoData(x+dx[n],y+dy[n]);
+        lowest     = std::min(lowest,dem(x+dx[n],y+dy[n]));
+      }
+      if(dem.isEdgeCell(x,y) || by_nodata || dem(x,y)>=lowest)
+        REQUIRE( breached(x,y)<=dem(x,y) );
+      else
+        REQUIRE( breached(x,y)<lowest );
+
+      //Every other cell has a lower neighbour, so that it drains
+      if(dem.isEdgeCell(x,y) || by_nodata)
+        continue;
+      bool drains = false;
+      for(int n=1;n<=8;n++)
+        drains |= breached(x+dx[n],y+dy[n])<breached(x,y);
+      REQUIRE( drains );
+    }
+  }
+}
+
+
+
+TEST_CASE("Checking hybrid breaching and filling", "[Breach]") {
+  Array2D<float> dem(41,37,0);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = (float)(((x*31+y*17)%11)/3 + ((x/9+y/7)%4));
+  REQUIRE( HasDepressions(dem) );
+
+  //Short, shallow breaches only: whatever cannot be breached must be filled
+  for(const auto mode: {SELECTIVE_BREACHING, CONSTRAINED_BREACHING}){
+    auto breached = dem;
+    Lindsay2016(breached, mode, true, 2, 1.0f);
+    REQUIRE( !HasDepressions(breached) );
+  }
+}
+
+
+
+TEST_CASE("Checking IndexStream", "[Breach]") {
+  IndexStream stream(7);
+  for(uint32_t i=0;i<100;i++)
+    stream.push_back(3*i);
+  REQUIRE( stream.size()==100 );
+  REQUIRE( stream.spilledSize()==98 );
+
+  std::vector<uint32_t> read;
+  stream.forEach([&](const uint32_t i){ read.push_back(i); });
+  REQUIRE( read.size()==100 );
+  for(uint32_t i=0;i<100;i++)
+    REQUIRE( read[i]==3*i );
+}
+
+
+
+TEST_CASE("Checking the depression hierarchy", "[DepFill]") {
+  //Pits of several sizes, some nested and some on flats
+  Array2D<float> dem(47,43,0);
+  dem.setNoData(-9999);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = (float)(((x*31+y*17)%11)/3 + ((x/9+y/7)%4) + ((x-23)*(x-23)+(y-21)*(y-21))/150);
+
+  Array2D<dh_label_t> labels;
+  const auto deps = GetDepressionHierarchy(dem,labels);
+  REQUIRE( deps.size()>2 );
+
+  auto filled = dem;
+  improved_priority_flood(filled);
+
+  //A cell is raised by filling exactly when it is below the spill elevation
+  //of the top-level depression containing it
+  double fill_volume = 0;
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++){
+    fill_volume += filled(x,y)-dem(x,y);
+    dh_label_t d = labels(x,y);
+    while(d!=DH_OCEAN && deps[d].parent!=DH_OCEAN)
+      d = deps[d].parent;
+    if(d!=DH_OCEAN && dem(x,y)<deps[d].spill_elev)
+      REQUIRE( filled(x,y)==deps[d].spill_elev );
+    else
+      REQUIRE( filled(x,y)==dem(x,y) );
+  }
+
+  double dep_volume = 0;
+  for(dh_label_t d=1;d<deps.size();d++){
+    const auto &dd = deps[d];
+    REQUIRE( dd.parent!=DH_NO_VALUE );
+    REQUIRE( dd.spill_elev>=dd.pit_elev );
+    if(dd.parent==DH_OCEAN){
+      dep_volume += dd.volume;
+    } else {
+      //A depression is part of the one it merges into
+      REQUIRE( deps[dd.parent].cell_count>=dd.cell_count );
+      REQUIRE( deps[dd.parent].volume>=dd.volume );
+      REQUIRE( deps[dd.parent].spill_elev>=dd.spill_elev );
+    }
+    if(!dd.isLeaf())
+      REQUIRE( dd.cell_count>=deps[dd.lchild].cell_count+deps[dd.rchild].cell_count );
+  }
+  REQUIRE( dep_volume==Approx(fill_volume) );
+}
+
+
+
+TEST_CASE("Checking selective filling from the depression hierarchy", "[DepFill]") {
+  Array2D<float> dem(47,43,0);
+  dem.setNoData(-9999);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = (float)(((x*31+y*17)%11)/3 + ((x/9+y/7)%4) + ((x-23)*(x-23)+(y-21)*(y-21))/150);
+
+  Array2D<dh_label_t> labels;
+  const auto deps = GetDepressionHierarchy(dem,labels);
+
+  SECTION("Filling every depression"){
+    auto expected = dem;
+    improved_priority_flood(expected);
+    auto filled = dem;
+    FillDepressionsIf(filled,labels,deps,[](const Depression<float> &){ return true; });
+    REQUIRE( filled==expected );
+  }
+
+  SECTION("Filling by size"){
+    //The test DEM and expected outputs from "Checking depression filling"
+    const auto grid = [](const std::vector<std::string> &rows){
+      Array2D<float> g(10,10,0);
+      g.setNoData(9);
+      for(int y=0;y<10;y++)
+      for(int x=0;x<10;x++)
+        g(x,y) = rows[y][x]-'0';
+      return g;
+    };
+    const auto small = grid({
+      "0000000000", "0000000000", "0222200000", "0200222200", "0222200200",
+      "0020200200", "0022200200", "0000222200", "0000000000", "0000000000"
+    });
+    const auto max_dep_1 = grid({
+      "0000000000", "0000000000", "0222200000", "0200222200", "0222200200",
+      "0022200200", "0022200200", "0000222200", "0000000000", "0000000000"
+    });
+    const auto max_dep_2 = grid({
+      "0000000000", "0000000000", "0222200000", "0222222200", "0222200200",
+      "0022200200", "0022200200", "0000222200", "0000000000", "0000000000"
+    });
+    Array2D<dh_label_t> small_labels;
+    const auto small_deps = GetDepressionHierarchy(small,small_labels);
+
+    auto filled = small;
+    FillDepressionsBelow(filled,small_labels,small_deps,DepressionMeasure::CELLS,1);
+    REQUIRE( filled==max_dep_1 );
+    filled = small;
+    FillDepressionsBelow(filled,small_labels,small_deps,DepressionMeasure::CELLS,2);
+    REQUIRE( filled==max_dep_2 );
+    filled = small;
+    FillDepressionsBelow(filled,small_labels,small_deps,DepressionMeasure::CELLS,3);
+    REQUIRE( filled==max_dep_2 );
+    filled = small;
+    FillDepressionsBelow(filled,small_labels,small_deps,DepressionMeasure::CELLS,6);
+    REQUIRE( !HasDepressions(filled) );
+  }
+
+  SECTION("Nested depressions differ from improved_priority_flood_max_dep"){
+    //Two one-cell pits inside a large basin which is too big to fill
+    Array2D<float> nested(7,7,0);
+    nested.setNoData(-9999);
+    const std::vector<std::string> rows = {
+      "6666666", "6444446", "6433336", "6413136", "6433336", "6444446", "6666666"
+    };
+    for(int y=0;y<7;y++)
+    for(int x=0;x<7;x++)
+      nested(x,y) = rows[y][x]-'0';
+
+    //Priority-Flood leaves the pits as they are, since they are part of the
+    //unfilled basin
+    auto max_dep = nested;
+    improved_priority_flood_max_dep(max_dep,2);
+    REQUIRE( max_dep==nested );
+
+    //The hierarchy fills each pit to its own spill elevation
+    Array2D<dh_label_t> nested_labels;
+    const auto nested_deps = GetDepressionHierarchy(nested,nested_labels);
+    auto filled = nested;
+    FillDepressionsBelow(filled,nested_labels,nested_deps,DepressionMeasure::CELLS,2);
+    REQUIRE( filled(2,3)==3 );
+    REQUIRE( filled(4,3)==3 );
+    REQUIRE( filled(3,3)==3 );
+    REQUIRE( filled(1,1)==4 );
+  }
+
+  SECTION("Filling by depth and volume"){
+    for(const auto measure: {DepressionMeasure::DEPTH,DepressionMeasure::VOLUME}){
+      auto filled = dem;
+      FillDepressionsBelow(filled,labels,deps,measure,2);
+      for(int y=0;y<dem.height();y++)
+      for(int x=0;x<dem.width();x++){
+        REQUIRE( filled(x,y)>=dem(x,y) );
+        //Every remaining depression is too big to have been filled. Those
+        //which spill at the same level as their parent are judged with it.
+        dh_label_t d = labels(x,y);
+        if(d!=DH_OCEAN && dem(x,y)<deps[d].spill_elev && filled(x,y)==dem(x,y)){
+          while(deps[d].parent!=DH_OCEAN && deps[deps[d].parent].spill_elev==deps[d].spill_elev)
+            d = deps[d].parent;
+          const double m = (measure==DepressionMeasure::DEPTH) ? deps[d].depth() : deps[d].volume;
+          REQUIRE( m>2 );
+        }
+      }
+    }
+  }
+}
+
+
+
+TEST_CASE("Checking parallel depression detection", "[DepFill]") {
+  std::mt19937 gen(5);
+  for(int i=0;i<200;i++){
+    //Few distinct elevations give many flats
+    const int levels = std::uniform_int_distribution<int>(1,6)(gen);
+    Array2D<int> dem(std::uniform_int_distribution<int>(1,30)(gen),std::uniform_int_distribution<int>(1,30)(gen),0);
+    dem.setNoData(-9999);
+    for(unsigned int c=0;c<dem.size();c++)
+      dem(c) = std::uniform_int_distribution<int>(0,levels-1)(gen);
+    REQUIRE( HasDepressionsParallel(dem)==HasDepressions(dem) );
+
+    improved_priority_flood(dem);
+    REQUIRE( !HasDepressionsParallel(dem) );
+
+    //A flat pit in the middle of a flat, which a lower edge cell elsewhere
+    //does not drain
+    if(dem.width()>6 && dem.height()>6){
+      for(unsigned int c=0;c<dem.size();c++)
+        dem(c) = 5;
+      dem(2,2) = dem(3,2) = 4;
+      REQUIRE( HasDepressionsParallel(dem) );
+      dem(dem.width()-1,dem.height()-1) = 3;
+      REQUIRE( HasDepressionsParallel(dem) );
+      dem(3,2) = 5;
+      dem(2,2) = 6;
+      REQUIRE( !HasDepressionsParallel(dem) );
+    }
+  }
+}
+
+
+
+TEST_CASE("Checking tile-parallel watershed labelling", "[DepFill]") {
+  std::mt19937 gen(11);
+  Array2D<float> dem(53,47,0);
+  dem.setNoData(-9999);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = std::uniform_int_distribution<int>(0,9)(gen) + ((x/8+y/6)%3)*4;
+
+  auto expected = dem;
+  improved_priority_flood(expected);
+
+  auto serial = dem;
+  Array2D<int32_t> serial_labels;
+  priority_flood_watersheds(serial,serial_labels,true);
+  int32_t serial_max_label = 0;
+  for(unsigned int i=0;i<serial_labels.size();i++)
+    serial_max_label = std::max(serial_max_label,serial_labels(i));
+
+  for(const auto &tile: std::vector< std::pair<int,int> >{{1,1},{7,5},{16,16},{53,47},{100,100}}){
+    auto filled = dem;
+    Array2D<int32_t> labels;
+    parallel_priority_flood_watersheds(filled,labels,true,tile.first,tile.second);
+    REQUIRE( filled==expected );
+
+    auto unaltered = dem;
+    Array2D<int32_t> labels2;
+    parallel_priority_flood_watersheds(unaltered,labels2,false,tile.first,tile.second);
+    REQUIRE( unaltered==dem );
+    REQUIRE( labels2==labels );
+
+    //As in priority_flood_watersheds(), each edge cell seeds a watershed and
+    //every other cell drains at its filled elevation to a neighbour in its own
+    //watershed
+    std::set<int32_t> edge_labels;
+    for(int y=0;y<dem.height();y++)
+    for(int x=0;x<dem.width();x++){
+      REQUIRE( labels(x,y)>0 );
+      if(dem.isEdgeCell(x,y)){
+        edge_labels.insert(labels(x,y));
+        continue;
+      }
+      bool drains = false;
+      for(int n=1;n<=8;n++)
+        drains |= labels(x+dx[n],y+dy[n])==labels(x,y) && filled(x,y)==std::max(dem(x,y),filled(x+dx[n],y+dy[n]));
+      REQUIRE( drains );
+    }
+    REQUIRE( edge_labels.size()==(size_t)(2*dem.width()+2*dem.height()-4) );
+    REQUIRE( *edge_labels.rbegin()==serial_max_label );
+  }
+}
+
+
+
+TEST_CASE("Checking tile-parallel pit mask", "[DepFill]") {
+  std::mt19937 gen(13);
+  Array2D<float> dem(41,38,0);
+  dem.setNoData(-9999);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = std::uniform_int_distribution<int>(0,9)(gen) + ((x/7+y/5)%3)*4;
+  for(int i=0;i<20;i++)
+    dem(std::uniform_int_distribution<int>(0,dem.size()-1)(gen)) = dem.noData();
+
+  Array2D<uint8_t> expected;
+  pit_mask(dem,expected);
+
+  for(const auto &tile: std::vector< std::pair<int,int> >{{1,1},{6,9},{16,16},{100,100}}){
+    Array2D<uint8_t> mask;
+    parallel_pit_mask(dem,mask,tile.first,tile.second);
+    REQUIRE( mask==expected );
+  }
+}
+
+
+
+TEST_CASE("Checking tile-parallel flow directions", "[DepFill]") {
+  std::mt19937 gen(19);
+  Array2D<float> dem(43,37,0);
+  dem.setNoData(-9999);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = std::uniform_int_distribution<int>(0,9)(gen) + ((x/8+y/6)%3)*4;
+
+  //Deep pits straddling the borders of the 7x5 and 16x16 tiles, so that
+  //watersheds must be re-rooted across tiles, and holes of NoData
+  for(const auto &pit: std::vector< std::pair<int,int> >{{6,4},{13,9},{15,15},{31,15},{15,31},{27,19}}){
+    for(int y=pit.second-2;y<=pit.second+3;y++)
+    for(int x=pit.first -2;x<=pit.first +3;x++)
+      dem(x,y) = 30;
+    for(int y=pit.second;y<=pit.second+1;y++)
+    for(int x=pit.first ;x<=pit.first +1;x++)
+      dem(x,y) = 0;
+  }
+  for(int y=1;y<dem.height()-1;y++)
+  for(int x=1;x<dem.width()-1;x++)
+    if((x*7+y*13)%29==0)
+      dem(x,y) = dem.noData();
+
+  auto filled = dem;
+  improved_priority_flood(filled);
+
+  //Following the flow directions from a cell leads off the DEM, or into
+  //NoData, without visiting a cell twice and without rising above the cell's
+  //fill elevation. improved_priority_flood() does not drain into holes of
+  //NoData, so a path ending in one may stay below it.
+  const auto Check = [&](const Array2D<d8_flowdir_t> &fd){
+    std::vector<int64_t> visited(dem.size(),-1);
+    for(int y=0;y<dem.height();y++)
+    for(int x=0;x<dem.width();x++){
+      const int64_t start = dem.xyToI(x,y);
+      if(dem.isNoData(x,y)){
+        REQUIRE( (dem.isEdgeCell(x,y) || fd(x,y)==fd.noData()) );
+        continue;
+      }
+      int   cx = x, cy = y;
+      float highest = dem(x,y);
+      bool  hole    = false;
+      visited[start] = start;
+      while(!dem.isEdgeCell(cx,cy)){
+        const int d = fd(cx,cy);
+        REQUIRE( (d>=1 && d<=8) );
+        cx += dx[d];
+        cy += dy[d];
+        if(dem.isNoData(cx,cy)){
+          hole = true;
+          break;
+        }
+        REQUIRE( visited[dem.xyToI(cx,cy)]!=start );
+        visited[dem.xyToI(cx,cy)] = start;
+        highest = std::max(highest,dem(cx,cy));
+      }
+      if(hole)
+        REQUIRE( highest<=filled(x,y) );
+      else
+        REQUIRE( highest==filled(x,y) );
+    }
+  };
+
+  Array2D<d8_flowdir_t> serial;
+  priority_flood_flowdirs(dem,serial);
+  Check(serial);
+
+  for(const auto &tile: std::vector< std::pair<int,int> >{{1,1},{3,2},{7,5},{16,16},{100,100}}){
+    Array2D<d8_flowdir_t> fd;
+    parallel_priority_flood_flowdirs(dem,fd,tile.first,tile.second);
+    Check(fd);
+    for(int x=0;x<dem.width();x++)
+      REQUIRE( (fd(x,0)==serial(x,0) && fd(x,dem.height()-1)==serial(x,dem.height()-1)) );
+  }
+}
+
+
+
+TEST_CASE("Checking incremental depression filling", "[DepFill]") {
+  //Rough terrain has many small watersheds, so edits often open a way out for
+  //a neighbouring watershed, which must then be re-flooded too
+  std::mt19937 gen(7);
+  Array2D<float> dem(40,37,0);
+  dem.setNoData(-9999);
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++)
+    dem(x,y) = std::uniform_int_distribution<int>(0,20)(gen);
+
+  auto filled = dem;
+  Array2D<int32_t> labels;
+  priority_flood_watersheds(filled,labels,true);
+
+  for(int edit=0;edit<100;edit++){
+    //Raise or lower a small rectangle, sometimes all the way to the bottom to
+    //open new outlets
+    const int x0 = std::uniform_int_distribution<int>(0,dem.width() -1)(gen);
+    const int y0 = std::uniform_int_distribution<int>(0,dem.height()-1)(gen);
+    const int x1 = std::min(x0+std::uniform_int_distribution<int>(0,4)(gen),dem.width() -1);
+    const int y1 = std::min(y0+std::uniform_int_distribution<int>(0,4)(gen),dem.height()-1);
+    const int change = std::uniform_int_distribution<int>(-15,15)(gen);
+    for(int y=y0;y<=y1;y++)
+    for(int x=x0;x<=x1;x++)
+      dem(x,y) = (edit%5==0) ? 0 : std::max(0.0f,dem(x,y)+change);
+
+    incremental_priority_flood(dem,filled,labels,x0,y0,x1,y1);
+
+    auto expected = dem;
+    improved_priority_flood(expected);
+    REQUIRE( filled==expected );
+  }
+
+  //The labels are still those of a Priority-Flood: every cell is filled to the
+  //level of a neighbour in its own watershed, or is on the edge of the DEM
+  for(int y=0;y<dem.height();y++)
+  for(int x=0;x<dem.width();x++){
+    if(dem.isEdgeCell(x,y))
+      continue;
+    bool ok = false;
+    for(int n=1;n<=8;n++)
+      ok |= labels(x+dx[n],y+dy[n])==labels(x,y) && filled(x,y)==std::max(dem(x,y),filled(x+dx[n],y+dy[n]));
+    REQUIRE( ok );
+  }
+}
+
+
+
+TEST_CASE("Checking step-counting epsilon filling", "[DepFill]") {
+  std::mt19937 gen(17);
+  Array2D<float> dem(45,39,0);
+  dem.setNoData(-9999);
+  for(unsigned int i=0;i<dem.size();i++)
+    dem(i) = std::uniform_real_distribution<float>(0,10)(gen);
+  for(int i=0;i<10;i++)
+    dem(std::uniform_int_distribution<int>(0,dem.size()-1)(gen)) = dem.noData();
+
+  //Every data cell off the edge must have a lower neighbour
+  const auto Drains = [](const auto &filled){
+    for(int y=1;y<filled.height()-1;y++)
+    for(int x=1;x<filled.width()-1;x++){
+      if(filled.isNoData(x,y))
+        continue;
+      bool drains = false;
+      for(int n=1;n<=8;n++)
+        drains |= filled(x+dx[n],y+dy[n])<filled(x,y);
+      if(!drains)
+        return false;
+    }
+    return true;
+  };
+
+  SECTION("float"){
+    auto expected = dem;
+    priority_flood_epsilon(expected);
+    auto filled = dem;
+    priority_flood_epsilon_steps(filled);
+    REQUIRE( filled==expected );
+    REQUIRE( Drains(filled) );
+  }
+
+  SECTION("double"){
+    Array2D<double> ddem(dem,0);
+    ddem.setNoData(-9999);
+    for(unsigned int i=0;i<dem.size();i++)
+      ddem(i) = dem(i);
+    auto expected = ddem;
+    priority_flood_epsilon(expected);
+    auto filled = ddem;
+    priority_flood_epsilon_steps(filled);
+    REQUIRE( filled==expected );
+    REQUIRE( Drains(filled) );
+  }
+
+  SECTION("integer"){
+    Array2D<int16_t> idem(dem,0);
+    idem.setNoData(-9999);
+    for(unsigned int i=0;i<dem.size();i++)
+      idem(i) = dem.isNoData(i) ? idem.noData() : (int16_t)(dem(i)*100);
+    auto filled = idem;
+    priority_flood_epsilon_steps(filled);
+    REQUIRE( Drains(filled) );
+    for(unsigned int i=0;i<idem.size();i++)
+      REQUIRE( filled(i)>=idem(i) );
+  }
+
+  SECTION("NoData and ties"){
+    //NoData cells in the pit queue tie with NoData cells on the edge, so the
+    //order in which the two queues are taken decides how many steps (3,1) is
+    //raised by
+    Array2D<float> tied(5,4,0);
+    tied.setNoData(-9999);
+    const std::vector<std::string> rows = {"33232", "33002", "NN202", "N3300"};
+    for(int y=0;y<4;y++)
+    for(int x=0;x<5;x++)
+      tied(x,y) = (rows[y][x]=='N') ? tied.noData() : (float)(rows[y][x]-'0');
+    auto expected = tied;
+    priority_flood_epsilon(expected);
+    auto filled = tied;
+    priority_flood_epsilon_steps(filled);
+    REQUIRE( filled==expected );
+
+    //Small DEMs with few distinct elevations have many ties
+    for(int trial=0;trial<500;trial++){
+      Array2D<float> small(std::uniform_int_distribution<int>(3,8)(gen),std::uniform_int_distribution<int>(3,8)(gen),0);
+      small.setNoData(-9999);
+      for(unsigned int i=0;i<small.size();i++)
+        small(i) = (std::uniform_int_distribution<int>(0,4)(gen)==0) ? small.noData() : (float)std::uniform_int_distribution<int>(0,3)(gen);
+      auto sexpected = small;
+      priority_flood_epsilon(sexpected);
+      auto sfilled = small;
+      priority_flood_epsilon_steps(sfilled);
+      REQUIRE( sfilled==sexpected );
+    }
+  }
+
+  SECTION("raising by whole steps"){
+    REQUIRE( EpsilonSteps<float>::raise(std::numeric_limits<float>::max(),5)==std::numeric_limits<float>::max() );
+    REQUIRE( EpsilonSteps<float>::raise(-1.0f,1)==std::nextafter(-1.0f,2.0f) );
+    REQUIRE( EpsilonSteps<double>::raise(1.0,3)==std::nextafter(std::nextafter(std::nextafter(1.0,2.0),2.0),2.0) );
+    REQUIRE( EpsilonSteps<int16_t>::raise(32760,100)==32767 );
+    REQUIRE( EpsilonSteps<int16_t>::raise(-9999,0)==-9999 );
+  }
+}
+
+
+
 TEST_CASE("Checking depression filling", "[DepFill]") {
   Array2D<int> elevation_orig("depressions/testdem1.dem", false);
 